@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2023 Huawei Technologies Co.,Ltd.
+ *
+ * openGauss is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *
+ *          http://license.coscl.org.cn/MulanPSL2
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ * -------------------------------------------------------------------------
+ *
+ * recovery.cpp
+ *
+ * IDENTIFICATION
+ *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/benchmarks/recovery.cpp
+ * -------------------------------------------------------------------------
+ */
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <glog/logging.h>
+#include <getopt.h>
+
+#include "nvm_dbcore.h"
+#include "nvm_tuple.h"
+#include "nvmdb_thread.h"
+#include "nvm_table.h"
+#include "nvm_transaction.h"
+#include "nvm_access.h"
+
+using namespace NVMDB;
+
+ColumnDesc RecoveryColDesc[] = {COL_DESC(COL_TYPE_INT), VAR_DESC(COL_TYPE_VARCHAR, 64)};
+
+TableDesc RecoveryDesc = {&RecoveryColDesc[0], sizeof(RecoveryColDesc) / sizeof(ColumnDesc)};
+
+/*
+ * 测量崩溃恢复的耗时：留下若干个各自插入 rows 行、未提交的事务后重启，按不同的恢复线程数回滚，
+ * 扫描 未完成事务数 x 恢复线程数，报告挂载 undo 和后台回滚各自的耗时。
+ */
+class RecoveryBench {
+    std::string dataDir;
+    std::vector<int> inflights;
+    std::vector<int> workers;
+    int rowsPerTrx;
+
+    Table *table{nullptr};
+    uint32 seghead{0};
+
+    void LeaveInflightTrxs(int trxNum)
+    {
+        std::vector<std::thread> tids;
+        for (int i = 0; i < trxNum; i++) {
+            tids.emplace_back([this, i] {
+                InitThreadLocalVariables();
+                RAMTuple tuple(RecoveryDesc.col_desc, RecoveryDesc.row_len);
+                tuple.SetCol(0, (char *)&i);
+                Transaction *trx = GetCurrentTrxContext();
+                trx->Begin();
+                for (int j = 0; j < rowsPerTrx; j++) {
+                    HeapInsert(trx, table, &tuple);
+                }
+                /* 不提交直接退出，事务保持 IN_PROGRESS */
+                DestroyThreadLocalVariables();
+            });
+        }
+        for (auto &tid : tids) {
+            tid.join();
+        }
+    }
+
+public:
+    RecoveryBench(const char *dir, const std::vector<int> &inflights, const std::vector<int> &workers, int rows)
+        : dataDir(dir), inflights(inflights), workers(workers), rowsPerTrx(rows)
+    {}
+
+    void InitBench()
+    {
+        InitColumnDesc(RecoveryDesc.col_desc, RecoveryDesc.col_cnt, RecoveryDesc.row_len);
+        InitDB(dataDir.c_str());
+        InitThreadLocalVariables();
+        table = new Table(0, RecoveryDesc.row_len);
+        seghead = table->CreateSegment();
+    }
+
+    void EndBench()
+    {
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+    }
+
+    void RunOnce(int trxNum, int workerNum)
+    {
+        LeaveInflightTrxs(trxNum);
+
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+        SetUndoRecoveryWorkers(workerNum);
+        BootStrap(dataDir.c_str());
+        table->Mount(seghead);
+        InitThreadLocalVariables();
+
+        UndoRecoveryProgress progress;
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            GetUndoRecoveryProgress(&progress);
+        } while (!progress.m_finished);
+        StartupStat startup;
+        GetStartupStat(&startup);
+        if (progress.m_rolledBackTrxs != static_cast<uint64>(trxNum)) {
+            LOG(ERROR) << "rolled back " << progress.m_rolledBackTrxs << " of " << trxNum << " transactions";
+        }
+        LOG(INFO) << "in-flight " << trxNum << ", workers " << workerNum << ": undo mount "
+                  << startup.m_undoMountUs << " us, rollback " << progress.m_elapsedUs << " us, "
+                  << trxNum * 1000000.0 / std::max<uint64>(progress.m_elapsedUs, 1) << " trx/s" << std::endl;
+    }
+
+    void Run()
+    {
+        for (int trxNum : inflights) {
+            for (int workerNum : workers) {
+                RunOnce(trxNum, workerNum);
+            }
+        }
+    }
+};
+
+static struct option g_opts[] = {
+    {"help", no_argument, nullptr, 'h'},
+    {"inflight", required_argument, nullptr, 'i'},
+    {"workers", required_argument, nullptr, 'w'},
+    {"rows", required_argument, nullptr, 'r'},
+    {"dir", required_argument, nullptr, 'D'},
+};
+
+struct RecoveryOpts {
+    std::vector<int> inflights;
+    std::vector<int> workers;
+    int rows;
+    const char *dir;
+};
+
+static void UsageExit()
+{
+    LOG(INFO) << "Command line options : recovery <options> \n"
+              << "   -h --help              : Print help message \n"
+              << "   -i --inflight          : In-flight transaction numbers, separated by ',' (< 1024)\n"
+              << "   -w --workers           : Recovery worker numbers, separated by ','\n"
+              << "   -r --rows              : Rows inserted by each in-flight transaction\n"
+              << "   -D --dir               : Data directories, separated by ';'\n";
+    exit(EXIT_FAILURE);
+}
+
+static std::vector<int> ParseList(const char *arg)
+{
+    std::vector<int> result;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int value = atoi(item.c_str());
+        if (value <= 0) {
+            UsageExit();
+        }
+        result.push_back(value);
+    }
+    return result;
+}
+
+RecoveryOpts ParseOpt(int argc, char **argv)
+{
+    RecoveryOpts opt = {.inflights = {16, 64, 256}, .workers = {1, 2, 4, 8}, .rows = 1000, .dir = "recovery_dev"};
+
+    while (true) {
+        int idx = 0;
+        int c = getopt_long(argc, argv, "hi:w:r:D:", g_opts, &idx);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'i':
+                opt.inflights = ParseList(optarg);
+                break;
+            case 'w':
+                opt.workers = ParseList(optarg);
+                break;
+            case 'r':
+                opt.rows = atoi(optarg);
+                break;
+            case 'D':
+                opt.dir = optarg;
+                break;
+            case 'h':
+            default:
+                UsageExit();
+                break;
+        }
+    }
+    if (opt.rows <= 0 || opt.inflights.empty() || opt.workers.empty()) {
+        UsageExit();
+    }
+    for (int trxNum : opt.inflights) {
+        if (static_cast<uint32>(trxNum) >= NVMDB_MAX_THREAD_NUM) {
+            UsageExit();
+        }
+    }
+    return opt;
+}
+
+int main(int argc, char **argv)
+{
+    FLAGS_logtostderr = true;
+    google::InitGoogleLogging(argv[0]);
+
+    RecoveryOpts opt = ParseOpt(argc, argv);
+
+    RecoveryBench bench(opt.dir, opt.inflights, opt.workers, opt.rows);
+    bench.InitBench();
+    bench.Run();
+    bench.EndBench();
+    return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2023 Huawei Technologies Co.,Ltd.
+ *
+ * openGauss is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *
+ *          http://license.coscl.org.cn/MulanPSL2
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ * -------------------------------------------------------------------------
+ *
+ * undowrite.cpp
+ *
+ * IDENTIFICATION
+ *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/benchmarks/undowrite.cpp
+ * -------------------------------------------------------------------------
+ */
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <glog/logging.h>
+#include <getopt.h>
+
+#include "nvm_dbcore.h"
+#include "nvm_tuple.h"
+#include "nvmdb_thread.h"
+#include "nvm_table.h"
+#include "nvm_transaction.h"
+#include "nvm_access.h"
+
+using namespace NVMDB;
+
+/*
+ * 测量 undo 写入 NVM 的带宽：每个线程更新自己的一段行，每个事务更新 rows 行，每行产生一条 update undo。
+ * 报告记录本身和实际写到 NVM 的字节速率，以及每条记录的落盘次数。
+ */
+class UndoWriteBench {
+    std::string dataDir;
+    int workers;
+    int duration;
+    int rowsPerTrx;
+    int rowsPerWorker;
+    uint32 width;
+
+    ColumnDesc colDesc[2];
+    TableDesc desc;
+    Table *table{nullptr};
+    std::vector<RowId> rowIds;
+    std::atomic<bool> onWorking{true};
+    std::vector<uint64> commits;
+
+public:
+    UndoWriteBench(const char *dir, int workers, int duration, int rowsPerTrx, uint32 width)
+        : dataDir(dir), workers(workers), duration(duration), rowsPerTrx(rowsPerTrx), width(width),
+          colDesc{COL_DESC(COL_TYPE_INT), VAR_DESC(COL_TYPE_VARCHAR, width)}, commits(workers, 0)
+    {
+        rowsPerWorker = rowsPerTrx * 16;
+        desc = {&colDesc[0], sizeof(colDesc) / sizeof(ColumnDesc)};
+    }
+
+    void InitBench()
+    {
+        InitColumnDesc(desc.col_desc, desc.col_cnt, desc.row_len);
+        InitDB(dataDir.c_str());
+        InitThreadLocalVariables();
+        table = new Table(0, desc.row_len);
+        table->CreateSegment();
+
+        RAMTuple tuple(desc.col_desc, desc.row_len);
+        std::string payload(width, 'a');
+        tuple.SetCol(1, const_cast<char *>(payload.c_str()));
+        Transaction *trx = GetCurrentTrxContext();
+        trx->Begin();
+        for (int i = 0; i < workers * rowsPerWorker; i++) {
+            tuple.SetCol(0, (char *)&i);
+            rowIds.push_back(HeapInsert(trx, table, &tuple));
+        }
+        trx->Commit();
+    }
+
+    void EndBench()
+    {
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+    }
+
+    void UpdateFunc(int seq)
+    {
+        InitThreadLocalVariables();
+        RAMTuple tuple(desc.col_desc, desc.row_len);
+        Transaction *trx = GetCurrentTrxContext();
+        int begin = seq * rowsPerWorker;
+        int next = 0;
+        int value = 0;
+        while (onWorking) {
+            trx->Begin();
+            for (int i = 0; i < rowsPerTrx; i++) {
+                RowId rowId = rowIds[begin + next];
+                next = (next + 1) % rowsPerWorker;
+                value++;
+                tuple.UpdateCol(0, (char *)&value);
+                HAM_STATUS status = HeapUpdate(trx, table, rowId, &tuple);
+                Assert(status == HAM_SUCCESS);
+            }
+            trx->Commit();
+            commits[seq]++;
+        }
+        DestroyThreadLocalVariables();
+    }
+
+    void Run()
+    {
+        UndoWriteStat before;
+        GetUndoWriteStat(&before);
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> updateTids;
+        for (int i = 0; i < workers; i++) {
+            updateTids.emplace_back(&UndoWriteBench::UpdateFunc, this, i);
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(duration));
+        onWorking = false;
+        for (auto &tid : updateTids) {
+            tid.join();
+        }
+
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        UndoWriteStat after;
+        GetUndoWriteStat(&after);
+        Report(after.m_records - before.m_records, after.m_recordBytes - before.m_recordBytes,
+               after.m_nvmBytes - before.m_nvmBytes, after.m_drains - before.m_drains, seconds);
+    }
+
+    void Report(uint64 records, uint64 recordBytes, uint64 nvmBytes, uint64 drains, double seconds)
+    {
+        static const double MB = 1024.0 * 1024;
+        uint64 totalCommit = 0;
+        for (int i = 0; i < workers; i++) {
+            totalCommit += commits[i];
+        }
+        LOG(INFO) << "threads " << workers << ", rows/trx " << rowsPerTrx << ", width " << width << ": "
+                  << totalCommit / seconds << " trx/s, " << records / seconds << " undo records/s, "
+                  << recordBytes / MB / seconds << " MB/s record, " << nvmBytes / MB / seconds
+                  << " MB/s nvm, " << drains * 1.0 / std::max<uint64>(records, 1) << " drains/record"
+                  << std::endl;
+    }
+};
+
+static struct option g_opts[] = {
+    {"help", no_argument, nullptr, 'h'},
+    {"threads", required_argument, nullptr, 't'},
+    {"duration", required_argument, nullptr, 'd'},
+    {"rows", required_argument, nullptr, 'r'},
+    {"width", required_argument, nullptr, 'w'},
+    {"dir", required_argument, nullptr, 'D'},
+};
+
+struct UndoWriteOpts {
+    int threads;
+    int duration;
+    int rows;
+    int width;
+    const char *dir;
+};
+
+static void UsageExit()
+{
+    LOG(INFO) << "Command line options : undowrite <options> \n"
+              << "   -h --help              : Print help message \n"
+              << "   -t --threads           : Thread num\n"
+              << "   -d --duration          : Duration time: (second)\n"
+              << "   -r --rows              : Rows updated per transaction\n"
+              << "   -w --width             : Width of the varchar column (bytes)\n"
+              << "   -D --dir               : Data directories, separated by ';'\n";
+    exit(EXIT_FAILURE);
+}
+
+UndoWriteOpts ParseOpt(int argc, char **argv)
+{
+    UndoWriteOpts opt = {.threads = 8, .duration = 10, .rows = 16, .width = 128, .dir = "undo_write_dev"};
+
+    while (true) {
+        int idx = 0;
+        int c = getopt_long(argc, argv, "ht:d:r:w:D:", g_opts, &idx);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 't':
+                opt.threads = atoi(optarg);
+                break;
+            case 'd':
+                opt.duration = atoi(optarg);
+                break;
+            case 'r':
+                opt.rows = atoi(optarg);
+                break;
+            case 'w':
+                opt.width = atoi(optarg);
+                break;
+            case 'D':
+                opt.dir = optarg;
+                break;
+            case 'h':
+            default:
+                UsageExit();
+                break;
+        }
+    }
+    if (opt.threads <= 0 || opt.duration <= 0 || opt.rows <= 0 || opt.width <= 0) {
+        UsageExit();
+    }
+    return opt;
+}
+
+int main(int argc, char **argv)
+{
+    FLAGS_logtostderr = true;
+    google::InitGoogleLogging(argv[0]);
+
+    UndoWriteOpts opt = ParseOpt(argc, argv);
+
+    UndoWriteBench bench(opt.dir, opt.threads, opt.duration, opt.rows, opt.width);
+    bench.InitBench();
+    bench.Run();
+    bench.EndBench();
+    return 0;
+}
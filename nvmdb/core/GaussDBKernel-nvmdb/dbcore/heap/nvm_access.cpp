@@ -39,6 +39,52 @@ RowId HeapUpperRowId(Table *table)
     return rowid_map->GetUpperRowId();
 }
 
+static bool HeapTupleIsDead(NVMTuple *tuple, uint64 minSnapshot)
+{
+    if (!NVMTupleIsUsed(tuple)) {
+        return true;
+    }
+    if (!NVMTupleDeleted(tuple)) {
+        return false;
+    }
+    if (TrxInfoIsCsn(tuple->m_trxInfo)) {
+        return tuple->m_trxInfo < minSnapshot;
+    }
+    TransactionInfo trxInfo;
+    if (!GetTransactionInfo((TransactionSlotPtr)tuple->m_trxInfo, &trxInfo)) {
+        /* 事务槽已回收：回滚会恢复 tuple 头，仍是删除状态说明删除早已提交 */
+        return true;
+    }
+    return trxInfo.status == TRX_COMMITTED && trxInfo.CSN < minSnapshot;
+}
+
+uint32 HeapShrink(Table *table)
+{
+    Assert(table->Ready());
+    RowIdMap *rowidMap = table->m_rowidMap;
+    VecStore *vecstore = rowidMap->GetVecStore();
+    uint32 tupleLen = vecstore->GetTupleLen();
+    uint64 minSnapshot = GetMinSnapshot();
+    uint32 released = 0;
+
+    for (uint32 pageIdx = 0; pageIdx < vecstore->GetLeafPageNum(); pageIdx++) {
+        char *page = vecstore->LeafPagePoint(pageIdx);
+        if (page == nullptr) {
+            continue;
+        }
+        bool dead = true;
+        uint32 tupleNum = vecstore->LeafPageTupleNum(pageIdx);
+        for (uint32 i = 0; i < tupleNum && dead; i++) {
+            dead = HeapTupleIsDead(reinterpret_cast<NVMTuple *>(page + i * tupleLen), minSnapshot);
+        }
+        if (dead) {
+            rowidMap->ReleaseLeafPage(pageIdx);
+            released++;
+        }
+    }
+    return released;
+}
+
 RowId HeapInsert(Transaction *trx, Table *table, RAMTuple *tuple)
 {
     Assert(table->m_rowLen == tuple->m_rowLen);
@@ -52,17 +98,22 @@ RowId HeapInsert(Transaction *trx, Table *table, RAMTuple *tuple)
 
     /* 分配一个RowId，这时候只是内存中的元数据修改了， NVM上的 NVMTUPLE_USED 标志位还没设上 */
     RowId rowid = rowid_map->InsertVersion();
-    RowIdMapEntry *row_entry = rowid_map->GetEntry(rowid);
-    char *data = row_entry->m_nvmAddr;
+    RowIdMapEntry row_entry = rowid_map->GetEntry(rowid);
+    char *data = row_entry.NvmAddr();
 
-    PrepareInsertUndo(trx, table->SegmentHead(), rowid, tuple->payload());
+    if (UndoRecPtrIsInValid(PrepareInsertUndo(trx, table->SegmentHead(), rowid, tuple->payload()))) {
+        /* 分配到的 RowId 没有设上 USED 标志，留作空洞 */
+        return HAM_TRANSACTION_WAIT_ABORT;
+    }
 
-    row_entry->Lock();
+    row_entry.Lock();
     /* Write tuple to NVM; note marking head as used */
     tuple->InitHead(trx->GetTrxSlotLocation(), InvalidUndoRecPtr, NVMTUPLE_USED, 0);
     tuple->Serialize(data, RealTupleSize(table->GetRowLen()));
-    row_entry->sync_dram_cache(RealTupleSize(tuple->payload()));
-    row_entry->Unlock();
+    row_entry.sync_dram_cache(RealTupleSize(tuple->payload()));
+    row_entry.Unlock();
+    /* 在 USED 标志之后计数，宕机回滚时计数只会偏小 */
+    rowid_map->GetVecStore()->MarkUsed(rowid);
 
     trx->PushWriteSet(row_entry);
     return rowid;
@@ -76,14 +127,15 @@ HAM_STATUS HeapRead(Transaction *trx, Table *table, RowId rowid, RAMTuple *tuple
     }
 
     RowIdMap *rowid_map = table->m_rowidMap;
-    RowIdMapEntry *row_entry = rowid_map->GetEntry(rowid, true);
-    if (row_entry == nullptr) {
-        return HAM_READ_ROW_NOT_USED;
+    RowIdMapEntry row_entry = rowid_map->GetEntry(rowid, true);
+    if (!row_entry.IsValid()) {
+        /* 页面在最小快照之后才被释放，作废的快照可能还应该看到其中的行 */
+        return trx->SnapshotTooOld() ? HAM_SNAPSHOT_TOO_OLD : HAM_READ_ROW_NOT_USED;
     }
     HAM_STATUS status;
 
-    row_entry->Lock();
-    char *data = row_entry->read_dram_cache(RealTupleSize(tuple->payload()));
+    row_entry.Lock();
+    char *data = row_entry.read_dram_cache(RealTupleSize(tuple->payload()));
     tuple->Deserialize(data);
     if (!tuple->IsInUsed()) {
         status = HAM_READ_ROW_NOT_USED;
@@ -100,15 +152,24 @@ HAM_STATUS HeapRead(Transaction *trx, Table *table, RowId rowid, RAMTuple *tuple
             goto end;
         } else if (result == TM_Invisible || result == TM_Aborted || result == TM_BeingModified) {
             if (tuple->HasPreVersion()) {
+                /* 读之后再查一次：检查通过说明读的时候 undo 还没有被回收 */
+                if (trx->SnapshotTooOld()) {
+                    status = HAM_SNAPSHOT_TOO_OLD;
+                    goto end;
+                }
                 tuple->FetchPreVersion(trx->undoRecordCache);
+                if (trx->SnapshotTooOld()) {
+                    status = HAM_SNAPSHOT_TOO_OLD;
+                    goto end;
+                }
             } else {
-                status = HAM_NO_VISIBLE_VERSION;
+                status = trx->SnapshotTooOld() ? HAM_SNAPSHOT_TOO_OLD : HAM_NO_VISIBLE_VERSION;
                 goto end;
             }
         }
     }
 end:
-    row_entry->Unlock();
+    row_entry.Unlock();
     return status;
 }
 
@@ -121,21 +182,21 @@ HAM_STATUS HeapUpdate(Transaction *trx, Table *table, RowId rowid, RAMTuple *tup
 
     trx->PrepareUndo();
     RowIdMap *rowid_map = table->m_rowidMap;
-    RowIdMapEntry *row_entry = rowid_map->GetEntry(rowid);
-    char *data = row_entry->m_nvmAddr;
+    RowIdMapEntry row_entry = rowid_map->GetEntry(rowid);
+    char *data = row_entry.NvmAddr();
 
     NVMTuple *nvm_tuple = (NVMTuple *)data;
-    row_entry->Lock();
+    row_entry.Lock();
 
     TM_Result result = trx->SatisifiedUpdate(nvm_tuple);
     if (result == TM_Invisible || result == TM_BeingModified) {
-        row_entry->Unlock();
+        row_entry.Unlock();
         trx->WaitAbort();
         return HAM_UPDATE_CONFLICT;
     } else {
         Assert(result == TM_Ok);
         if (NVMTupleDeleted(nvm_tuple)) {
-            row_entry->Unlock();
+            row_entry.Unlock();
             /* 一个”可见“的删除操作，说明尝试更新一个被删除的 tuple，需要报 error */
             trx->WaitAbort();
             return HAM_ROW_DELETED;
@@ -147,10 +208,14 @@ HAM_STATUS HeapUpdate(Transaction *trx, Table *table, RowId rowid, RAMTuple *tup
         tuple->GetUpdatedCols(updated_cols, update_cnt, update_len);
         UndoRecPtr undo_ptr = PrepareUpdateUndo(trx, table->SegmentHead(), rowid, nvm_tuple,
                                                 UndoUpdatePara{updated_cols, update_cnt, update_len});
+        if (UndoRecPtrIsInValid(undo_ptr)) {
+            row_entry.Unlock();
+            return HAM_TRANSACTION_WAIT_ABORT;
+        }
         tuple->InitHead(trx->GetTrxSlotLocation(), undo_ptr, nvm_tuple->m_flag1, nvm_tuple->m_flag2);
         tuple->Serialize((char *)nvm_tuple, RealTupleSize(table->GetRowLen())); /* inplace update */
-        row_entry->sync_dram_cache(RealTupleSize(tuple->payload()));
-        row_entry->Unlock();
+        row_entry.sync_dram_cache(RealTupleSize(tuple->payload()));
+        row_entry.Unlock();
 
         trx->PushWriteSet(row_entry);
 
@@ -166,30 +231,34 @@ HAM_STATUS HeapDelete(Transaction *trx, Table *table, RowId rowid)
 
     trx->PrepareUndo();
     RowIdMap *rowid_map = table->m_rowidMap;
-    RowIdMapEntry *row_entry = rowid_map->GetEntry(rowid);
-    char *data = row_entry->m_nvmAddr;
+    RowIdMapEntry row_entry = rowid_map->GetEntry(rowid);
+    char *data = row_entry.NvmAddr();
 
     NVMTuple *nvm_tuple = (NVMTuple *)data;
-    row_entry->Lock();
+    row_entry.Lock();
     TM_Result result = trx->SatisifiedUpdate(nvm_tuple);
     if (result == TM_Invisible || result == TM_BeingModified) {
-        row_entry->Unlock();
+        row_entry.Unlock();
         trx->WaitAbort();
         return HAM_UPDATE_CONFLICT;
     } else {
         Assert(result == TM_Ok);
         if (NVMTupleDeleted(nvm_tuple)) {
-            row_entry->Unlock();
+            row_entry.Unlock();
             trx->WaitAbort();
             return HAM_ROW_DELETED;
         }
 
         UndoRecPtr undo_ptr = PrepareDeleteUndo(trx, table->SegmentHead(), rowid, nvm_tuple);
+        if (UndoRecPtrIsInValid(undo_ptr)) {
+            row_entry.Unlock();
+            return HAM_TRANSACTION_WAIT_ABORT;
+        }
         NVMTupleSetDeleted(nvm_tuple);
         nvm_tuple->m_trxInfo = trx->GetTrxSlotLocation();
         nvm_tuple->m_prev = undo_ptr;
-        row_entry->sync_dram_cache_deleted();
-        row_entry->Unlock();
+        row_entry.sync_dram_cache_deleted();
+        row_entry.Unlock();
         trx->PushWriteSet(row_entry);
         return HAM_SUCCESS;
     }
@@ -29,15 +29,33 @@ namespace NVMDB {
 GlobalBitMap::GlobalBitMap(size_t size) : m_size(size)
 {
     assert(size >= BITMAP_UNIT_SIZE);
-    m_map = new uint64[m_size / BITMAP_UNIT_SIZE];
-    size_t memSize = m_size / BITMAP_UNIT_SIZE * sizeof(uint64);
-    int ret = memset_s(m_map, memSize, 0, memSize);
-    SecureRetCheck(ret);
+    m_unitNum = m_size / BITMAP_UNIT_SIZE;
+    m_chunkNum = (m_unitNum + CHUNK_UNITS - 1) / CHUNK_UNITS;
+    m_chunks = new std::atomic<uint64 *>[m_chunkNum]();
 }
 
 GlobalBitMap::~GlobalBitMap()
 {
-    delete[] m_map;
+    for (size_t i = 0; i < m_chunkNum; i++) {
+        delete[] m_chunks[i].load();
+    }
+    delete[] m_chunks;
+}
+
+uint64 *GlobalBitMap::GetUnit(uint32 aryoff)
+{
+    Assert(aryoff < m_unitNum);
+    std::atomic<uint64 *> &chunkEntry = m_chunks[aryoff / CHUNK_UNITS];
+    uint64 *chunk = chunkEntry.load(std::memory_order_acquire);
+    if (unlikely(chunk == nullptr)) {
+        uint64 *newChunk = new uint64[CHUNK_UNITS]();
+        if (chunkEntry.compare_exchange_strong(chunk, newChunk)) {
+            chunk = newChunk;
+        } else {
+            delete[] newChunk;
+        }
+    }
+    return &chunk[aryoff % CHUNK_UNITS];
 }
 
 /* Find first zero in the data and tas it, return the position [0, 63] or 64 meaning no zero */
@@ -90,8 +108,8 @@ uint32 GlobalBitMap::SyncAcquire()
 {
 restart:
     uint32 start = m_startHint;
-    for (uint32 aryoff = start; aryoff < m_size / BITMAP_UNIT_SIZE; aryoff++) {
-        uint32 ffz = FFZAndSet(&m_map[aryoff]);
+    for (uint32 aryoff = start; aryoff < m_unitNum; aryoff++) {
+        uint32 ffz = FFZAndSet(GetUnit(aryoff));
         if (ffz == BITMAP_UNIT_SIZE) {
             continue;
         }
@@ -116,8 +134,9 @@ void GlobalBitMap::SyncRelease(uint32 bit)
     uint32 aryoff = AryOffset(bit);
     uint64 mask = 1LLU << BitOffset(bit);
 
-    Assert(m_map[aryoff] & mask);
-    uint64 oldv = __sync_fetch_and_and(&m_map[aryoff], ~mask);
+    uint64 *unit = GetUnit(aryoff);
+    Assert(*unit & mask);
+    uint64 oldv = __sync_fetch_and_and(unit, ~mask);
     Assert(oldv & mask);
 
     if (aryoff < m_startHint) {
@@ -125,4 +144,20 @@ void GlobalBitMap::SyncRelease(uint32 bit)
     }
 }
 
+void GlobalBitMap::SyncSet(uint32 bit)
+{
+    uint32 aryoff = AryOffset(bit);
+    uint64 mask = 1LLU << BitOffset(bit);
+
+    __sync_fetch_and_or(GetUnit(aryoff), mask);
+
+    /* 不推进 m_startHint，前面空闲的 bit 仍要优先分配 */
+    uint32 oldHbit = m_highestBit.load();
+    while (oldHbit < bit) {
+        if (m_highestBit.compare_exchange_weak(oldHbit, bit)) {
+            break;
+        }
+    }
+}
+
 }  // namespace NVMDB
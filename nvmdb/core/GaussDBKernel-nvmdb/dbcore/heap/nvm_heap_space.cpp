@@ -19,6 +19,11 @@
  *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/dbcore/heap/nvm_heap_space.cpp
  * -------------------------------------------------------------------------
  */
+#include <thread>
+#include <deque>
+#include <condition_variable>
+
+#include "nvm_rowid_map.h"
 #include "nvm_heap_space.h"
 
 namespace NVMDB {
@@ -26,19 +31,118 @@ namespace NVMDB {
 static const char HEAP_FILENAME[] = "heap";
 TableSpace *g_heapSpace = nullptr;
 
+/* 每轮最多归还的 extent 数，轮与轮之间让出 CPU，避免大表回收长时间占用空闲链表 */
+static const uint32 RECLAIM_EXTENTS_PER_ROUND = 64;
+
+struct ReclaimTask {
+    int m_slot; /* 持久化队列中的槽位 */
+    uint32 m_seghead;
+};
+
+static std::thread g_heapReclaim;
+static std::mutex g_reclaimMtx;
+static std::condition_variable g_reclaimCv;
+static std::deque<ReclaimTask> g_reclaimQueue;
+static std::atomic<bool> g_doReclaim{false};
+
+/* 退出时中断的任务已持久化，下次启动后继续 */
+static void ReclaimSegment(const ReclaimTask &task)
+{
+    /* 必须先摘掉 RowIdMap，segment 页号被复用后才不会命中旧缓存 */
+    DropRowIdMap(task.m_seghead);
+    while (!g_heapSpace->FreeSegmentChunk(task.m_seghead, RECLAIM_EXTENTS_PER_ROUND)) {
+        if (!g_doReclaim) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    /* 先清除槽位再归还 head：宕机最多泄漏 head，不会重复回收 */
+    g_heapSpace->ReclaimDone(task.m_slot);
+    uint32 seghead = task.m_seghead;
+    g_heapSpace->FreeExtent(&seghead);
+}
+
+static void HeapReclaim()
+{
+    pthread_setname_np(pthread_self(), "NVM HeapReclaim");
+    std::unique_lock<std::mutex> lock(g_reclaimMtx);
+    while (true) {
+        g_reclaimCv.wait(lock, [] { return !g_reclaimQueue.empty() || !g_doReclaim; });
+        if (g_reclaimQueue.empty()) {
+            break;
+        }
+        ReclaimTask task = g_reclaimQueue.front();
+        g_reclaimQueue.pop_front();
+        lock.unlock();
+        ReclaimSegment(task);
+        lock.lock();
+    }
+}
+
+static void PushReclaimTask(const ReclaimTask &task)
+{
+    {
+        std::lock_guard<std::mutex> lockGuard(g_reclaimMtx);
+        g_reclaimQueue.push_back(task);
+    }
+    g_reclaimCv.notify_one();
+}
+
+static void StartHeapReclaim()
+{
+    std::vector<std::pair<int, uint32>> pending;
+    g_heapSpace->ReclaimPending(&pending);
+    for (auto &item : pending) {
+        PushReclaimTask(ReclaimTask{item.first, item.second});
+    }
+    g_doReclaim = true;
+    g_heapReclaim = std::thread(HeapReclaim);
+}
+
+static void StopHeapReclaim()
+{
+    {
+        std::lock_guard<std::mutex> lockGuard(g_reclaimMtx);
+        g_doReclaim = false;
+    }
+    g_reclaimCv.notify_all();
+    if (g_heapReclaim.joinable()) {
+        g_heapReclaim.join();
+    }
+}
+
+void HeapFreeSegmentAsync(uint32 seghead)
+{
+    int slot = g_heapSpace->ReclaimEnqueue(seghead);
+    PushReclaimTask(ReclaimTask{slot, seghead});
+}
+
+void HeapDropTable(uint32 oid)
+{
+    uint32 seghead = g_heapSpace->SearchTable(oid);
+    if (NVMBlockNumberIsInvalid(seghead)) {
+        return;
+    }
+    int slot = g_heapSpace->ReclaimEnqueue(seghead, oid);
+    PushReclaimTask(ReclaimTask{slot, seghead});
+}
+
 void HeapCreate(const char *dir)
 {
     g_heapSpace = new TableSpace(dir, HEAP_FILENAME);
     g_heapSpace->Create();
+    StartHeapReclaim();
 }
 void HeapBootStrap(const char *dir)
 {
     g_heapSpace = new TableSpace(dir, HEAP_FILENAME);
     g_heapSpace->Mount();
+    StartHeapReclaim();
 }
 
 void HeapExitProcess()
 {
+    StopHeapReclaim();
     if (g_heapSpace != nullptr) {
         g_heapSpace->UnMount();
         delete g_heapSpace;
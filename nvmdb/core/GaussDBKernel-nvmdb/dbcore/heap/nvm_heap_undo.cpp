@@ -24,6 +24,8 @@
 #include "nvm_undo_api.h"
 #include "nvm_transaction.h"
 #include "nvm_vecstore.h"
+#include "nvm_heap_space.h"
+#include "nvm_heap_undo.h"
 
 namespace NVMDB {
 static constexpr size_t UNDO_DATA_MAX_SIZE = MAX_UNDO_RECORD_CACHE_SIZE - NVMTupleHeadSize;
@@ -106,6 +108,7 @@ UndoRecPtr PrepareUpdateUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMT
     return undoPtr;
 }
 
+/* 删除只改 tuple 头，数据仍原样留在 NVM 上，undo 里只记 tuple 头 */
 UndoRecPtr PrepareDeleteUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMTuple *oldTuple)
 {
     auto *undo = reinterpret_cast<UndoRecord *>(trx->undoRecordCache);
@@ -113,7 +116,7 @@ UndoRecPtr PrepareDeleteUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMT
     undo->m_rowLen = oldTuple->m_len;
     undo->m_seghead = seghead;
     undo->m_rowId = rowid;
-    undo->m_payload = oldTuple->m_len + NVMTupleHeadSize;
+    undo->m_payload = NVMTupleHeadSize;
     undo->m_pre = 0;
 #ifndef NDEBUG
     undo->m_trxSlot = trx->GetTrxSlotLocation();
@@ -124,32 +127,76 @@ UndoRecPtr PrepareDeleteUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMT
     return undoPtr;
 }
 
-void UndoInsert(UndoRecord *undo)
+UndoRecPtr PrepareTruncateUndo(Transaction *trx, uint32 oid, uint32 oldSeg, uint32 newSeg)
 {
-    RowIdMap *rowidMap = GetRowIdMap(undo->m_seghead, undo->m_rowLen);
-    RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId);
-    row->Lock();
-    NVMTupleSetUnUsed(reinterpret_cast<NVMTuple *>(row->m_nvmAddr));
-    if (row->m_dramCache != nullptr) {
-        NVMTupleSetUsed(reinterpret_cast<NVMTuple *>(row->m_dramCache));
+    auto *undo = reinterpret_cast<UndoRecord *>(trx->undoRecordCache);
+    undo->m_undoType = TableTruncateUndo;
+    undo->m_rowLen = 0;
+    undo->m_seghead = newSeg;
+    undo->m_rowId = 0;
+    undo->m_payload = sizeof(TruncateUndoData);
+    undo->m_pre = 0;
+#ifndef NDEBUG
+    undo->m_trxSlot = trx->GetTrxSlotLocation();
+#endif
+    auto *data = reinterpret_cast<TruncateUndoData *>(undo->data);
+    data->m_oid = oid;
+    data->m_oldSeg = oldSeg;
+    data->m_newSeg = newSeg;
+    UndoRecPtr undoPtr = trx->InsertUndoRecord(undo);
+    return undoPtr;
+}
+
+/* 连续的 undo 记录属于同一张表时直接复用上一次的 RowIdMap */
+static inline RowIdMap *GetUndoRowIdMap(UndoRecord *undo, UndoReplayContext *context)
+{
+    if (context->m_rowidMap == nullptr || context->m_seghead != undo->m_seghead) {
+        context->m_rowidMap = GetRowIdMap(undo->m_seghead, undo->m_rowLen);
+        context->m_seghead = undo->m_seghead;
+    }
+    Assert(context->m_rowidMap->GetRowLen() == undo->m_rowLen);
+    return context->m_rowidMap;
+}
+
+/* 同一张表相邻的一组行落在同一个 lane，并行回滚时一个线程连续回放同一个页面上的行 */
+static constexpr uint32 UNDO_LANE_ROW_SHIFT = 6;
+
+uint64 HeapUndoLane(UndoRecord *undo)
+{
+    return (static_cast<uint64>(undo->m_seghead) << BIS_PER_U32) ^ (undo->m_rowId >> UNDO_LANE_ROW_SHIFT);
+}
+
+void UndoInsert(UndoRecord *undo, UndoReplayContext *context)
+{
+    RowIdMap *rowidMap = GetUndoRowIdMap(undo, context);
+    RowIdMapEntry row = rowidMap->GetEntry(undo->m_rowId);
+    row.Lock();
+    /* 宕机时 tuple 可能还没写上 USED 标志，这时计数也没有加过 */
+    bool used = NVMTupleIsUsed(reinterpret_cast<NVMTuple *>(row.NvmAddr()));
+    NVMTupleSetUnUsed(reinterpret_cast<NVMTuple *>(row.NvmAddr()));
+    if (row.DramCache() != nullptr) {
+        NVMTupleSetUnUsed(reinterpret_cast<NVMTuple *>(row.DramCache()));
+    }
+    row.Unlock();
+    if (used) {
+        rowidMap->GetVecStore()->MarkUnused(undo->m_rowId);
     }
-    row->Unlock();
 }
 
-void UndoUpdate(UndoRecord *undo)
+void UndoUpdate(UndoRecord *undo, UndoReplayContext *context)
 {
-    RowIdMap *rowidMap = GetRowIdMap(undo->m_seghead, undo->m_rowLen);
-    RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId);
-    row->Lock();
-    int ret = memcpy_s(row->m_nvmAddr, RealTupleSize(undo->m_rowLen), undo->data, NVMTupleHeadSize);
+    RowIdMap *rowidMap = GetUndoRowIdMap(undo, context);
+    RowIdMapEntry row = rowidMap->GetEntry(undo->m_rowId);
+    row.Lock();
+    int ret = memcpy_s(row.NvmAddr(), RealTupleSize(undo->m_rowLen), undo->data, NVMTupleHeadSize);
     SecureRetCheck(ret);
-    UnpackDeltaUndo(row->m_nvmAddr + NVMTupleHeadSize, undo->data + NVMTupleHeadSize, undo->m_deltaLen);
-    if (row->m_dramCache != nullptr) {
-        ret = memcpy_s(row->m_dramCache, RealTupleSize(undo->m_rowLen), row->m_nvmAddr,
+    UnpackDeltaUndo(row.NvmAddr() + NVMTupleHeadSize, undo->data + NVMTupleHeadSize, undo->m_deltaLen);
+    if (row.DramCache() != nullptr) {
+        ret = memcpy_s(row.DramCache(), RealTupleSize(undo->m_rowLen), row.NvmAddr(),
                        undo->m_rowLen + NVMTupleHeadSize);
         SecureRetCheck(ret);
     }
-    row->Unlock();
+    row.Unlock();
 }
 
 void UndoUpdate(UndoRecord *undo, RAMTuple *tuple)
@@ -160,18 +207,47 @@ void UndoUpdate(UndoRecord *undo, RAMTuple *tuple)
     tuple->m_isNullBitmap = tuple->m_null;
 }
 
-void UndoDelete(UndoRecord *undo)
+/* 旧格式的删除 undo 带有整个 tuple，按 m_payload 拷贝对两种格式都成立 */
+void UndoDelete(UndoRecord *undo, UndoReplayContext *context)
 {
-    RowIdMap *rowidMap = GetRowIdMap(undo->m_seghead, undo->m_rowLen);
-    RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId);
-    row->Lock();
-    int ret = memcpy_s(row->m_nvmAddr, undo->m_rowLen + NVMTupleHeadSize, undo->data, undo->m_payload);
+    RowIdMap *rowidMap = GetUndoRowIdMap(undo, context);
+    RowIdMapEntry row = rowidMap->GetEntry(undo->m_rowId);
+    row.Lock();
+    int ret = memcpy_s(row.NvmAddr(), undo->m_rowLen + NVMTupleHeadSize, undo->data, undo->m_payload);
     SecureRetCheck(ret);
-    if (row->m_dramCache != nullptr) {
-        ret = memcpy_s(row->m_dramCache, RealTupleSize(undo->m_rowLen), undo->data, undo->m_payload);
+    if (row.DramCache() != nullptr) {
+        ret = memcpy_s(row.DramCache(), RealTupleSize(undo->m_rowLen), undo->data, undo->m_payload);
         SecureRetCheck(ret);
     }
-    row->Unlock();
+    row.Unlock();
+}
+
+void UndoDelete(UndoRecord *undo, RAMTuple *tuple)
+{
+    if (undo->m_payload > NVMTupleHeadSize) {
+        tuple->Deserialize(undo->data);
+        return;
+    }
+    /* 删除一定是版本链上的第一跳，tuple 中的数据就是删除前的数据 */
+    int ret = memcpy_s(static_cast<NVMTuple *>(tuple), sizeof(NVMTuple), undo->data, NVMTupleHeadSize);
+    SecureRetCheck(ret);
+    tuple->m_isNullBitmap = tuple->m_null;
+}
+
+void UndoTruncate(UndoRecord *undo, UndoReplayContext *context)
+{
+    auto *data = reinterpret_cast<TruncateUndoData *>(undo->data);
+    /*
+     * 只有表目录仍指向新 segment 时才切回旧 segment 并回收新 segment，回滚中途宕机后重做不会重复回收。
+     * 新 segment 上的插入已由更晚的 undo 记录先行回滚。
+     */
+    if (g_heapSpace->SearchTable(data->m_oid) != data->m_newSeg) {
+        return;
+    }
+    g_heapSpace->UpdateTable(data->m_oid, data->m_oldSeg);
+    /* 新 segment 的 RowIdMap 随后会被后台回收，不能再留在回放上下文中 */
+    *context = UndoReplayContext();
+    HeapFreeSegmentAsync(data->m_newSeg);
 }
 
 }  // namespace NVMDB
\ No newline at end of file
@@ -19,7 +19,6 @@
  *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/dbcore/heap/nvm_rowid_map.cpp
  * -------------------------------------------------------------------------
  */
-#include <unordered_map>
 #include <mutex>
 
 #include "nvm_heap_space.h"
@@ -27,134 +26,183 @@
 
 namespace NVMDB {
 
-/*
- * 这里的难点在于 extend 的时候，segments的指针会指向新的地址；而并发的读可能会读到旧的地址
- * 所以需要用一个 extend flag 来标记。读操作，在读 segments 前后会检查flag 是否有变化。
- * 如果有变化，需要重试一次。
- *
- * 正确性： 一个 segment 一旦创建，其地址不会改变，只要找到它起始地址就可以了。
- *        如果 reader 在读 segments 数组前后，flag没有变化，说明它读的segment值，是正确的。
- *        即使读操作结束之后，再扩展，也不影响该值。
- */
-RowIdMapEntry *RowIdMap::GetSegment(int segId)
+std::atomic<RowIdMapPage *> *RowIdMap::GetSegment(uint32 segId)
 {
-    if (segId >= m_segmentCapacity.load()) {
-        Extend(segId);
+    Assert(segId < m_segmentNum);
+    std::atomic<RowIdMapPage *> *segment = m_segments[segId].load(std::memory_order_acquire);
+    if (likely(segment != nullptr)) {
+        return segment;
     }
-    while (true) {
-        uint32 flag = GetExtendVersion();
-        auto segment = reinterpret_cast<RowIdMapEntry *>(m_segments.load()[segId]);
-        uint32 newFlag = GetExtendVersion();
+    auto *newSegment = new std::atomic<RowIdMapPage *>[segment_len]();
+    if (m_segments[segId].compare_exchange_strong(segment, newSegment)) {
+        return newSegment;
+    }
+    /* 其他线程已经装入 */
+    delete[] newSegment;
+    return segment;
+}
+
+RowIdMap::~RowIdMap()
+{
+    for (uint32 i = 0; i < m_segmentNum; i++) {
+        std::atomic<RowIdMapPage *> *segment = m_segments[i].load();
         if (segment == nullptr) {
-            Extend(segId);
-        } else if (newFlag == flag) {
-            return segment;
+            continue;
+        }
+        for (int j = 0; j < segment_len; j++) {
+            delete segment[j].load();
         }
+        delete[] segment;
     }
+    delete[] m_segments;
+    delete m_vecstore;
 }
 
-void RowIdMap::Extend(int segId)
+/* tuple 地址由页面描述和页内下标算出，页面描述在第一次访问该页时创建 */
+RowIdMapEntry RowIdMap::GetEntry(RowId rowId, bool isRead)
 {
-    std::lock_guard<std::mutex> lockGuard(mtx);
-    if (segId >= m_segmentCapacity.load()) {
-        int newCap = m_segmentCapacity.load() * EXTEND_FACTOR;
-        while (newCap <= segId) {
-            newCap *= EXTEND_FACTOR;
-        }
-        auto newSegments = new RowIdMapEntry *[newCap];
-        size_t memSize = newCap * sizeof(RowIdMapEntry *);
-        int ret = memset_s(newSegments, memSize, 0, memSize);
-        SecureRetCheck(ret);
-        ret = memcpy_s(newSegments, memSize, m_segments, m_segmentCapacity.load() * sizeof(RowIdMapEntry *));
-        SecureRetCheck(ret);
-
-        SetExtendFlag();
-        delete[] m_segments.load();
-        m_segments.store(newSegments);
-        ResetExtendFlag();
-        m_segmentCapacity.store(newCap);
+    if (unlikely(rowId >= m_maxRowId)) {
+        Assert(isRead);
+        return RowIdMapEntry();
     }
+    uint32 pageIdx = m_vecstore->LeafPageOfRowId(rowId);
+    std::atomic<RowIdMapPage *> *segment = GetSegment(pageIdx / segment_len);
+    std::atomic<RowIdMapPage *> &slot = segment[pageIdx % segment_len];
 
-    if (m_segments[segId] == nullptr) {
-        RowIdMapEntry *segment = new RowIdMapEntry[segment_len];
-        size_t memSize = sizeof(RowIdMapEntry) * segment_len;
-        int ret = memset_s(segment, memSize, 0, memSize);
-        SecureRetCheck(ret);
-        m_segments[segId] = segment;
+    RowIdMapPage *page = slot.load(std::memory_order_acquire);
+    if (page == nullptr) {
+        char *nvmPage = m_vecstore->LeafPagePoint(pageIdx);
+        /* not valid row on nvm. */
+        if (nvmPage == nullptr) {
+            Assert(isRead);
+            return RowIdMapEntry();
+        }
+        auto *newPage = new RowIdMapPage(nvmPage, m_vecstore->GetTupleLen(), m_vecstore->LeafPageTupleNum(pageIdx));
+        if (slot.compare_exchange_strong(page, newPage)) {
+            page = newPage;
+        } else {
+            delete newPage;
+        }
     }
+    return RowIdMapEntry(page, rowId - m_vecstore->LeafPageFirstRowId(pageIdx));
 }
 
-RowIdMapEntry *RowIdMap::GetEntry(RowId rowId, bool isRead)
+void RowIdMap::ReleaseLeafPage(uint32 pageIdx)
 {
-    int segId = rowId / segment_len;
-    RowIdMapEntry *segment = GetSegment(segId);
-    RowIdMapEntry *entry = &segment[rowId % segment_len];
+    std::atomic<RowIdMapPage *> *segment = m_segments[pageIdx / segment_len].load();
+    /* 没有创建过的 segment 中不会有页面描述 */
+    if (segment != nullptr) {
+        delete segment[pageIdx % segment_len].exchange(nullptr);
+    }
+    m_vecstore->ReleaseLeafPage(pageIdx);
+}
 
-    if (!entry->IsValid()) {
-        char *nvmAddr = m_vecstore->VersionPoint(rowId);
-        /* not valid row on nvm. */
-        if (nvmAddr == nullptr) {
-            Assert(isRead);
-            return nullptr;
+size_t RowIdMap::GetMetaMemorySize()
+{
+    size_t size = sizeof(RowIdMap) + m_segmentNum * sizeof(std::atomic<RowIdMapPage *> *);
+    for (uint32 i = 0; i < m_segmentNum; i++) {
+        std::atomic<RowIdMapPage *> *segment = m_segments[i].load();
+        if (segment == nullptr) {
+            continue;
         }
-        entry->Lock();
-        if (!entry->IsValid()) {
-            entry->m_nvmAddr = nvmAddr;
-            entry->m_dramCache = nullptr;
-            entry->m_flag2 = 0;
-            std::atomic_thread_fence(std::memory_order_release);
-            entry->SetValid();
+        size += segment_len * sizeof(std::atomic<RowIdMapPage *>);
+        for (int j = 0; j < segment_len; j++) {
+            RowIdMapPage *page = segment[j].load();
+            if (page != nullptr) {
+                size += page->MetaSize();
+            }
         }
-        entry->Unlock();
     }
-    std::atomic_thread_fence(std::memory_order_acquire);
-    return entry;
+    return size;
 }
 
-static std::unordered_map<uint32, RowIdMap *> g_globalRowidMaps;
+/*
+ * seghead -> RowIdMap 的注册表。seghead 是 heap space 的页号，按高位分 chunk 组成两级目录：
+ * 目录静态分配，chunk 在第一次注册该范围内的表时分配。查找无锁，注册和摘除在 g_grimMtx 下进行。
+ */
+static const uint32 REGISTRY_CHUNK_SHIFT = 16;
+static const uint32 REGISTRY_CHUNK_LEN = 1U << REGISTRY_CHUNK_SHIFT;
+static const uint32 REGISTRY_DIR_LEN = (MAX_UINT32 >> REGISTRY_CHUNK_SHIFT) + 1;
+
+static std::atomic<std::atomic<RowIdMap *> *> g_rowidMapDir[REGISTRY_DIR_LEN];
 static std::mutex g_grimMtx;
-thread_local std::unordered_map<uint32, RowIdMap *> g_localRowidMaps;
 
-static RowIdMap *GetRowIdMapFromGlobalCache(uint32 seghead, uint32 rowLen)
+static inline std::atomic<RowIdMap *> *RegistrySlot(uint32 seghead)
 {
-    std::lock_guard<std::mutex> lockGuard(g_grimMtx);
-    if (g_globalRowidMaps.find(seghead) == g_globalRowidMaps.end()) {
-        g_globalRowidMaps[seghead] = new RowIdMap(g_heapSpace, seghead, rowLen);
+    std::atomic<RowIdMap *> *chunk = g_rowidMapDir[seghead >> REGISTRY_CHUNK_SHIFT].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        return nullptr;
     }
-    return g_globalRowidMaps[seghead];
+    return &chunk[seghead & (REGISTRY_CHUNK_LEN - 1)];
 }
 
-RowIdMap *GetRowIdMap(uint32 seghead, uint32 rowLen)
+static RowIdMap *RegisterRowIdMap(uint32 seghead, uint32 rowLen)
 {
-    if (g_localRowidMaps.find(seghead) == g_localRowidMaps.end()) {
-        g_localRowidMaps[seghead] = GetRowIdMapFromGlobalCache(seghead, rowLen);
+    std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+    std::atomic<std::atomic<RowIdMap *> *> &dirEntry = g_rowidMapDir[seghead >> REGISTRY_CHUNK_SHIFT];
+    if (dirEntry.load() == nullptr) {
+        dirEntry.store(new std::atomic<RowIdMap *>[REGISTRY_CHUNK_LEN](), std::memory_order_release);
     }
-    RowIdMap *result = g_localRowidMaps[seghead];
-    Assert(result->GetRowLen() == rowLen);
-    return result;
+    std::atomic<RowIdMap *> *slot = RegistrySlot(seghead);
+    RowIdMap *rowidMap = slot->load();
+    if (rowidMap == nullptr) {
+        rowidMap = new RowIdMap(g_heapSpace, seghead, rowLen);
+        slot->store(rowidMap, std::memory_order_release);
+    }
+    return rowidMap;
 }
 
-void InitGlobalRowIdMapCache()
+uint64 GetRowIdMapEpoch(uint32 seghead)
 {
-    g_globalRowidMaps.clear();
+    /* 加锁后 slot 中的 RowIdMap 不会被并发释放 */
+    std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+    std::atomic<RowIdMap *> *slot = RegistrySlot(seghead);
+    RowIdMap *rowidMap = slot == nullptr ? nullptr : slot->load();
+    return rowidMap == nullptr ? 0 : rowidMap->GetVecStore()->GetEpoch();
 }
 
-void InitLocalRowIdMapCache()
+void DropRowIdMap(uint32 seghead)
 {
-    g_localRowidMaps.clear();
+    RowIdMap *rowidMap = nullptr;
+    {
+        std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+        std::atomic<RowIdMap *> *slot = RegistrySlot(seghead);
+        if (slot != nullptr) {
+            rowidMap = slot->exchange(nullptr);
+        }
+    }
+    delete rowidMap;
 }
 
-void DestroyGlobalRowIdMapCache()
+RowIdMap *GetRowIdMap(uint32 seghead, uint32 rowLen)
 {
-    for (auto entry : g_globalRowidMaps) {
-        delete entry.second;
+    std::atomic<RowIdMap *> *slot = RegistrySlot(seghead);
+    RowIdMap *result = slot == nullptr ? nullptr : slot->load(std::memory_order_acquire);
+    if (unlikely(result == nullptr)) {
+        result = RegisterRowIdMap(seghead, rowLen);
     }
-    g_globalRowidMaps.clear();
+    Assert(result->GetRowLen() == rowLen);
+    return result;
 }
 
-void DestroyLocalRowIdMapCache()
+void InitGlobalRowIdMapCache()
 {
-    g_localRowidMaps.clear();
+    DestroyGlobalRowIdMapCache();
+}
+
+void DestroyGlobalRowIdMapCache()
+{
+    std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+    for (uint32 i = 0; i < REGISTRY_DIR_LEN; i++) {
+        std::atomic<RowIdMap *> *chunk = g_rowidMapDir[i].exchange(nullptr);
+        if (chunk == nullptr) {
+            continue;
+        }
+        for (uint32 j = 0; j < REGISTRY_CHUNK_LEN; j++) {
+            delete chunk[j].load();
+        }
+        delete[] chunk;
+    }
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
@@ -65,9 +65,11 @@ bool RAMTuple::HasPreVersion()
 void RAMTuple::FetchPreVersion(char *undoRecordCache)
 {
     Assert(!UndoRecPtrIsInValid(m_prev));
-    UndoRecord *undo = CopyUndoRecord(m_prev, undoRecordCache);
+    UndoRecord *undo = GetUndoRecord(m_prev, undoRecordCache);
     if (undo->m_undoType == HeapUpdateUndo) {
         UndoUpdate(undo, this);
+    } else if (undo->m_undoType == HeapDeleteUndo) {
+        UndoDelete(undo, this);
     } else {
         Deserialize(undo->data);
     }
@@ -28,20 +28,64 @@
 
 namespace NVMDB {
 
+static std::atomic<uint64> g_vecStoreEpoch{0};
+
 VecStore::VecStore(TableSpace *tblspc, uint32 seghead, uint32 rowLen)
 {
     m_tblspc = tblspc;
     m_seghead = seghead;
+    m_epoch = g_vecStoreEpoch.fetch_add(1, std::memory_order_relaxed) + 1;
     m_tupleLen = rowLen + NVMTupleHeadSize;
-    m_tuplesPerpage = PageContentSize(HEAP_EXTENT_SIZE) / m_tupleLen;
+    m_rowidMgr = new RowIDMgr(m_tblspc, m_seghead, m_tupleLen);
 
-    uint32 pagesPerDir = MaxRowId / m_tuplesPerpage / g_dirPathNum;
-    m_gbm = new GlobalBitMap *[g_dirPathNum];
     Assert(g_dirPathNum > 0);
+    uint32 pagesPerDir = m_rowidMgr->GetMaxLeafPageNum() / g_dirPathNum;
+    pagesPerDir = pagesPerDir / GlobalBitMap::BITMAP_UNIT_SIZE * GlobalBitMap::BITMAP_UNIT_SIZE;
+    m_gbm = new GlobalBitMap *[g_dirPathNum];
     for (uint32 i = 0; i < g_dirPathNum; i++) {
         m_gbm[i] = new GlobalBitMap(pagesPerDir);
     }
-    m_rowidMgr = new RowIDMgr(m_tblspc, m_seghead, m_tupleLen);
+    RebuildBitmap();
+}
+
+/*
+ * 已经写满的 leaf page 不再分给任何线程。未写满的页按已占用个数记下起始下标：页内 tuple 按顺序分配，
+ * 没有删除时前面的都已占用，不必逐个 TryAt。
+ */
+void VecStore::RebuildBitmap()
+{
+    uint32 pageNum = m_rowidMgr->GetLeafPageNum();
+    for (uint32 pageIdx = 0; pageIdx < pageNum; pageIdx++) {
+        uint16 *usedCount = m_rowidMgr->leaf_page_used_count(pageIdx);
+        if (usedCount == nullptr) {
+            continue;
+        }
+        uint32 used = __atomic_load_n(usedCount, __ATOMIC_RELAXED);
+        if (used >= LeafPageTupleNum(pageIdx)) {
+            m_gbm[pageIdx % g_dirPathNum]->SyncSet(pageIdx / g_dirPathNum);
+        } else if (used > 0) {
+            m_startHints[pageIdx] = used;
+        }
+    }
+    m_hasStartHints.store(!m_startHints.empty(), std::memory_order_release);
+}
+
+uint32 VecStore::TakeStartHint(uint32 pageIdx)
+{
+    if (!m_hasStartHints.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lockGuard(mtx);
+    auto it = m_startHints.find(pageIdx);
+    if (it == m_startHints.end()) {
+        return 0;
+    }
+    uint32 start = it->second;
+    m_startHints.erase(it);
+    if (m_startHints.empty()) {
+        m_hasStartHints.store(false, std::memory_order_release);
+    }
+    return start;
 }
 
 VecStore::~VecStore()
@@ -50,6 +94,7 @@ VecStore::~VecStore()
         delete m_gbm[i];
     }
     delete[] m_gbm;
+    delete m_rowidMgr;
 }
 
 char *VecStore::TryAt(RowId rid)
@@ -64,7 +109,7 @@ char *VecStore::TryAt(RowId rid)
 
 RowId VecStore::TryNextRowid()
 {
-    ThreadLocalTableCache *localTableCache = GetThreadLocalTableCache(m_seghead);
+    ThreadLocalTableCache *localTableCache = GetThreadLocalTableCache(m_seghead, m_epoch);
     RowId rid = InvalidRowId;
 
     // 1. 从 RowID Cache 中找，是否有自己之前删过的。
@@ -84,8 +129,8 @@ RowId VecStore::TryNextRowid()
         uint32 dirSeq = GetCurrentGroupId() % g_dirPathNum;
         uint32 bit = m_gbm[dirSeq]->SyncAcquire();
         bit = dirSeq + g_dirPathNum * bit;
-        localTableCache->m_range.start = bit * m_tuplesPerpage;
-        localTableCache->m_range.end = (bit + 1) * m_tuplesPerpage;
+        localTableCache->m_range.start = LeafPageFirstRowId(bit) + TakeStartHint(bit);
+        localTableCache->m_range.end = LeafPageFirstRowId(bit + 1);
     }
 
     assert(0);
@@ -105,13 +150,60 @@ RowId VecStore::InsertVersion()
         if (pointer != nullptr) {
             return rowId;
         }
+        m_tryAtMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void VecStore::MarkUsed(RowId rid)
+{
+    uint32 pageIdx = LeafPageOfRowId(rid);
+    uint16 *usedCount = m_rowidMgr->leaf_page_used_count(pageIdx);
+    Assert(usedCount != nullptr);
+    uint16 oldCount = __atomic_fetch_add(usedCount, 1, __ATOMIC_RELAXED);
+    Assert(oldCount < LeafPageTupleNum(pageIdx));
+}
+
+void VecStore::MarkUnused(RowId rid)
+{
+    uint16 *usedCount = m_rowidMgr->leaf_page_used_count(LeafPageOfRowId(rid));
+    if (usedCount == nullptr) {
+        return;
+    }
+    /* 计数只能偏小：宕机时 MarkUsed 可能还没做，这里不能减成负数 */
+    uint16 oldCount = __atomic_load_n(usedCount, __ATOMIC_RELAXED);
+    while (oldCount > 0) {
+        if (__atomic_compare_exchange_n(usedCount, &oldCount, oldCount - 1, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
     }
 }
 
+uint32 VecStore::GetLeafPageUsedCount(uint32 pageIdx)
+{
+    uint16 *usedCount = m_rowidMgr->leaf_page_used_count(pageIdx);
+    return usedCount == nullptr ? 0 : __atomic_load_n(usedCount, __ATOMIC_RELAXED);
+}
+
 RowId VecStore::GetUpperRowId()
 {
     RowId nvmRowId = m_rowidMgr->GetUpperRowId();
     return nvmRowId;
 }
 
+uint32 VecStore::GetLeafPageNum()
+{
+    return m_rowidMgr->GetLeafPageNum();
+}
+
+char *VecStore::LeafPagePoint(uint32 pageIdx)
+{
+    return m_rowidMgr->leaf_page_pointer(pageIdx);
+}
+
+void VecStore::ReleaseLeafPage(uint32 pageIdx)
+{
+    m_rowidMgr->release_leaf_page(pageIdx);
+}
+
 }  // namespace NVMDB
\ No newline at end of file
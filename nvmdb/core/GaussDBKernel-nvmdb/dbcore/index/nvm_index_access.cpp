@@ -31,7 +31,10 @@ void IndexInsert(Transaction *trx, NVMIndex *index, DRAMIndexTuple *indexTuple,
     Key_t key;
     trx->PrepareUndo();
     index->Encode(indexTuple, &key, rowId);
-    PrepareIndexInsertUndo(trx, key, trx->GetSnapshot());
+    /* undo 写不下时事务已进入 TX_WAIT_ABORT，不再修改索引 */
+    if (UndoRecPtrIsInValid(PrepareIndexInsertUndo(trx, key, trx->GetSnapshot()))) {
+        return;
+    }
     index->Insert(indexTuple, rowId);
 }
 
@@ -40,7 +43,9 @@ void IndexDelete(Transaction *trx, NVMIndex *index, DRAMIndexTuple *indexTuple,
     Key_t key;
     trx->PrepareUndo();
     index->Encode(indexTuple, &key, rowId);
-    PrepareIndexDeleteUndo(trx, key);
+    if (UndoRecPtrIsInValid(PrepareIndexDeleteUndo(trx, key))) {
+        return;
+    }
     index->Delete(indexTuple, rowId, trx->GetTrxSlotLocation());
 }
 }  // namespace NVMDB
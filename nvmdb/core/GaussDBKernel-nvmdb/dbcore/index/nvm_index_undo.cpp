@@ -21,6 +21,7 @@
  */
 #include "index/nvm_index_access.h"
 #include "undo/nvm_undo_record.h"
+#include "undo/nvm_undo_rollback.h"
 
 namespace NVMDB {
 
@@ -33,15 +34,15 @@ namespace NVMDB {
  *              这里有一个 trick， trx 1提交之后，trx 2才能插入，否则会有并发更新的问题，
  *              所以 trx2 的 snapshot 必然 大于 trx1 的CSN，所以直接用 trx2 的snapshot 回填即可。
  * undo 的格式
- * 因为UndoRecord 的head对索引undo来说没用，所以复用了下存储空间。seghead 和 rowid 两个 uint32 拼成了一个 uint64 的CSN
+ * 因为UndoRecord 的head对索引undo来说没用，所以复用了下存储空间。CSN 直接存放在 64 位的 rowid 中
  */
-void PrepareIndexInsertUndo(Transaction *trx, Key_t &key, uint64 csn)
+UndoRecPtr PrepareIndexInsertUndo(Transaction *trx, Key_t &key, uint64 csn)
 {
     auto *undo = reinterpret_cast<UndoRecord *>(trx->undoRecordCache);
     undo->m_undoType = IndexInsertUndo;
     undo->m_rowLen = 0;
-    undo->m_seghead = csn >> BIS_PER_U32;
-    undo->m_rowId = csn & 0xFFFFFFFF;
+    undo->m_seghead = NVMInvalidBlockNumber;
+    undo->m_rowId = csn;
     undo->m_payload = sizeof(key);
     undo->m_pre = 0;
 #ifndef NDEBUG
@@ -49,14 +50,14 @@ void PrepareIndexInsertUndo(Transaction *trx, Key_t &key, uint64 csn)
 #endif
     int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &key, sizeof(key));
     SecureRetCheck(ret);
-    trx->InsertUndoRecord(undo);
+    return trx->InsertUndoRecord(undo);
 }
 
 /*
  * 删除的时候可以保证，自己可以看见，且没有并发的修改，即在删除之前肯定是可见的。所以回滚直接设置value 为InvalidCSN
  * 即可。
  */
-void PrepareIndexDeleteUndo(Transaction *trx, Key_t &key)
+UndoRecPtr PrepareIndexDeleteUndo(Transaction *trx, Key_t &key)
 {
     auto *undo = reinterpret_cast<UndoRecord *>(trx->undoRecordCache);
     undo->m_undoType = IndexDeleteUndo;
@@ -67,13 +68,12 @@ void PrepareIndexDeleteUndo(Transaction *trx, Key_t &key)
     undo->m_pre = 0;
     int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &key, sizeof(key));
     SecureRetCheck(ret);
-    trx->InsertUndoRecord(undo);
+    return trx->InsertUndoRecord(undo);
 }
 
-void UndoIndexInsert(UndoRecord *undo)
+void UndoIndexInsert(UndoRecord *undo, UndoReplayContext *context)
 {
-    uint64 csn = undo->m_seghead;
-    csn = (csn << BIS_PER_U32) | undo->m_rowId;
+    uint64 csn = undo->m_rowId;
     Key_t key;
     Assert(undo->m_payload == sizeof(Key_t));
     int ret = memcpy_s(&key, sizeof(key), undo->data, undo->m_payload);
@@ -82,7 +82,7 @@ void UndoIndexInsert(UndoRecord *undo)
     pt->Insert(key, csn);
 }
 
-void UndoIndexDelete(UndoRecord *undo)
+void UndoIndexDelete(UndoRecord *undo, UndoReplayContext *context)
 {
     Key_t key;
     Assert(undo->m_payload == sizeof(Key_t));
@@ -92,4 +92,19 @@ void UndoIndexDelete(UndoRecord *undo)
     pt->Insert(key, INVALID_CSN);
 }
 
+/* 同一个 key 上的插入和删除必须按顺序回放，按 key 的内容分 lane */
+uint64 IndexUndoLane(UndoRecord *undo)
+{
+    Key_t key;
+    Assert(undo->m_payload == sizeof(Key_t));
+    int ret = memcpy_s(&key, sizeof(key), undo->data, undo->m_payload);
+    SecureRetCheck(ret);
+    const char *data = key.getData();
+    uint64 lane = 14695981039346656037ULL; /* FNV-1a */
+    for (size_t i = 0; i < key.size(); i++) {
+        lane = (lane ^ static_cast<uint8>(data[i])) * 1099511628211ULL;
+    }
+    return lane;
+}
+
 }  // namespace NVMDB
\ No newline at end of file
@@ -19,16 +19,76 @@
  *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/dbcore/index/nvm_pactree_instance.cpp
  * -------------------------------------------------------------------------
  */
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
 #include "pactree.h"
+#include "index/nvm_index.h"
 
 namespace NVMDB {
 
 static pactree *g_pt = nullptr;
 
+/*
+ * truncate 之后旧 generation 的索引项在后台物理删除。任务不持久化：退出时丢弃未做完的任务，
+ * 重启后表挂载索引时按 segment 中持久化的 generation 重新登记，早于它的 generation 都已作废。
+ */
+struct IndexPurgeTask {
+    TableId m_idxId;
+    uint32 m_generation;
+};
+
+static std::thread g_indexPurge;
+static std::mutex g_purgeMtx;
+static std::condition_variable g_purgeCv;
+static std::deque<IndexPurgeTask> g_purgeQueue;
+static bool g_doPurge = false;
+
+static void IndexPurge()
+{
+    pthread_setname_np(pthread_self(), "NVM IndexPurge");
+    g_pt->registerThread(0);
+    std::unique_lock<std::mutex> lock(g_purgeMtx);
+    while (true) {
+        g_purgeCv.wait(lock, [] { return !g_purgeQueue.empty() || !g_doPurge; });
+        if (!g_doPurge) {
+            break;
+        }
+        IndexPurgeTask task = g_purgeQueue.front();
+        g_purgeQueue.pop_front();
+        lock.unlock();
+        Key_t begin;
+        Key_t end;
+        NVMIndex::EncodeGeneration(task.m_idxId, 0, &begin);
+        NVMIndex::EncodeGeneration(task.m_idxId, task.m_generation, &end);
+        g_pt->removeRange(begin, end);
+        lock.lock();
+    }
+    g_purgeQueue.clear();
+    lock.unlock();
+    g_pt->unregisterThread();
+}
+
+void IndexPurgeGenerationsAsync(TableId idxId, uint32 generation)
+{
+    if (generation == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lockGuard(g_purgeMtx);
+        g_purgeQueue.push_back(IndexPurgeTask{idxId, generation});
+    }
+    g_purgeCv.notify_one();
+}
+
 void IndexBootstrap(const char *dir)
 {
     Assert(g_pt == nullptr);
     g_pt = new pactree(dir);
+    g_doPurge = true;
+    g_indexPurge = std::thread(IndexPurge);
 }
 
 pactree *GetGlobalPACTree()
@@ -39,6 +99,14 @@ pactree *GetGlobalPACTree()
 
 void IndexExitProcess()
 {
+    {
+        std::lock_guard<std::mutex> lockGuard(g_purgeMtx);
+        g_doPurge = false;
+    }
+    g_purgeCv.notify_all();
+    if (g_indexPurge.joinable()) {
+        g_indexPurge.join();
+    }
     delete g_pt;
     g_pt = nullptr;
 }
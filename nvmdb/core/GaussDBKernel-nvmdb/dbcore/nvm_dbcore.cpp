@@ -19,6 +19,9 @@
  *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/dbcore/nvm_dbcore.cpp
  * -------------------------------------------------------------------------
  */
+#include <chrono>
+#include <thread>
+
 #include "nvm_undo_api.h"
 #include "nvm_heap_space.h"
 #include "nvmdb_thread.h"
@@ -36,20 +39,44 @@ void InitDB(const char *dir)
     IndexBootstrap(dir);
 }
 
+static StartupStat g_startupStat;
+
+template <typename Func>
+static uint64 TimedRun(Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 void BootStrap(const char *dir)
 {
-    ParseDirectoryConfig(dir);
-    InitGlobalVariables();
-    HeapBootStrap(dir);
-    IndexBootstrap(dir);
-    UndoBootStrap(dir);
+    StartupStat stat{};
+    stat.m_totalUs = TimedRun([&]() {
+        ParseDirectoryConfig(dir);
+        InitGlobalVariables();
+        /* heap、索引、undo 的文件各自独立，并行挂载；undo 的后台回滚会访问 heap 和索引，等三者都挂载后再启动 */
+        std::thread heap([&]() { stat.m_heapMountUs = TimedRun([&]() { HeapBootStrap(dir); }); });
+        std::thread index([&]() { stat.m_indexMountUs = TimedRun([&]() { IndexBootstrap(dir); }); });
+        stat.m_undoMountUs = TimedRun([&]() { UndoMount(dir); });
+        heap.join();
+        index.join();
+        UndoStartRecovery();
+    });
+    g_startupStat = stat;
+}
+
+void GetStartupStat(StartupStat *stat)
+{
+    *stat = g_startupStat;
 }
 
 void ExitDBProcess()
 {
+    /* 后台 undo 线程可能仍在回滚，会访问 heap 和索引，需最先停止 */
+    UndoExitProcess();
     IndexExitProcess();
     HeapExitProcess();
-    UndoExitProcess();
     DestroyGlobalVariables();
 }
 
@@ -19,21 +19,34 @@
  *   src/gausskernel/storage/nvmdb/core/GaussDBKernel-nvmdb/dbcore/nvm_page_dlist.cpp
  * -------------------------------------------------------------------------
  */
+#include <libpmem.h>
+
 #include "nvm_types.h"
 #include "nvm_table_space.h"
 #include "nvm_page_dlist.h"
 
 namespace NVMDB {
 
+/*
+ * 链表在 NVM 上，每次修改指针后立即持久化。pop_tail 只沿 prev 找尾部，prev 链是权威的：
+ * 插入时先写好新节点并挂到 head 的 prev 上，摘除时最后才改 head 的 prev。宕机时 next 链可能落后一步，
+ * 下一次 pop 会修正；回收 segment 时重做未完成的 pop 会摘同一个节点，不会重复归还。
+ */
 static inline PageDListNode *get_dlist_node(TableSpace *space, int offset, uint32 node)
 {
     return (PageDListNode *)(space->RelpointOfPageno(node) + offset);
 }
 
+static inline void persist_dlist_node(PageDListNode *node)
+{
+    pmem_persist(node, sizeof(PageDListNode));
+}
+
 void page_dlist_init_head(TableSpace *space, int offset, uint32 node)
 {
     auto dlist_node = get_dlist_node(space, offset, node);
     dlist_node->next = dlist_node->prev = node;
+    persist_dlist_node(dlist_node);
 }
 
 bool page_dlist_is_head(TableSpace *space, int offset, uint32 node)
@@ -55,8 +68,11 @@ void page_dlist_push_tail(TableSpace *space, int offset, uint32 head, uint32 nod
 
     new_node->prev = head_node->prev;
     new_node->next = head;
-    tail_node->next = node;
+    persist_dlist_node(new_node);
     head_node->prev = node;
+    persist_dlist_node(head_node);
+    tail_node->next = node;
+    persist_dlist_node(tail_node);
 }
 
 uint32 page_dlist_pop_tail(TableSpace *space, int offset, uint32 head)
@@ -66,8 +82,11 @@ uint32 page_dlist_pop_tail(TableSpace *space, int offset, uint32 head)
     auto tail_prev = get_dlist_node(space, offset, tail_node->prev);
     uint32 res = head_node->prev;
 
-    head_node->prev = tail_node->prev;
+    /* 改完 head 的 prev 之后节点才算摘下，之前宕机重做会摘同一个节点 */
     tail_prev->next = head;
+    persist_dlist_node(tail_prev);
+    head_node->prev = tail_node->prev;
+    persist_dlist_node(head_node);
 
     return res;
 }
@@ -85,10 +104,13 @@ void page_dlist_delete(TableSpace *space, int offset, uint32 node)
     auto prev_node = get_dlist_node(space, offset, curr_node->prev);
     auto next_node = get_dlist_node(space, offset, curr_node->next);
 
-    prev_node->next = curr_node->next;
     next_node->prev = curr_node->prev;
+    persist_dlist_node(next_node);
+    prev_node->next = curr_node->next;
+    persist_dlist_node(prev_node);
 
     curr_node->prev = curr_node->next = node;
+    persist_dlist_node(curr_node);
 }
 
 /* 把整个链表 src 加入到 dst 中 */
@@ -104,9 +126,13 @@ void page_dlist_link(TableSpace *space, int offset, uint32 src, uint32 dst)
     auto dst_next_node = get_dlist_node(space, offset, dst_node->next);
 
     dst_next_node->prev = src_node->prev;
+    persist_dlist_node(dst_next_node);
     src_tail_node->next = dst_node->next;
+    persist_dlist_node(src_tail_node);
     dst_node->next = src;
+    persist_dlist_node(dst_node);
     src_node->prev = dst;
+    persist_dlist_node(src_node);
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
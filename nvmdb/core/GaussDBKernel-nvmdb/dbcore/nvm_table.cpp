@@ -22,6 +22,8 @@
 #include "nvm_table.h"
 #include "nvm_vecstore.h"
 #include "nvm_heap_space.h"
+#include "nvm_heap_undo.h"
+#include "nvm_transaction.h"
 
 namespace NVMDB {
 
@@ -41,10 +43,10 @@ void TableDescDestroy(TableDesc *desc)
     delete[] desc->col_desc;
 }
 
-uint32 Table::CreateSegment()
+uint32 Table::CreateSegment(ExtentSizeType leafExtent, bool adaptive)
 {
-    g_heapSpace->AllocNewExtent(&m_seghead, EXTSZ_2M);
-    m_rowidMap = GetRowIdMap(m_seghead, m_rowLen);
+    HeapLeafLayout layout = RowIDMgr::MakeLayout(g_heapSpace, m_rowLen + NVMTupleHeadSize, leafExtent, adaptive);
+    Mount(RowIDMgr::CreateSegment(g_heapSpace, layout));
     return m_seghead;
 }
 
@@ -52,6 +54,28 @@ void Table::Mount(uint32 seghead)
 {
     m_seghead = seghead;
     m_rowidMap = GetRowIdMap(seghead, m_rowLen);
+    m_generation = m_rowidMap->GetVecStore()->GetGeneration();
+    for (NVMIndex *i : index) {
+        i->SetGeneration(m_generation);
+    }
+}
+
+bool Table::Truncate(Transaction *trx)
+{
+    trx->PrepareUndo();
+    uint32 oldSeg = m_seghead;
+    /* 新 segment 沿用原表的 leaf page 布局 */
+    uint32 newSeg = RowIDMgr::CreateSegment(g_heapSpace, m_rowidMap->GetVecStore()->GetLeafLayout(), m_generation + 1);
+    /* 先写 undo 再切换目录，宕机后由 undo 切回 */
+    if (UndoRecPtrIsInValid(PrepareTruncateUndo(trx, m_tableId, oldSeg, newSeg))) {
+        HeapFreeSegmentAsync(newSeg);
+        return false;
+    }
+    bool found = g_heapSpace->UpdateTable(m_tableId, newSeg);
+    ALWAYS_CHECK(found);
+    Mount(newSeg);
+    trx->PushTruncatedTable(this, oldSeg);
+    return true;
 }
 
 uint32 Table::GetColIdByName(const char *name) const
@@ -20,10 +20,13 @@
  * -------------------------------------------------------------------------
  */
 #include <cstring>
+#include <chrono>
 
 #include "nvm_tuple.h"
 #include "nvm_undo_api.h"
 #include "nvm_transaction.h"
+#include "nvm_table.h"
+#include "nvm_heap_space.h"
 #include "nvm_cfg.h"
 
 namespace NVMDB {
@@ -60,9 +63,16 @@ bool IsValidCsn(uint64 csn)
     return csn != 0 && csn >= MIN_TRX_CSN;
 }
 
+/*
+ * snapshotSeq 每次建立快照加一，expiredSeq 等于它时说明当前快照已被作废；
+ * 回收线程只记下它看到的 snapshotSeq，事务随后建立的新快照不受影响。
+ */
 struct PROC {
     bool inUsed = false;
     std::atomic<uint64> snapshotCsn{MIN_TRX_CSN};
+    std::atomic<uint64> snapshotSeq{0};
+    std::atomic<uint64> snapshotUs{0};
+    std::atomic<uint64> expiredSeq{0};
 };
 
 static std::atomic<uint64> g_procArrayVersion{0};
@@ -85,6 +95,17 @@ void DestroyGlobalProcArray()
 static volatile uint64 MIN_SNAPSHOT = MIN_TRX_CSN;
 constexpr int SLEEP_TIME = 10000;
 
+static inline bool ProcSnapshotExpired(volatile PROC *proc)
+{
+    return proc->expiredSeq.load(std::memory_order_relaxed) == proc->snapshotSeq.load(std::memory_order_relaxed);
+}
+
+static uint64 SnapshotNowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 uint64 GetMinSnapshot()
 {
     uint32 idx = 0;
@@ -99,6 +120,10 @@ uint64 GetMinSnapshot()
     }
     uint64 vOld = g_procArrayVersion.load(std::memory_order_acquire);
     for (idx = 0; idx < NVMDB_MAX_THREAD_NUM; idx++) {
+        /* 空闲槽位上残留的快照不再被任何线程使用，作废的快照不再读旧版本 */
+        if (!g_procArray[idx].inUsed || ProcSnapshotExpired(&g_procArray[idx])) {
+            continue;
+        }
         tmpSnapshot = g_procArray[idx].snapshotCsn.load(std::memory_order_relaxed);
         Assert(IsValidCsn(tmpSnapshot));
         if (tmpSnapshot < minSnapshot) {
@@ -112,11 +137,59 @@ uint64 GetMinSnapshot()
         goto again;
     }
 
-    Assert(minSnapshot >= MIN_SNAPSHOT);
-    MIN_SNAPSHOT = minSnapshot;
+    /* 回收线程和 HeapShrink 可能并发扫描，先扫完的可能后写回；MIN_SNAPSHOT 只前进，返回值仍是本次扫描的下界 */
+    uint64 oldMin = MIN_SNAPSHOT;
+    while (oldMin < minSnapshot && !__sync_bool_compare_and_swap(&MIN_SNAPSHOT, oldMin, minSnapshot)) {
+        oldMin = MIN_SNAPSHOT;
+    }
     return minSnapshot;
 }
 
+uint32 ExpireSnapshots(uint64 max_age_us, bool expire_oldest)
+{
+    uint64 currentCsn = COMMIT_SEQUENCE_NUM;
+    uint64 nowUs = SnapshotNowUs();
+    uint64 oldestCsn = currentCsn;
+    uint32 oldestIdx = NVMDB_MAX_THREAD_NUM;
+    uint64 oldestSeq = 0;
+    uint32 expired = 0;
+    for (uint32 idx = 0; idx < NVMDB_MAX_THREAD_NUM; idx++) {
+        volatile PROC *proc = &g_procArray[idx];
+        if (!proc->inUsed) {
+            continue;
+        }
+        uint64 seq = proc->snapshotSeq.load(std::memory_order_acquire);
+        uint64 snapshotCsn = proc->snapshotCsn.load(std::memory_order_relaxed);
+        uint64 snapshotUs = proc->snapshotUs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        /* 读的过程中建立了新快照，或者快照没有拖住任何 undo */
+        if (proc->snapshotSeq.load(std::memory_order_relaxed) != seq || proc->expiredSeq == seq ||
+            snapshotCsn >= currentCsn) {
+            continue;
+        }
+        if (max_age_us != 0 && nowUs > snapshotUs + max_age_us) {
+            proc->expiredSeq.store(seq, std::memory_order_seq_cst);
+            expired++;
+        } else if (snapshotCsn < oldestCsn) {
+            oldestCsn = snapshotCsn;
+            oldestIdx = idx;
+            oldestSeq = seq;
+        }
+    }
+    if (expire_oldest && oldestIdx < NVMDB_MAX_THREAD_NUM) {
+        g_procArray[oldestIdx].expiredSeq.store(oldestSeq, std::memory_order_seq_cst);
+        expired++;
+    }
+    return expired;
+}
+
+bool Transaction::SnapshotTooOld()
+{
+    /* 调用者之前读过的 undo 要在检查之前完成，否则可能读到已回收复用的空间却没发现快照已作废 */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return g_procArray[local_proc_array_idx].expiredSeq.load(std::memory_order_relaxed) == snapshot_seq;
+}
+
 static inline uint64 NvmGetCSN()
 {
     return COMMIT_SEQUENCE_NUM;
@@ -131,6 +204,8 @@ void RecoveryCSN(const uint64 &max_undo_csn)
 {
     Assert(IsValidCsn(max_undo_csn));
     COMMIT_SEQUENCE_NUM = max_undo_csn + 1;
+    /* 重新挂载时还没有任何快照，上一次挂载留下的值可能比恢复出的 CSN 还大 */
+    MIN_SNAPSHOT = MIN_TRX_CSN;
 }
 
 thread_local Transaction *local_trx_context = nullptr;
@@ -167,8 +242,12 @@ void Transaction::InstallSnapshot()
 {
     /* Atomic assign my snapshot where others can see it. */
     g_procArrayVersion.fetch_add(1, std::memory_order_relaxed);
-    g_procArray[local_proc_array_idx].snapshotCsn.store(COMMIT_SEQUENCE_NUM, std::memory_order_release);
-    snapshot = g_procArray[local_proc_array_idx].snapshotCsn;
+    volatile PROC *proc = &g_procArray[local_proc_array_idx];
+    snapshot_seq = proc->snapshotSeq.load(std::memory_order_relaxed) + 1;
+    proc->snapshotSeq.store(snapshot_seq, std::memory_order_relaxed);
+    proc->snapshotUs.store(SnapshotNowUs(), std::memory_order_relaxed);
+    proc->snapshotCsn.store(COMMIT_SEQUENCE_NUM, std::memory_order_release);
+    snapshot = proc->snapshotCsn;
     min_snapshot = MIN_SNAPSHOT;
     Assert(IsValidCsn(snapshot));
     Assert(snapshot >= MIN_SNAPSHOT);
@@ -178,7 +257,7 @@ void Transaction::UninstallSnapshot()
 {
     /* invalid registered snapshot. */
     Assert(snapshot == g_procArray[local_proc_array_idx].snapshotCsn);
-    Assert(snapshot >= MIN_SNAPSHOT);
+    Assert(snapshot >= MIN_SNAPSHOT || SnapshotTooOld());
 }
 
 void Transaction::ProcArrayAdd()
@@ -191,6 +270,9 @@ void Transaction::ProcArrayAdd()
     Assert(!g_procArray[index].inUsed);
     Assert(IsValidCsn(g_procArray[index].snapshotCsn));
     local_proc_array_idx = index;
+    /* 槽位上残留的是前一个线程的旧快照，先换成当前 CSN，保证 MIN_SNAPSHOT 不回退 */
+    g_procArrayVersion.fetch_add(1, std::memory_order_relaxed);
+    g_procArray[index].snapshotCsn.store(COMMIT_SEQUENCE_NUM, std::memory_order_release);
     g_procArray[index].inUsed = true;
     ReleaseProcArrayLock();
 }
@@ -218,6 +300,7 @@ void Transaction::Begin()
 {
     Assert(tx_status == TX_EMPTY || tx_status == TX_ABORTED || tx_status == TX_COMMITTED);
     Assert(write_set.empty());
+    Assert(truncated_tables.empty());
     InstallSnapshot();
     tx_status = TX_IN_PROGRESS;
 }
@@ -227,6 +310,7 @@ void Transaction::Commit()
     Assert(tx_status == TX_IN_PROGRESS);
     tx_status = TX_COMMITTING;
     if (undo_trx != nullptr) {
+        undo_trx->PublishUndo();
         csn = NvmGetCSN();
         undo_trx->UpdateTrxSlotCSN(csn);
         undo_trx->UpdateTrxSlotStatus(TRX_COMMITTED);
@@ -234,6 +318,11 @@ void Transaction::Commit()
         ReleaseTrxUndoContext(undo_trx);
         undo_trx = nullptr;
         write_set.clear();
+        for (auto &truncated : truncated_tables) {
+            HeapFreeSegmentAsync(truncated.second);
+            truncated.first->PurgeStaleIndexes();
+        }
+        truncated_tables.clear();
     }
     tx_status = TX_COMMITTED;
     UninstallSnapshot();
@@ -249,6 +338,11 @@ void Transaction::Abort()
         ReleaseTrxUndoContext(undo_trx);
         undo_trx = nullptr;
         write_set.clear();
+        /* 表目录已由 undo 切回，这里恢复内存中的 table；同一事务多次 truncate 时逆序恢复 */
+        for (auto iter = truncated_tables.rbegin(); iter != truncated_tables.rend(); ++iter) {
+            iter->first->Mount(iter->second);
+        }
+        truncated_tables.clear();
     }
     tx_status = TX_ABORTED;
     UninstallSnapshot();
@@ -265,6 +359,10 @@ TM_Result Transaction::VersionIsVisible(NVMTuple *tuple)
         TransactionInfo trx_info;
         bool recycled = !GetTransactionInfo((TransactionSlotPtr)tuple->m_trxInfo, &trx_info);
         if (recycled) {
+            /* 作废的快照可能早于被回收事务的提交，无法判断，按不可见处理，由调用者报 snapshot too old */
+            if (unlikely(SnapshotTooOld())) {
+                return TM_Invisible;
+            }
             /* fill MIN_SNAPSHOT back to trx_info as upper commit CSN. */
             return TM_Ok;
         }
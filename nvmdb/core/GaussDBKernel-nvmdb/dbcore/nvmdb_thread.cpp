@@ -30,13 +30,37 @@ namespace NVMDB {
 
 thread_local std::map<uint32, ThreadLocalTableCache *> local_table_cache;
 
-ThreadLocalTableCache *GetThreadLocalTableCache(uint32 seghead)
+/* 丢弃已回收 segment 的缓存：segment 页号可能被新表复用，epoch 不同的缓存属于旧表 */
+static void EvictStaleTableCache()
 {
-    if (local_table_cache.find(seghead) == local_table_cache.end()) {
-        local_table_cache.insert({seghead, new ThreadLocalTableCache()});
+    for (auto iter = local_table_cache.begin(); iter != local_table_cache.end();) {
+        if (GetRowIdMapEpoch(iter->first) != iter->second->m_epoch) {
+            delete iter->second;
+            iter = local_table_cache.erase(iter);
+        } else {
+            ++iter;
+        }
     }
+}
 
-    return local_table_cache[seghead];
+ThreadLocalTableCache *GetThreadLocalTableCache(uint32 seghead, uint64 epoch)
+{
+    auto iter = local_table_cache.find(seghead);
+    if (likely(iter != local_table_cache.end() && iter->second->m_epoch == epoch)) {
+        return iter->second;
+    }
+    /* 新访问一个 segment 的次数有限，顺带清理所有作废的缓存，线程缓存的表数不随 DDL 历史增长 */
+    EvictStaleTableCache();
+    ThreadLocalTableCache *cache = new ThreadLocalTableCache();
+    cache->m_epoch = epoch;
+    iter = local_table_cache.find(seghead);
+    if (iter != local_table_cache.end()) {
+        delete iter->second;
+        iter->second = cache;
+    } else {
+        local_table_cache.insert({seghead, cache});
+    }
+    return cache;
 }
 
 void DestroyLocalTableCache()
@@ -132,8 +156,6 @@ void DestroyThreadLocalStorage()
 void InitThreadLocalVariables()
 {
     InitThreadLocalStorage();
-    InitLocalRowIdMapCache();
-    InitLocalUndoSegment();
     InitLocalIndex(GetCurrentGroupId());
 #ifndef NVMDB_ADAPTER
     InitTransactionContext();
@@ -144,12 +166,10 @@ void DestroyThreadLocalVariables()
 {
     DestroyThreadLocalStorage();
     DestroyLocalTableCache();
-    DestroyLocalRowIdMapCache();
     DestroyLocalIndex();
 #ifndef NVMDB_ADAPTER
     DestroyTransactionContext();
 #endif
-    DestroyLocalUndoSegment();
 }
 
 }  // namespace NVMDB
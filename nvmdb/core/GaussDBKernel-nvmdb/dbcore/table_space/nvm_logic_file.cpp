@@ -20,6 +20,11 @@
  * -------------------------------------------------------------------------
  */
 #include <libpmem.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include <experimental/filesystem>
 
 #include "nvm_logic_file.h"
@@ -33,6 +38,92 @@ uint32 g_dirPathNum;
 
 constexpr mode_t PMEM_MODE = 0666;
 
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* 预取的粒度，每段之间检查 slice 是否仍被映射 */
+static constexpr size_t PREFAULT_CHUNK = 2 * 1024 * 1024;
+static constexpr size_t OS_PAGE_SIZE = 4096;
+
+struct PrefaultTask {
+    LogicFile *m_file;
+    uint32 m_sliceno;
+};
+
+static std::mutex g_prefaultMtx;
+static std::condition_variable g_prefaultCv;
+static std::deque<PrefaultTask> g_prefaultTasks;
+static LogicFile *g_prefaultCurrent = nullptr;
+static bool g_prefaultRunning = false;
+
+static std::atomic<uint64> g_mappedSlices{0};
+static std::atomic<uint64> g_prefaultedBytes{0};
+static std::atomic<bool> g_populateUnsupported{false};
+
+/* 建立 [addr, addr+len) 的页表；内核不支持 MADV_POPULATE_WRITE (5.14 之前) 时逐页读一次 */
+static void PopulateRange(char *addr, size_t len)
+{
+    if (!g_populateUnsupported.load(std::memory_order_relaxed)) {
+        if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) {
+            g_prefaultedBytes.fetch_add(len, std::memory_order_relaxed);
+            return;
+        }
+        if (errno == EINVAL) {
+            g_populateUnsupported.store(true, std::memory_order_relaxed);
+        }
+    }
+    for (size_t off = 0; off < len; off += OS_PAGE_SIZE) {
+        (void)*(volatile char *)(addr + off);
+    }
+    g_prefaultedBytes.fetch_add(len, std::memory_order_relaxed);
+}
+
+static void PrefaultWorker()
+{
+    pthread_setname_np(pthread_self(), "NVM Prefault");
+    std::unique_lock<std::mutex> lock(g_prefaultMtx);
+    while (!g_prefaultTasks.empty()) {
+        PrefaultTask task = g_prefaultTasks.front();
+        g_prefaultTasks.pop_front();
+        g_prefaultCurrent = task.m_file;
+        lock.unlock();
+        task.m_file->PrefaultSlice(task.m_sliceno);
+        lock.lock();
+        g_prefaultCurrent = nullptr;
+        g_prefaultCv.notify_all();
+    }
+    /* 队列为空即退出，下次提交时重新拉起 */
+    g_prefaultRunning = false;
+}
+
+static void SubmitPrefault(LogicFile *file, uint32 sliceno)
+{
+    std::lock_guard<std::mutex> guard(g_prefaultMtx);
+    g_prefaultTasks.push_back(PrefaultTask{file, sliceno});
+    if (!g_prefaultRunning) {
+        g_prefaultRunning = true;
+        std::thread(PrefaultWorker).detach();
+    }
+}
+
+void GetMMapStat(MMapStat *stat)
+{
+    stat->m_mappedSlices = g_mappedSlices.load(std::memory_order_relaxed);
+    stat->m_prefaultedBytes = g_prefaultedBytes.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(g_prefaultMtx);
+        stat->m_pendingPrefaults = g_prefaultTasks.size();
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        stat->m_minorFaults = usage.ru_minflt;
+        stat->m_majorFaults = usage.ru_majflt;
+    } else {
+        stat->m_minorFaults = stat->m_majorFaults = 0;
+    }
+}
+
 void ParseDirectoryConfig(const char *dirNames, bool isInit, uint32 &dirPathNum,
                           std::vector<std::string> &dirPaths)
 {
@@ -65,13 +156,65 @@ void ParseDirectoryConfig(const char *dirNames, bool isInit, uint32 &dirPathNum,
     }
 }
 
-bool LogicFile::MMapFile(uint32 sliceno, bool create)
+void LogicFile::Mount()
 {
-    if (m_sliceAddr.size() > sliceno) {
-        if (m_sliceAddr[sliceno] != nullptr) {
-            return true;
+    /* 只探测文件是否存在，真正的映射推迟到首次访问，启动时间不再随数据量增长 */
+    uint32 sliceNum = 0;
+    while (sliceNum < MAX_SLICE_NUM && access(GetFilename(sliceNum).c_str(), F_OK) == 0) {
+        sliceNum++;
+    }
+    MMapFile(0, false);
+    m_sliceNum.store(std::max(sliceNum, SliceNumber()), std::memory_order_release);
+
+#ifndef SIMULATE_MMAP
+    if (m_mmapOptions.m_prefault == MMAP_PREFAULT_ASYNC) {
+        /* 后台线程顺带完成映射 */
+        for (uint32 i = 1; i < sliceNum; i++) {
+            SubmitPrefault(this, i);
         }
     }
+#endif
+}
+
+void LogicFile::UnMount()
+{
+    CancelPrefault();
+    uint32 sliceNum = SliceNumber();
+    for (uint32 i = 0; i < sliceNum; i++) {
+        UMMapFile(i);
+    }
+    m_sliceNum.store(0, std::memory_order_release);
+}
+
+char *LogicFile::MapSliceOnDemand(uint32 sliceno)
+{
+    /* 页号合法则文件一定存在 */
+    bool exist = MMapFile(sliceno, false);
+    ALWAYS_CHECK(exist);
+    return SliceAddr(sliceno);
+}
+
+void LogicFile::SetSliceAddr(uint32 sliceno, char *addr)
+{
+    std::atomic<char *> *chunk = m_sliceDir[sliceno >> SLICE_CHUNK_SHIFT].load(std::memory_order_relaxed);
+    if (chunk == nullptr) {
+        chunk = new std::atomic<char *>[SLICE_CHUNK_LEN]();
+        m_sliceDir[sliceno >> SLICE_CHUNK_SHIFT].store(chunk, std::memory_order_release);
+    }
+    chunk[sliceno & (SLICE_CHUNK_LEN - 1)].store(addr, std::memory_order_release);
+}
+
+bool LogicFile::MMapFile(uint32 sliceno, bool create, bool submitPrefault)
+{
+    ALWAYS_CHECK(sliceno < MAX_SLICE_NUM);
+    if (SliceAddr(sliceno) != nullptr) {
+        return true;
+    }
+    /* 不同 space 的分配者可能同时扩展文件，slice 数组的修改需要串行 */
+    std::lock_guard<std::mutex> guard(m_spcMtx);
+    if (SliceAddr(sliceno) != nullptr) {
+        return true;
+    }
     void *pmemaddr;
 
 #ifdef SIMULATE_MMAP
@@ -95,36 +238,93 @@ bool LogicFile::MMapFile(uint32 sliceno, bool create)
     if (!isPmem && !reportSimulate) {
         reportSimulate = true;
     }
+    AdviseSlice((char *)pmemaddr);
 #endif
-    if (m_sliceAddr.size() <= sliceno) {
-        if (m_sliceAddr.size() < sliceno) {
-            m_sliceAddr.resize(sliceno, nullptr);
-        }
-        m_sliceAddr.push_back((char *)pmemaddr);
-    } else {
-        Assert(m_sliceAddr.size() > sliceno);
-        m_sliceAddr[sliceno] = (char *)pmemaddr;
+    SetSliceAddr(sliceno, (char *)pmemaddr);
+    if (m_sliceNum.load(std::memory_order_relaxed) <= sliceno) {
+        m_sliceNum.store(sliceno + 1, std::memory_order_release);
     }
-    Assert(m_sliceAddr.size() > sliceno);
+    g_mappedSlices.fetch_add(1, std::memory_order_relaxed);
 
+#ifndef SIMULATE_MMAP
+    if (m_mmapOptions.m_prefault == MMAP_PREFAULT_SYNC) {
+        PopulateRange((char *)pmemaddr, SLICE_LEN);
+    } else if (m_mmapOptions.m_prefault == MMAP_PREFAULT_ASYNC && submitPrefault) {
+        m_prefaultCanceled.store(false, std::memory_order_relaxed);
+        SubmitPrefault(this, sliceno);
+    }
+#endif
     return true;
 }
 
+void LogicFile::AdviseSlice(char *addr)
+{
+    /* 只是提示，失败（如 DAX 不支持透明大页）不影响正确性 */
+    if (m_mmapOptions.m_hugePage) {
+        (void)madvise(addr, SLICE_LEN, MADV_HUGEPAGE);
+    }
+    if (m_mmapOptions.m_access == MMAP_ACCESS_SEQUENTIAL) {
+        (void)madvise(addr, SLICE_LEN, MADV_SEQUENTIAL);
+    } else if (m_mmapOptions.m_access == MMAP_ACCESS_RANDOM) {
+        (void)madvise(addr, SLICE_LEN, MADV_RANDOM);
+    }
+}
+
+void LogicFile::PrefaultSlice(uint32 sliceno)
+{
+    /* 挂载时尚未映射的 slice 在这里映射；已被 punch 的 slice 不再存在，直接跳过 */
+    if (m_prefaultCanceled.load(std::memory_order_relaxed) || !MMapFile(sliceno, false, false)) {
+        return;
+    }
+    for (size_t off = 0; off < SLICE_LEN; off += PREFAULT_CHUNK) {
+        if (m_prefaultCanceled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        /* 持锁保证预取期间 slice 不会被 punch 掉 */
+        std::lock_guard<std::mutex> guard(m_spcMtx);
+        char *addr = SliceAddr(sliceno);
+        if (addr == nullptr) {
+            return;
+        }
+        PopulateRange(addr + off, std::min(PREFAULT_CHUNK, SLICE_LEN - off));
+    }
+}
+
+void LogicFile::CancelPrefault()
+{
+    if (m_mmapOptions.m_prefault != MMAP_PREFAULT_ASYNC) {
+        return;
+    }
+    m_prefaultCanceled.store(true, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(g_prefaultMtx);
+    for (auto iter = g_prefaultTasks.begin(); iter != g_prefaultTasks.end();) {
+        if (iter->m_file == this) {
+            iter = g_prefaultTasks.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    g_prefaultCv.wait(lock, [this] { return g_prefaultCurrent != this; });
+}
+
 void LogicFile::UMMapFile(uint32 sliceno, bool destroy)
 {
-    if (m_sliceAddr.size() <= sliceno || m_sliceAddr[sliceno] == nullptr) {
+    std::lock_guard<std::mutex> guard(m_spcMtx);
+    char *addr = SliceAddr(sliceno);
+    if (addr == nullptr) {
         return;
     }
 #ifdef SIMULATE_MMAP
-    free(slice_addr[sliceno]);
+    free(addr);
 #else
-    pmem_unmap(m_sliceAddr[sliceno], SLICE_LEN);
+    pmem_unmap(addr, SLICE_LEN);
 #endif
-    m_sliceAddr[sliceno] = nullptr;
+    SetSliceAddr(sliceno, nullptr);
+    g_mappedSlices.fetch_sub(1, std::memory_order_relaxed);
     if (destroy) {
         std::string filename = GetFilename(sliceno);
         unlink(filename.c_str());
     }
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
@@ -21,6 +21,7 @@
  */
 #include <iostream>
 #include <cstring>
+#include <libpmem.h>
 
 #include "nvm_table_space.h"
 
@@ -38,8 +39,9 @@ void TableSpace::FblInsert(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
 {
     FreeBlockLists *fbl = &m_spaceMetadata[spaceno].m_freeBlockLists[extsz];
     if (fbl->m_root == NVMInvalidBlockNumber) {
-        fbl->m_root = *ptr;
         page_dlist_init_head(this, PageSegmentDListOffset, *ptr);
+        __atomic_store_n(&fbl->m_root, *ptr, __ATOMIC_RELEASE);
+        pmem_persist(&fbl->m_root, sizeof(fbl->m_root));
     } else {
         page_dlist_push_tail(this, PageSegmentDListOffset, fbl->m_root, *ptr);
     }
@@ -47,23 +49,6 @@ void TableSpace::FblInsert(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
     *ptr = NVMInvalidBlockNumber;
 }
 
-void TableSpace::FblInsertList(ExtentSizeType extsz, uint32 *seghead)
-{
-    uint32 node = 0;
-    uint32 spaceno = 0;
-    /* pop until only head left. */
-    while (!page_dlist_is_head(this, PageSegmentDListOffset, *seghead)) {
-        node = page_dlist_pop_tail(this, PageSegmentDListOffset, *seghead);
-        spaceno = get_space_of_page(node);
-        FblInsert(extsz, &node, spaceno);
-    }
-    node = *seghead;
-    spaceno = get_space_of_page(node);
-    FblInsert(extsz, &node, spaceno);
-
-    *seghead = NVMInvalidBlockNumber;
-}
-
 bool TableSpace::FblPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
 {
     FreeBlockLists *fbl = &m_spaceMetadata[spaceno].m_freeBlockLists[extsz];
@@ -74,7 +59,8 @@ bool TableSpace::FblPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
     if (page_dlist_is_head(this, PageSegmentDListOffset, fbl->m_root)) {
         /* last one */
         *ptr = fbl->m_root;
-        fbl->m_root = NVMInvalidBlockNumber;
+        __atomic_store_n(&fbl->m_root, NVMInvalidBlockNumber, __ATOMIC_RELEASE);
+        pmem_persist(&fbl->m_root, sizeof(fbl->m_root));
     } else {
         *ptr = page_dlist_pop_tail(this, PageSegmentDListOffset, fbl->m_root);
     }
@@ -82,12 +68,29 @@ bool TableSpace::FblPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
     return true;
 }
 
+void TableSpace::FblLockedInsert(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
+{
+    std::lock_guard<std::mutex> guard(m_fblMtx[spaceno][extsz]);
+    FblInsert(extsz, ptr, spaceno);
+}
+
+bool TableSpace::FblLockedPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno)
+{
+    /* 表增长阶段空闲链表通常为空，无需加锁即可判断 */
+    if (FblIsEmpty(extsz, spaceno)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(m_fblMtx[spaceno][extsz]);
+    return FblPop(extsz, ptr, spaceno);
+}
+
 void TableSpace::Create()
 {
     LogicFile::Create();
-    m_spaceMetadata = reinterpret_cast<SpaceMetaData *>(m_sliceAddr[0]);
-    m_tableMetadata = reinterpret_cast<TableMetaData *>(m_sliceAddr[0] + NVM_BLCKSZ);
-    Assert(m_dirPathNum * sizeof(SpaceMetaData) <= NVM_BLCKSZ);
+    m_spaceMetadata = reinterpret_cast<SpaceMetaData *>(RelpointOfPageno(0));
+    m_tableMetadata = reinterpret_cast<TableMetaData *>(RelpointOfPageno(0) + NVM_BLCKSZ);
+    m_reclaimQueue = reinterpret_cast<ReclaimQueue *>(RelpointOfPageno(0) + RECLAIM_QUEUE_OFFSET);
+    static_assert(NVMDB_MAX_GROUP * sizeof(SpaceMetaData) <= RECLAIM_QUEUE_OFFSET, "space meta overlaps");
     /* first two block of space 0 kept as space meta and table meta respectively. */
     for (int i = 0; i < m_dirPathNum; i++) {
         m_spaceMetadata[i].m_hwm = (i == 0) ? HIGH_WATER_MARK : 0;
@@ -95,13 +98,18 @@ void TableSpace::Create()
             FblInit(static_cast<ExtentSizeType>(j), i);
         }
     }
+    /* 表目录的哈希层在第一次建表时才分配 */
+    m_tableMetadata->m_levelNum = 0;
+    m_tableMetadata->m_magic = TABLE_CATALOG_MAGIC;
+    pmem_persist(m_tableMetadata, sizeof(TableMetaData));
 }
 
 void TableSpace::Mount()
 {
     LogicFile::Mount();
-    m_spaceMetadata = reinterpret_cast<SpaceMetaData *>(m_sliceAddr[0]);
-    m_tableMetadata = reinterpret_cast<TableMetaData *>(m_sliceAddr[0] + NVM_BLCKSZ);
+    m_spaceMetadata = reinterpret_cast<SpaceMetaData *>(RelpointOfPageno(0));
+    m_tableMetadata = reinterpret_cast<TableMetaData *>(RelpointOfPageno(0) + NVM_BLCKSZ);
+    m_reclaimQueue = reinterpret_cast<ReclaimQueue *>(RelpointOfPageno(0) + RECLAIM_QUEUE_OFFSET);
 #ifndef SIMULATE_MMAP
     Assert(m_spaceMetadata->m_hwm > 0);
 #endif
@@ -112,6 +120,7 @@ void TableSpace::Mount()
             extend(get_global_page_num(j * SLICE_BLOCKS, i));
         }
     }
+    ALWAYS_CHECK(m_tableMetadata->m_magic == TABLE_CATALOG_MAGIC);
 }
 
 void TableSpace::UnMount()
@@ -126,43 +135,55 @@ void TableSpace::Drop()
 
 char *TableSpace::RootPage()
 {
-    Assert(m_sliceAddr.size() > 0);
-    return m_sliceAddr[0] + NVM_BLCKSZ;
+    Assert(SliceNumber() > 0);
+    return RelpointOfPageno(0) + NVM_BLCKSZ;
 }
 
 void TableSpace::AllocNewExtent(uint32 *ptr, ExtentSizeType blksz, uint32 root, uint32 spaceno)
 {
     /* pageno is physical page number. */
     uint32 pageno;
-    m_spcMtx.lock();
-    if (!FblPop(blksz, &pageno, spaceno)) {
-        /* no free page yet, allocating a new extent. */
-        uint32 restBlocks = CurrentSliceRestBlocks(spaceno);
-        if (restBlocks < GetExtentBlockCount(blksz)) {
-            /* Ensure the new extent should be in one slice. If the rest space can not allocate an extent, skip current
-             * slice and push all rest blocks into free list of EXTENT_8k */
-            for (int i = 0; i < restBlocks; i++) {
-                uint32 blkno = m_spaceMetadata[spaceno].m_hwm + i;
-                blkno = get_global_page_num(blkno, spaceno);
-                FblInsert(EXTSZ_8K, &blkno, spaceno);
+    if (!FblLockedPop(blksz, &pageno, spaceno)) {
+        std::lock_guard<std::mutex> hwmGuard(m_hwmMtx[spaceno]);
+        /* others may have freed an extent while we were waiting for the hwm lock */
+        if (!FblLockedPop(blksz, &pageno, spaceno)) {
+            /* no free page yet, allocating a new extent. */
+            Assert(GetExtentBlockCount(blksz) <= SLICE_BLOCKS);
+            uint32 restBlocks = CurrentSliceRestBlocks(spaceno);
+            if (restBlocks < GetExtentBlockCount(blksz)) {
+                /* Ensure the new extent should be in one slice. If the rest space can not allocate an extent, skip
+                 * current slice and cut the rest blocks into the largest extents that fit, pushing them into the
+                 * matching free lists. */
+                while (restBlocks > 0) {
+                    ExtentSizeType restsz = LargestExtentWithin(restBlocks);
+                    uint32 blkno = get_global_page_num(m_spaceMetadata[spaceno].m_hwm, spaceno);
+                    NVMPageHeader *restHeader = reinterpret_cast<NVMPageHeader *>(RelpointOfPageno(blkno));
+                    restHeader->m_blkno = blkno;
+                    restHeader->m_blksz = restsz;
+                    {
+                        std::lock_guard<std::mutex> fblGuard(m_fblMtx[spaceno][restsz]);
+                        FblInsert(restsz, &blkno, spaceno);
+                    }
+                    m_spaceMetadata[spaceno].m_hwm += GetExtentBlockCount(restsz);
+                    restBlocks -= GetExtentBlockCount(restsz);
+                }
+                Assert(m_spaceMetadata[spaceno].m_hwm % SLICE_BLOCKS == 0);
             }
-            m_spaceMetadata[spaceno].m_hwm += restBlocks;
-            Assert(m_spaceMetadata[spaceno].m_hwm % SLICE_BLOCKS == 0);
-        }
 
-        uint32 newHwm = m_spaceMetadata[spaceno].m_hwm + GetExtentBlockCount(blksz);
-        uint32 nextSliceno = get_global_page_num(newHwm, spaceno) / SLICE_BLOCKS;
+            uint32 newHwm = m_spaceMetadata[spaceno].m_hwm + GetExtentBlockCount(blksz);
+            uint32 nextSliceno = get_global_page_num(newHwm, spaceno) / SLICE_BLOCKS;
 
-        /* ensure not exceeding file size */
-        MMapFile(nextSliceno, true);
-        pageno = get_global_page_num(m_spaceMetadata[spaceno].m_hwm, spaceno);
-        m_spaceMetadata[spaceno].m_hwm = newHwm;
+            /* ensure not exceeding file size */
+            MMapFile(nextSliceno, true);
+            pageno = get_global_page_num(m_spaceMetadata[spaceno].m_hwm, spaceno);
+            m_spaceMetadata[spaceno].m_hwm = newHwm;
+        }
     }
-    m_spcMtx.unlock();
 
     NVMPageHeader *pageHeader = reinterpret_cast<NVMPageHeader *>(RelpointOfPageno(pageno));
     pageHeader->m_blkno = pageno;
     pageHeader->m_blksz = blksz;
+    pageHeader->m_usedCount = 0;
 
     if (NVMBlockNumberIsInvalid(root)) {
         /* 链表自己指向自己 */
@@ -180,67 +201,215 @@ void TableSpace::AllocNewExtent(uint32 *ptr, ExtentSizeType blksz, uint32 root,
 
 void TableSpace::FreeExtent(uint32 *ptr)
 {
-    std::lock_guard<std::mutex> guard(m_spcMtx);
-
     NVMPageHeader *pageHeader = reinterpret_cast<NVMPageHeader *>(RelpointOfPageno(*ptr));
     Assert(*ptr == pageHeader->m_blkno);
     uint32 spaceno = get_space_of_page(*ptr);
-    FblInsert(static_cast<ExtentSizeType>(pageHeader->m_blksz), ptr, spaceno);
+    FblLockedInsert(static_cast<ExtentSizeType>(pageHeader->m_blksz), ptr, spaceno);
 }
 
 void TableSpace::FreeSegment(uint32 *ptr)
 {
-    std::lock_guard<std::mutex> guard(m_spcMtx);
-
     NVMPageHeader *pageHeader = reinterpret_cast<NVMPageHeader *>(RelpointOfPageno(*ptr));
     Assert(*ptr == pageHeader->m_blkno);
-    FblInsertList(static_cast<ExtentSizeType>(pageHeader->m_blksz), ptr);
+    /* segment 链表归调用者独占，只需对目标空闲链表逐个加锁 */
+    while (!FreeSegmentChunk(*ptr, MAX_UINT32)) {
+    }
+    FreeExtent(ptr);
 }
 
-void TableSpace::CreateTable(const TableSegMetaData &oid2Seg)
+bool TableSpace::FreeSegmentChunk(uint32 seghead, uint32 maxExtents)
 {
-    std::lock_guard<std::mutex> lockGuard(m_spcMtx);
-    errno_t ret =
-        memcpy_s(m_tableMetadata->m_segheads + m_tableMetadata->m_tableNum, sizeof(oid2Seg), &oid2Seg, sizeof(oid2Seg));
+    /* 从尾部弹出，pop 持久化之后才放入空闲链表：宕机最多丢失正在归还的一个 extent，不会重复归还 */
+    for (uint32 i = 0; i < maxExtents; i++) {
+        if (page_dlist_is_head(this, PageSegmentDListOffset, seghead)) {
+            return true;
+        }
+        uint32 node = page_dlist_pop_tail(this, PageSegmentDListOffset, seghead);
+        FreeExtent(&node);
+    }
+    return page_dlist_is_head(this, PageSegmentDListOffset, seghead);
+}
+
+static inline TableSegMetaData CatalogLoad(const TableSegMetaData *slot)
+{
+    static_assert(sizeof(TableSegMetaData) == sizeof(uint64), "catalog slot must be updated atomically");
+    uint64 word = __atomic_load_n(reinterpret_cast<const uint64 *>(slot), __ATOMIC_ACQUIRE);
+    TableSegMetaData value;
+    errno_t ret = memcpy_s(&value, sizeof(value), &word, sizeof(word));
     SecureRetCheck(ret);
-    m_tableMetadata->m_tableNum++;
+    return value;
 }
 
-uint32 TableSpace::SearchTable(uint32 oid)
+static inline bool CatalogSlotIsEmpty(const TableSegMetaData &value)
 {
-    std::lock_guard<std::mutex> lockGuard(m_spcMtx);
-    for (int i = 0; i < m_tableMetadata->m_tableNum; ++i) {
-        TableSegMetaData *segAddr = m_tableMetadata->m_segheads + i;
-        if (segAddr->m_oid == oid) {
-            return segAddr->m_seg;
+    return value.m_oid == 0 && NVMBlockNumberIsInvalid(value.m_seg);
+}
+
+void TableSpace::CatalogStore(TableSegMetaData *slot, const TableSegMetaData &value)
+{
+    uint64 word;
+    errno_t ret = memcpy_s(&word, sizeof(word), &value, sizeof(value));
+    SecureRetCheck(ret);
+    __atomic_store_n(reinterpret_cast<uint64 *>(slot), word, __ATOMIC_RELEASE);
+    pmem_persist(slot, sizeof(TableSegMetaData));
+}
+
+TableSegMetaData *TableSpace::CatalogLookup(uint32 oid, TableSegMetaData *value)
+{
+    uint32 levelNum = __atomic_load_n(&m_tableMetadata->m_levelNum, __ATOMIC_ACQUIRE);
+    uint32 capacity = CatalogLevelCapacity();
+    for (uint32 level = 0; level < levelNum; level++) {
+        TableSegMetaData *entries = CatalogLevel(level);
+        uint32 pos = CatalogHash(oid) % capacity;
+        for (uint32 i = 0; i < TABLE_CATALOG_PROBE_LEN; i++) {
+            TableSegMetaData *slot = entries + (pos + i) % capacity;
+            *value = CatalogLoad(slot);
+            /* 空槽位之后不会再有该 oid：插入总是占用探测序列中的第一个空位，而空槽位只会变为已删除 */
+            if (CatalogSlotIsEmpty(*value)) {
+                break;
+            }
+            if (value->m_oid == oid && NVMBlockNumberIsValid(value->m_seg)) {
+                return slot;
+            }
         }
     }
-    return 0;
+    return nullptr;
+}
+
+TableSegMetaData *TableSpace::CatalogFreeSlot(uint32 level, uint32 oid)
+{
+    TableSegMetaData *entries = CatalogLevel(level);
+    uint32 capacity = CatalogLevelCapacity();
+    uint32 pos = CatalogHash(oid) % capacity;
+    for (uint32 i = 0; i < TABLE_CATALOG_PROBE_LEN; i++) {
+        TableSegMetaData *slot = entries + (pos + i) % capacity;
+        TableSegMetaData value = CatalogLoad(slot);
+        /* 空槽或已删除槽 */
+        if (NVMBlockNumberIsInvalid(value.m_seg)) {
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+void TableSpace::CatalogAddLevel()
+{
+    uint32 level = m_tableMetadata->m_levelNum;
+    ALWAYS_CHECK(level < TABLE_CATALOG_MAX_LEVEL);
+    /* 所有层串在第 0 层所在的 segment 上 */
+    uint32 root = (level == 0) ? NVMInvalidBlockNumber : m_tableMetadata->m_levels[0];
+    uint32 pageno;
+    AllocNewExtent(&pageno, EXTSZ_2M, root);
+    pmem_persist(RelpointOfPageno(pageno), GetExtentSize(EXTSZ_2M));
+
+    /* 先持久化层地址，再发布层数，读者看到新层时其内容一定已清零 */
+    m_tableMetadata->m_levels[level] = pageno;
+    pmem_persist(&m_tableMetadata->m_levels[level], sizeof(uint32));
+    __atomic_store_n(&m_tableMetadata->m_levelNum, level + 1, __ATOMIC_RELEASE);
+    pmem_persist(&m_tableMetadata->m_levelNum, sizeof(uint32));
+}
+
+void TableSpace::CreateTable(const TableSegMetaData &oid2Seg)
+{
+    Assert(oid2Seg.m_oid != TABLE_CATALOG_DELETED_OID && NVMBlockNumberIsValid(oid2Seg.m_seg));
+    std::lock_guard<std::mutex> lockGuard(m_catalogMtx);
+    TableSegMetaData value;
+    Assert(CatalogLookup(oid2Seg.m_oid, &value) == nullptr);
+
+    TableSegMetaData *slot = nullptr;
+    for (uint32 level = 0; level < m_tableMetadata->m_levelNum && slot == nullptr; level++) {
+        slot = CatalogFreeSlot(level, oid2Seg.m_oid);
+    }
+    if (slot == nullptr) {
+        CatalogAddLevel();
+        slot = CatalogFreeSlot(m_tableMetadata->m_levelNum - 1, oid2Seg.m_oid);
+        ALWAYS_CHECK(slot != nullptr);
+    }
+    CatalogStore(slot, oid2Seg);
+}
+
+uint32 TableSpace::SearchTable(uint32 oid)
+{
+    TableSegMetaData value;
+    if (CatalogLookup(oid, &value) == nullptr) {
+        return NVMInvalidBlockNumber;
+    }
+    return value.m_seg;
+}
+
+bool TableSpace::UpdateTable(uint32 oid, uint32 seg)
+{
+    Assert(NVMBlockNumberIsValid(seg));
+    std::lock_guard<std::mutex> lockGuard(m_catalogMtx);
+    TableSegMetaData value;
+    TableSegMetaData *slot = CatalogLookup(oid, &value);
+    if (slot == nullptr) {
+        return false;
+    }
+    CatalogStore(slot, TableSegMetaData{oid, seg});
+    return true;
 }
 
 void TableSpace::DropTable(uint32 oid)
 {
-    int i = 0;
-    TableSegMetaData *segAddr = nullptr;
-    std::lock_guard<std::mutex> lockGuard(m_spcMtx);
-    for (; i < m_tableMetadata->m_tableNum; ++i) {
-        segAddr = m_tableMetadata->m_segheads + i;
-        if (segAddr->m_oid == oid) {
+    std::lock_guard<std::mutex> lockGuard(m_catalogMtx);
+    TableSegMetaData value;
+    TableSegMetaData *slot = CatalogLookup(oid, &value);
+    if (slot == nullptr) {
+        return;
+    }
+    CatalogStore(slot, TableSegMetaData{TABLE_CATALOG_DELETED_OID, NVMInvalidBlockNumber});
+}
+
+int TableSpace::ReclaimEnqueue(uint32 seghead, uint32 oid)
+{
+    Assert(NVMBlockNumberIsValid(seghead));
+    int slot = -1;
+    std::unique_lock<std::mutex> lock(m_reclaimMtx);
+    while (true) {
+        for (uint32 i = 0; i < RECLAIM_QUEUE_LEN; i++) {
+            TableSegMetaData *item = &m_reclaimQueue->m_items[i];
+            if (NVMBlockNumberIsInvalid(CatalogLoad(item).m_seg)) {
+                CatalogStore(item, TableSegMetaData{oid, seghead});
+                slot = static_cast<int>(i);
+                break;
+            }
+        }
+        if (slot >= 0) {
             break;
         }
+        m_reclaimCv.wait(lock);
+    }
+    /* 先登记再删表目录项：宕机后由 ReclaimPending 补做删除，segment 不会泄漏 */
+    if (oid != TABLE_CATALOG_DELETED_OID) {
+        DropTable(oid);
     }
+    return slot;
+}
 
-    if (segAddr == nullptr) {
-        return;
+void TableSpace::ReclaimDone(int slot)
+{
+    Assert(slot >= 0 && static_cast<uint32>(slot) < RECLAIM_QUEUE_LEN);
+    {
+        std::lock_guard<std::mutex> lockGuard(m_reclaimMtx);
+        CatalogStore(&m_reclaimQueue->m_items[slot], TableSegMetaData{0, NVMInvalidBlockNumber});
     }
+    m_reclaimCv.notify_all();
+}
 
-    size_t count = m_tableMetadata->m_tableNum - i - 1;
-    if (count != 0) {
-        size_t memLen = count * sizeof(TableSegMetaData);
-        errno_t ret = memmove_s(m_tableMetadata->m_segheads + i, memLen, m_tableMetadata->m_segheads + i + 1, memLen);
-        SecureRetCheck(ret);
+void TableSpace::ReclaimPending(std::vector<std::pair<int, uint32>> *pending)
+{
+    std::lock_guard<std::mutex> lockGuard(m_reclaimMtx);
+    for (uint32 i = 0; i < RECLAIM_QUEUE_LEN; i++) {
+        TableSegMetaData item = CatalogLoad(&m_reclaimQueue->m_items[i]);
+        if (NVMBlockNumberIsInvalid(item.m_seg)) {
+            continue;
+        }
+        if (item.m_oid != TABLE_CATALOG_DELETED_OID && SearchTable(item.m_oid) == item.m_seg) {
+            DropTable(item.m_oid);
+        }
+        pending->push_back({static_cast<int>(i), item.m_seg});
     }
-    m_tableMetadata->m_tableNum--;
 }
 
 }  // namespace NVMDB
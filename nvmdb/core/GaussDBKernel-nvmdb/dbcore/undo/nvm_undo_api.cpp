@@ -33,10 +33,21 @@ void UndoCreate(const char *dir)
 }
 
 void UndoBootStrap(const char *dir)
+{
+    UndoMount(dir);
+    UndoStartRecovery();
+}
+
+void UndoMount(const char *dir)
 {
     UndoSegmentMount(dir);
 }
 
+void UndoStartRecovery()
+{
+    UndoSegmentStartRecovery();
+}
+
 void UndoExitProcess()
 {
     UndoSegmentUnmount();
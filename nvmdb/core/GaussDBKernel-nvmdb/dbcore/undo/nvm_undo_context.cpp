@@ -20,6 +20,7 @@
  * -------------------------------------------------------------------------
  */
 #include <cstring>
+#include <libpmem.h>
 
 #include "nvm_undo_context.h"
 
@@ -27,8 +28,7 @@ namespace NVMDB {
 
 UndoTrxContext *AllocUndoContext()
 {
-    SwitchUndoSegmentIfFull();
-    UndoSegment *undo_segment = PickSegmentForTrx();
+    UndoSegment *undo_segment = AcquireUndoSegment();
     uint64 trxslot_id = undo_segment->GetNextTrxSlot();
     UndoTrxContext *result = new UndoTrxContext(undo_segment, trxslot_id);
     /*
@@ -41,20 +41,29 @@ UndoTrxContext *AllocUndoContext()
 
 UndoRecPtr UndoTrxContext::InsertUndoRecord(UndoRecord *record)
 {
-    record->m_pre = trxslot->end;
+    record->m_pre = m_end;
     UndoRecPtr undo = undo_segment->InsertUndoRecord(record);
+    if (UndoRecPtrIsInValid(undo)) {
+        return undo;
+    }
+    /*
+     * 记录落盘之后才设置 start，宕机恢复时从 start 或 end 向后沿 m_pre 找到最后一条。
+     * 调用者随后就会修改 heap，事务槽（连同状态）要在这之前落盘，否则恢复时找不到这个事务的 undo。
+     */
     if (UndoRecPtrIsInValid(trxslot->start)) {
         trxslot->start = undo;
+        pmem_persist(trxslot, sizeof(TransactionSlot));
     }
-    Assert(trxslot->end < undo);
-    trxslot->end = undo;
-    Assert(trxslot->end >= trxslot->start);
+    Assert(m_end < undo);
+    m_end = undo;
+    Assert(m_end >= trxslot->start);
 
     return undo;
 }
 
 void ReleaseTrxUndoContext(UndoTrxContext *undo_trx_ctx)
 {
+    ReleaseUndoSegment(undo_trx_ctx->BoundSegment());
     delete undo_trx_ctx;
 }
 
@@ -20,6 +20,7 @@
  * -------------------------------------------------------------------------
  */
 #include <cstring>
+#include <cstddef>
 
 #include "nvm_undo_internal.h"
 #include "nvm_undo_segment.h"
@@ -27,6 +28,40 @@
 
 namespace NVMDB {
 
+static const uint64 UNDO_CHECKSUM_MUL = 0x9e3779b97f4a7c15ULL;
+
+/* m_checksum 单独占一个 8 字节字（后 4 字节是对齐空洞），按字计算时整个跳过 */
+static_assert(offsetof(UndoRecord, m_checksum) % sizeof(uint64) == 0, "m_checksum must start a word");
+static_assert(offsetof(UndoRecord, m_rowId) == offsetof(UndoRecord, m_checksum) + sizeof(uint64),
+    "m_checksum must occupy its own word");
+
+/* data 按 8 字节对齐 */
+static uint64 ChecksumRange(uint64 hash, const char *data, uint32 len)
+{
+    const uint64 *words = reinterpret_cast<const uint64 *>(data);
+    uint32 wordNum = len / sizeof(uint64);
+    for (uint32 i = 0; i < wordNum; i++) {
+        hash = (hash ^ words[i]) * UNDO_CHECKSUM_MUL;
+        hash ^= hash >> 29;
+    }
+    for (uint32 i = wordNum * sizeof(uint64); i < len; i++) {
+        hash = (hash ^ static_cast<uint8>(data[i])) * UNDO_CHECKSUM_MUL;
+    }
+    return hash;
+}
+
+uint32 UndoRecChecksum(const UndoRecord *record)
+{
+    Assert(reinterpret_cast<uintptr_t>(record) % sizeof(uint64) == 0);
+    const char *data = reinterpret_cast<const char *>(record);
+    uint32 len = UndoRecTotalSize(record->m_payload);
+    uint32 skipBegin = offsetof(UndoRecord, m_checksum);
+    uint32 skipEnd = skipBegin + sizeof(uint64);
+    uint64 hash = ChecksumRange(len, data, skipBegin);
+    hash = ChecksumRange(hash, data + skipEnd, len - skipEnd);
+    return static_cast<uint32>(hash ^ (hash >> 32));
+}
+
 UndoRecord *CopyUndoRecord(UndoRecPtr ptr, char* undo_record_cache)
 {
     int segid = UndoRecPtrGetSegment(ptr);
@@ -34,4 +69,11 @@ UndoRecord *CopyUndoRecord(UndoRecPtr ptr, char* undo_record_cache)
     return undo_segment->CopyUndoRecord(ptr, undo_record_cache);
 }
 
+UndoRecord *GetUndoRecord(UndoRecPtr ptr, char* undo_record_cache)
+{
+    int segid = UndoRecPtrGetSegment(ptr);
+    UndoSegment *undo_segment = GetUndoSegment(segid);
+    return undo_segment->GetUndoRecord(ptr, undo_record_cache);
+}
+
 }
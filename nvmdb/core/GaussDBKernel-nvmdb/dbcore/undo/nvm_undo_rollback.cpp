@@ -28,30 +28,47 @@
 
 namespace NVMDB {
 
-using NVMUndoFunc = void (*)(UndoRecord *);
+using NVMUndoFunc = void (*)(UndoRecord *, UndoReplayContext *);
+using NVMUndoLaneFunc = uint64 (*)(UndoRecord *);
 
 struct NVMUndoProcedure {
     UndoRecordType type;
     std::string name;
     NVMUndoFunc undoFunc;
+    NVMUndoLaneFunc laneFunc; /* NULL 表示回滚时是屏障 */
 };
 
 static NVMUndoProcedure g_nvmUndoFuncs[] = {
-    {InvalidUndoRecordType, "", NULL},
-    {HeapInsertUndo, "HeapInsertUndo", UndoInsert},
-    {HeapUpdateUndo, "HeapUpdateUndo", UndoUpdate},
-    {HeapDeleteUndo, "HeapDeleteUndo", UndoDelete},
-    {IndexInsertUndo, "IndexInsertUndo", UndoIndexInsert},
-    {IndexDeleteUndo, "IndexDeleteUndo", UndoIndexDelete},
+    {InvalidUndoRecordType, "", NULL, NULL},
+    {HeapInsertUndo, "HeapInsertUndo", UndoInsert, HeapUndoLane},
+    {HeapUpdateUndo, "HeapUpdateUndo", UndoUpdate, HeapUndoLane},
+    {HeapDeleteUndo, "HeapDeleteUndo", UndoDelete, HeapUndoLane},
+    {IndexInsertUndo, "IndexInsertUndo", UndoIndexInsert, IndexUndoLane},
+    {IndexDeleteUndo, "IndexDeleteUndo", UndoIndexDelete, IndexUndoLane},
+    {TableTruncateUndo, "TableTruncateUndo", UndoTruncate, NULL},
 };
 
-void UndoRecordRollBack(UndoRecord *record)
+void UndoRecordRollBack(UndoRecord *record, UndoReplayContext *context)
 {
     if (UndoRecordTypeIsValid((UndoRecordType)record->m_undoType)) {
         NVMUndoProcedure *procedure = &g_nvmUndoFuncs[record->m_undoType];
         Assert(procedure->type == record->m_undoType);
-        procedure->undoFunc(record);
+        procedure->undoFunc(record, context);
     }
 }
 
-}
\ No newline at end of file
+bool UndoRecordRollBackLane(UndoRecord *record, uint64 *lane)
+{
+    if (!UndoRecordTypeIsValid((UndoRecordType)record->m_undoType)) {
+        return false;
+    }
+    NVMUndoProcedure *procedure = &g_nvmUndoFuncs[record->m_undoType];
+    Assert(procedure->type == record->m_undoType);
+    if (procedure->laneFunc == NULL) {
+        return false;
+    }
+    *lane = procedure->laneFunc(record);
+    return true;
+}
+
+}
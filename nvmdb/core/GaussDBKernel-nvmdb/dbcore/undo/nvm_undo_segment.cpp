@@ -20,9 +20,16 @@
  * -------------------------------------------------------------------------
  */
 #include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <cstddef>
 #include <cstring>
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include <unistd.h>
+#include <libpmem.h>
 
 #include "nvm_transaction.h"
 #include "nvm_undo_rollback.h"
@@ -32,21 +39,115 @@
 
 namespace NVMDB {
 
-static UndoSegment *g_undo_segment_padding[NVMDB_UNDO_SEGMENT_NUM + 16];
-static UndoSegment **g_undo_segments = &g_undo_segment_padding[16];
-static bool g_undo_segment_allocated[NVMDB_UNDO_SEGMENT_NUM];
+/* 文件尚未创建的 segment 为 NULL；创建时在 g_undoSegmentLock 下发布，后台线程无锁读取 */
+static std::atomic<UndoSegment *> g_undo_segment_padding[NVMDB_UNDO_SEGMENT_NUM + 16];
+static std::atomic<UndoSegment *> *g_undo_segments = &g_undo_segment_padding[16];
+
+/*
+ * 空闲的 segment 按所在目录分组放在无锁栈中，事务第一次写 undo 时取一个，结束时放回，线程本身不占用 segment。
+ * 栈顶是 {版本号:32, segid + 1:32}，每次修改版本号加一，避免 ABA；next 中同样存 segid + 1，0 表示栈底。
+ */
+static std::atomic<uint64> g_freeSegmentHead[NVMDB_MAX_GROUP];
+static std::atomic<uint32> g_freeSegmentNext[NVMDB_UNDO_SEGMENT_NUM];
+static const uint32 InvalidSegmentId = 0xFFFFFFFF;
+
+/*
+ * undo segment 的文件在第一次被事务绑定时才创建，文件个数随写事务的并发数增长。
+ * 元数据文件中的位图持久化地记录哪些 segment 已经创建，重启时只挂载这些 segment。
+ */
+static const char *g_undoMetaFilename = "undometa";
+static const uint32 UNDO_META_MAGIC = 0x4E56554D; /* "NVUM" */
+
+struct UndoMetaData {
+    uint32 m_magic;
+    uint64 m_created[NVMDB_UNDO_SEGMENT_NUM / BIS_PER_U64];
+};
+
+static LogicFile *g_undoMeta = nullptr;
+static UndoMetaData *g_undoMetaData = nullptr;
 
 constexpr int SLOT_OFFSET = 2;
 
 static const char *g_undoFilename = "undo";
 
-thread_local UndoSegment *t_undo_segment = nullptr;
-thread_local uint64 my_clock = 0;
-static uint64 clock_sweep = 0;
 std::mutex g_undoSegmentLock;
 
 std::thread g_undoRecycle;
-static bool g_doRecycle = true;
+static std::atomic<bool> g_doRecycle{true};
+
+/*
+ * 回收由一个协调线程驱动：一轮没有任何进展就按指数退避睡眠，写入者等空间时提前唤醒它；
+ * 未回收的事务槽积压多时，按积压量拉起辅助线程，和协调线程一起按 segment 号分摊一轮回收。
+ */
+static const uint32 RECYCLE_MIN_SLEEP_US = 100;
+static const uint32 RECYCLE_MAX_SLEEP_US = 100 * 1000;
+static std::mutex g_recycleMtx;
+static std::condition_variable g_recycleCv;     /* 唤醒协调线程，或通知它一轮已结束 */
+static std::condition_variable g_recyclePassCv; /* 唤醒辅助线程参与新的一轮 */
+static bool g_recycleRequested = false;
+static uint64 g_recyclePassGen = 0;
+static uint32 g_recyclePassWorkers = 0;  /* 本轮参与的线程数，含协调线程 */
+static uint32 g_recyclePassPending = 0;  /* 本轮还没结束的辅助线程数 */
+static uint64 g_recyclePassSnapshot = 0;
+static uint64 g_recyclePassNowUs = 0;
+static std::atomic<uint32> g_recycleNextSegment{0};
+static std::atomic<uint64> g_retentionAgeMs{NVMDB_UNDO_RETENTION_AGE_MS};
+static std::atomic<uint64> g_retentionBytes{NVMDB_UNDO_RETENTION_BYTES};
+static std::atomic<bool> g_recyclePassProgress{false};
+static UndoRecycleStat g_recyclePassStat;  /* 本轮累计的滞后，g_recycleMtx 保护 */
+static UndoRecycleStat g_recycleStat;      /* 上一轮的结果，g_recycleMtx 保护 */
+
+/* 写入者等待回收时调用，让协调线程立即开始下一轮 */
+static void RequestUndoRecycle()
+{
+    std::lock_guard<std::mutex> guard(g_recycleMtx);
+    g_recycleRequested = true;
+    g_recycleCv.notify_one();
+}
+
+/* 上一次 Unmount 停掉了回收线程，启动前重新打开并清空统计 */
+static void StartUndoRecycle()
+{
+    std::lock_guard<std::mutex> guard(g_recycleMtx);
+    g_doRecycle = true;
+    g_recycleRequested = false;
+    g_recycleStat = UndoRecycleStat{};
+}
+
+static uint32 g_recoveryWorkers = NVMDB_UNDO_RECOVERY_WORKER_NUM;
+static std::atomic<uint32> g_recoveryNextSegment{0};
+static std::atomic<uint32> g_recoveryDoneSegments{0};
+static std::atomic<uint64> g_recoveryPendingTrxs{0};
+static std::atomic<uint64> g_recoveryRolledBackTrxs{0};
+static std::atomic<uint64> g_recoveryElapsedUs{0};
+static std::atomic<bool> g_recoveryFinished{false};
+
+/* 默认不超过 CPU 数，单核上并行回放只有开销 */
+static uint32 DefaultUndoRollbackWorkers()
+{
+    return std::max(1U, std::min(NVMDB_UNDO_ROLLBACK_WORKER_NUM, std::thread::hardware_concurrency()));
+}
+
+static std::atomic<uint32> g_rollbackWorkers{DefaultUndoRollbackWorkers()};
+
+/*
+ * 每个线程缓存最近解析过的已结束事务的状态和 CSN，扫描时反复遇到同一批写入者不必每次读 NVM 上的 slot。
+ * 提交或回滚之后状态不再变化；slot 被回收后 min_slot_id 会越过它，命中时再检查一次，返回值和不缓存时一致。
+ * 重新挂载后 slot id 从头分配，按挂载的代数整体作废。
+ */
+static const uint32 TRX_INFO_CACHE_SIZE = 64;
+static const uint32 TRX_INFO_CACHE_SEG_STRIDE = 0x9E37;
+
+struct TrxInfoCacheEntry {
+    TransactionSlotPtr m_trxPtr{0};
+    uint64 m_csn{0};
+    TransactionSlotStatus m_status{TRX_EMPTY};
+    uint32 m_epoch{0}; /* 0 表示无效 */
+};
+
+static std::atomic<uint32> g_undoMountEpoch{1};
+static thread_local TrxInfoCacheEntry t_trxInfoCache[TRX_INFO_CACHE_SIZE];
+static thread_local TrxInfoCacheStat t_trxInfoCacheStat = {0, 0};
 
 void UndoSegmentInitHead(UndoSegmentHead *head)
 {
@@ -61,6 +162,9 @@ void UndoSegmentInitHead(UndoSegmentHead *head)
     head->min_slot_id = 0;
 }
 
+/* undo 按顺序追加、顺序回放；segment 数量多，不做预取 */
+static const MMapOptions UNDO_MMAP_OPTIONS = {MMAP_PREFAULT_NONE, MMAP_ACCESS_SEQUENTIAL, false};
+
 static std::string generate_undo_filename(uint32 segment_id)
 {
     return std::string(g_undoFilename) + std::to_string(segment_id);
@@ -69,9 +173,190 @@ static std::string generate_undo_filename(uint32 segment_id)
 UndoSegment::UndoSegment(const char *dir, uint32 segment_id)
     : segid(segment_id),
       filename(generate_undo_filename(segment_id)),
-      LogicFile(dir, generate_undo_filename(segment_id).c_str(), UNDO_SLICE_SIZE, UNDO_MAX_SLICE_NUM)
+      LogicFile(dir, generate_undo_filename(segment_id).c_str(), UNDO_SLICE_SIZE, UNDO_MAX_SLICE_NUM,
+                UNDO_MMAP_OPTIONS)
 {}
 
+/*
+ * 同一事务的 undo 首尾相接，沿 m_pre 往回读是逆序的顺序访问。每读一条就预取约十几条之前的两个 cache line，
+ * 回滚时读记录的开销比回放本身还大。跨 slice 时预取到的地址不一定有效，预取不会出错。
+ */
+static const uint32 UNDO_PREFETCH_DISTANCE = 1024;
+static const uint32 UNDO_PREFETCH_LINE = 64;
+
+static inline void PrefetchPrecedingUndo(const UndoRecord *record)
+{
+    const char *addr = reinterpret_cast<const char *>(record);
+    __builtin_prefetch(addr - UNDO_PREFETCH_DISTANCE);
+    __builtin_prefetch(addr - UNDO_PREFETCH_DISTANCE - UNDO_PREFETCH_LINE);
+}
+
+static inline uint32 UndoLaneWorker(uint64 lane, uint32 workers)
+{
+    /* 相邻的 lane 打散到不同线程 */
+    return static_cast<uint32>(((lane * 0x9E3779B97F4A7C15ULL) >> BIS_PER_U32) % workers);
+}
+
+/*
+ * 回滚线程池：第一次并行回滚时按需拉起，线程局部变量只初始化一次，卸载时停止。
+ * 一个大事务回滚期间独占借到的线程，同一个 lane 的记录总是交给同一个线程，按交付的顺序回放。
+ */
+static const uint32 UNDO_ROLLBACK_CHUNK_LEN = 256;
+
+struct UndoRollbackWorker {
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<std::vector<UndoRecPtr>> m_chunks; /* 待回放的记录，每批内已是逆序 */
+    bool m_running{false};                         /* 正在回放取出的一批 */
+    bool m_stop{false};
+    UndoSegment *m_segment{nullptr};
+};
+
+static std::mutex g_rollbackMtx;
+static std::vector<UndoRollbackWorker *> g_rollbackPool;
+static std::vector<UndoRollbackWorker *> g_rollbackIdle;
+
+static void UndoRollbackWorkerMain(UndoRollbackWorker *worker)
+{
+    pthread_setname_np(pthread_self(), "NVM UndoRollback");
+    InitThreadLocalVariables();
+    char *undo_record_cache = new char[MAX_UNDO_RECORD_CACHE_SIZE];
+    std::unique_lock<std::mutex> lock(worker->m_mtx);
+    while (true) {
+        worker->m_cv.wait(lock, [worker] { return worker->m_stop || !worker->m_chunks.empty(); });
+        if (worker->m_chunks.empty()) {
+            break;
+        }
+        std::vector<UndoRecPtr> chunk = std::move(worker->m_chunks.front());
+        worker->m_chunks.pop_front();
+        worker->m_running = true;
+        lock.unlock();
+        UndoReplayContext context;
+        for (UndoRecPtr ptr : chunk) {
+            UndoRecordRollBack(worker->m_segment->GetUndoRecord(ptr, undo_record_cache), &context);
+        }
+        lock.lock();
+        worker->m_running = false;
+        if (worker->m_chunks.empty()) {
+            worker->m_cv.notify_all();
+        }
+    }
+    lock.unlock();
+    delete[] undo_record_cache;
+    DestroyThreadLocalVariables();
+}
+
+/* 借出空闲线程，总数不超过 limit，不够时新建；可能一个都借不到 */
+static void AcquireRollbackWorkers(uint32 count, uint32 limit, std::vector<UndoRollbackWorker *> *workers)
+{
+    std::lock_guard<std::mutex> guard(g_rollbackMtx);
+    while (g_rollbackIdle.size() < count && g_rollbackPool.size() < limit) {
+        UndoRollbackWorker *worker = new UndoRollbackWorker();
+        worker->m_thread = std::thread(UndoRollbackWorkerMain, worker);
+        g_rollbackPool.push_back(worker);
+        g_rollbackIdle.push_back(worker);
+    }
+    while (workers->size() < count && !g_rollbackIdle.empty()) {
+        workers->push_back(g_rollbackIdle.back());
+        g_rollbackIdle.pop_back();
+    }
+}
+
+static void ReleaseRollbackWorkers(const std::vector<UndoRollbackWorker *> &workers)
+{
+    std::lock_guard<std::mutex> guard(g_rollbackMtx);
+    g_rollbackIdle.insert(g_rollbackIdle.end(), workers.begin(), workers.end());
+}
+
+static void DispatchRollbackChunk(UndoRollbackWorker *worker, std::vector<UndoRecPtr> *chunk)
+{
+    if (chunk->empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(worker->m_mtx);
+    worker->m_chunks.push_back(std::move(*chunk));
+    worker->m_cv.notify_all();
+    chunk->clear();
+    chunk->reserve(UNDO_ROLLBACK_CHUNK_LEN);
+}
+
+/* 交出手上未满的批，等所有线程回放完 */
+static void DrainRollbackWorkers(const std::vector<UndoRollbackWorker *> &workers,
+                                 std::vector<std::vector<UndoRecPtr>> *chunks)
+{
+    for (size_t i = 0; i < workers.size(); i++) {
+        DispatchRollbackChunk(workers[i], &(*chunks)[i]);
+    }
+    for (UndoRollbackWorker *worker : workers) {
+        std::unique_lock<std::mutex> lock(worker->m_mtx);
+        worker->m_cv.wait(lock, [worker] { return worker->m_chunks.empty() && !worker->m_running; });
+    }
+}
+
+static void StopUndoRollbackPool()
+{
+    std::vector<UndoRollbackWorker *> pool;
+    {
+        std::lock_guard<std::mutex> guard(g_rollbackMtx);
+        pool.swap(g_rollbackPool);
+        g_rollbackIdle.clear();
+    }
+    for (UndoRollbackWorker *worker : pool) {
+        {
+            std::lock_guard<std::mutex> guard(worker->m_mtx);
+            worker->m_stop = true;
+            worker->m_cv.notify_all();
+        }
+        worker->m_thread.join();
+        delete worker;
+    }
+}
+
+/*
+ * 和串行回滚一样沿 m_pre 从后往前读记录，按 lane 分给本线程和借来的线程：本线程的 lane 当场回放，
+ * 其余的攒成批交出去，同一 lane 内保持逆序。遇到不能分 lane 的记录（屏障）先等所有线程回放完，再由本线程回放它。
+ * 每条记录回放的都是修改前的镜像，回滚中途宕机后从头重做结果相同。
+ */
+void UndoSegment::BatchRollBack(TransactionSlot *trx_slot, uint32 workers, char *undo_record_cache)
+{
+    std::vector<UndoRollbackWorker *> helpers;
+    AcquireRollbackWorkers(workers - 1, g_rollbackWorkers.load(std::memory_order_relaxed) - 1, &helpers);
+    uint32 lanes = static_cast<uint32>(helpers.size()) + 1;
+    std::vector<std::vector<UndoRecPtr>> chunks(helpers.size());
+    for (size_t i = 0; i < helpers.size(); i++) {
+        helpers[i]->m_segment = this;
+        chunks[i].reserve(UNDO_ROLLBACK_CHUNK_LEN);
+    }
+
+    UndoReplayContext context;
+    UndoRecPtr undo_ptr = trx_slot->end;
+    while (!UndoRecPtrIsInValid(undo_ptr)) {
+        Assert(undo_ptr >= trx_slot->start && undo_ptr <= trx_slot->end);
+        UndoRecord *undo_record = GetUndoRecord(undo_ptr, undo_record_cache);
+        PrefetchPrecedingUndo(undo_record);
+        UndoRecPtr pre = undo_record->m_pre;
+        uint64 lane;
+        if (!UndoRecordRollBackLane(undo_record, &lane)) {
+            DrainRollbackWorkers(helpers, &chunks);
+            UndoRecordRollBack(undo_record, &context);
+        } else {
+            uint32 w = UndoLaneWorker(lane, lanes);
+            if (w == 0) {
+                UndoRecordRollBack(undo_record, &context);
+            } else {
+                chunks[w - 1].push_back(undo_ptr);
+                if (chunks[w - 1].size() == UNDO_ROLLBACK_CHUNK_LEN) {
+                    DispatchRollbackChunk(helpers[w - 1], &chunks[w - 1]);
+                }
+            }
+        }
+        undo_ptr = pre;
+    }
+    DrainRollbackWorkers(helpers, &chunks);
+    ReleaseRollbackWorkers(helpers);
+}
+
 void UndoSegment::RollBack(TransactionSlot *trx_slot, char *undo_record_cache)
 {
     if (UndoRecPtrIsInValid(trx_slot->start)) {
@@ -79,32 +364,41 @@ void UndoSegment::RollBack(TransactionSlot *trx_slot, char *undo_record_cache)
         return;
     }
 
+    uint64 undoBytes = UndoRecPtrGetOffset(trx_slot->end) - UndoRecPtrGetOffset(trx_slot->start);
+    uint64 workers = std::min(static_cast<uint64>(g_rollbackWorkers.load(std::memory_order_relaxed)),
+                              undoBytes / NVMDB_UNDO_ROLLBACK_BYTES_PER_WORKER);
+    if (workers > 1) {
+        BatchRollBack(trx_slot, static_cast<uint32>(workers), undo_record_cache);
+        return;
+    }
+
+    UndoReplayContext context;
     UndoRecPtr undo_ptr = trx_slot->end;
     while (!UndoRecPtrIsInValid(undo_ptr)) {
         Assert(undo_ptr >= trx_slot->start && undo_ptr <= trx_slot->end);
-        UndoRecord *undo_record = CopyUndoRecord(undo_ptr, undo_record_cache);
-        UndoRecordRollBack(undo_record);
+        UndoRecord *undo_record = GetUndoRecord(undo_ptr, undo_record_cache);
+        PrefetchPrecedingUndo(undo_record);
+        UndoRecordRollBack(undo_record, &context);
         undo_ptr = undo_record->m_pre;
     }
 }
 
 void UndoSegment::Recovery(uint64 &max_undo_csn)
 {
+    /* 回收时记下的快照可能比剩下的事务的 CSN 都大，重启后的 CSN 不能比它小 */
+    if (max_undo_csn < seghead->min_snapshot) {
+        max_undo_csn = seghead->min_snapshot;
+    }
     if (trxslot_is_empty()) {
-        if (max_undo_csn < seghead->min_snapshot) {
-            max_undo_csn = seghead->min_snapshot;
-        }
         return;
     }
     Assert(seghead->next_free_slot >= 1);
-    /* the last 2 allocated trx slot.  */
-    uint64 slot_begin = 0;
+    /* segment 被释放后会优先复用，未回收的 slot 中可能有多个未完成的事务，全部检查 */
+    uint64 slot_begin = seghead->next_recycle_slot;
     uint64 slot_end = seghead->next_free_slot - 1;
-    if (slot_end != 0) {
-        slot_begin = slot_end - 1;
-    }
     TransactionSlot *trx_slot = nullptr;
     uint64 undo_csn = 0;
+    uint64 recovered_end = 0;
     for (uint64 i = slot_begin; i <= slot_end; i++) {
         trx_slot = &seghead->trxslots[i % UNDO_TRX_SLOTS];
         uint32 tx_status = trx_slot->status;
@@ -114,6 +408,8 @@ void UndoSegment::Recovery(uint64 &max_undo_csn)
             max_undo_csn = undo_csn;
         } else if (tx_status == TRX_IN_PROGRESS) {
             /* do roll back */
+            g_recoveryPendingTrxs.fetch_add(1, std::memory_order_relaxed);
+            recovered_end = std::max(recovered_end, RecoverTrxSlotEnd(trx_slot));
         } else {
             /* already rollback  */
         }
@@ -121,14 +417,55 @@ void UndoSegment::Recovery(uint64 &max_undo_csn)
 
     if (seghead->recovery_start == 0) {
         /* safe to update recovery restart point; Otherwise means that last crash happens during recovery */
+        /* 存的是 slot 号加 1，0 表示没有待恢复的事务，否则 segment 的第 0 个事务永远不会被回滚 */
         seghead->recovery_start = slot_begin + 1;
     }
     seghead->recovery_end = slot_end;
+    /* 未完成事务的 undo 可能写到了 free_begin 之后，新的 undo 必须接在它们后面 */
+    if (recovered_end > seghead->free_begin) {
+        seghead->free_begin = recovered_end;
+    }
+    m_freeBegin = seghead->free_begin;
+    m_tailLoaded = false;
 }
 
-void UndoSegment::BGRecovery()
+uint64 UndoSegment::RecoverTrxSlotEnd(TransactionSlot *trx_slot)
 {
-    for (uint64 i = seghead->recovery_start; i <= seghead->recovery_end; i++) {
+    if (UndoRecPtrIsInValid(trx_slot->start)) {
+        return 0;
+    }
+    UndoRecPtr cur = UndoRecPtrIsInValid(trx_slot->end) ? trx_slot->start : trx_slot->end;
+    UndoRecord head;
+    copy_from_slice(UndoRecPtrGetOffset(cur), (char *)&head, UndoRecHeadSize);
+    uint64 next = UndoRecPtrGetOffset(cur) + UndoRecTotalSize(head.m_payload);
+    char *record_cache = new char[MAX_UNDO_RECORD_CACHE_SIZE];
+    while (true) {
+        /* 逻辑偏移不会重复，环上残留的旧记录和块尾的 0 都接不上 m_pre；接得上的再用校验和确认记录完整 */
+        copy_from_slice(next, (char *)&head, UndoRecHeadSize);
+        if (head.m_pre != cur || !UndoRecordTypeIsValid(static_cast<UndoRecordType>(head.m_undoType)) ||
+            UndoRecTotalSize(head.m_payload) > MAX_UNDO_RECORD_CACHE_SIZE) {
+            break;
+        }
+        auto record = reinterpret_cast<UndoRecord *>(record_cache);
+        copy_from_slice(next, record_cache, UndoRecTotalSize(head.m_payload));
+        if (UndoRecChecksum(record) != record->m_checksum) {
+            break;
+        }
+        cur = AssembleUndoRecPtr(segid, next);
+        next += UndoRecTotalSize(head.m_payload);
+    }
+    delete[] record_cache;
+    trx_slot->end = cur;
+    return next;
+}
+
+uint32 UndoSegment::BGRecovery()
+{
+    uint32 rolledBack = 0;
+    if (seghead->recovery_start == 0) {
+        return rolledBack;
+    }
+    for (uint64 i = seghead->recovery_start - 1; i <= seghead->recovery_end; i++) {
         auto trx_slot = &seghead->trxslots[i % UNDO_TRX_SLOTS];
         uint32 tx_status = trx_slot->status;
 
@@ -137,9 +474,11 @@ void UndoSegment::BGRecovery()
             RollBack(trx_slot, undo_record_cache);
             trx_slot->status = TRX_ROLLBACKED;
             delete[] undo_record_cache;
+            rolledBack++;
         }
     }
     seghead->recovery_start = 0;
+    return rolledBack;
 }
 
 /* copy to read trx slot content AS undo recycle runs background. */
@@ -210,10 +549,10 @@ bool UndoSegment::trxslot_is_full()
            seghead->next_recycle_slot.load(std::memory_order_relaxed) + UNDO_TRX_SLOTS;
 }
 
-/* take undo record heap into consideration if you loop use it. */
+/* 环用掉一半后不再分配新事务，留出空间给正在进行的事务 */
 bool UndoSegment::SegmentFull()
 {
-    return trxslot_is_full();
+    return trxslot_is_full() || RingUsedSlices(UndoFreeBegin()) > UNDO_RING_SLICES / 2;
 }
 
 bool UndoSegment::SegmentEmpty()
@@ -230,48 +569,116 @@ uint64 UndoSegment::GetNextTrxSlot()
     return trx_slot_id;
 }
 
+uint32 UndoSegment::PhysicalPageno(uint64 vptr)
+{
+    uint64 sliceno = vptr / UNDO_SLICE_SIZE;
+    if (sliceno != 0) {
+        sliceno = 1 + (sliceno - 1) % UNDO_RING_SLICES;
+    }
+    return sliceno * (UNDO_SLICE_SIZE / NVM_BLCKSZ) + (vptr % UNDO_SLICE_SIZE) / NVM_BLCKSZ;
+}
+
+uint64 UndoSegment::RingUsedSlices(uint64 end)
+{
+    /* recycled_begin 由回收线程推进 */
+    uint64 begin = std::max(static_cast<uint64>(reinterpret_cast<volatile uint64 &>(seghead->recycled_begin)),
+                            static_cast<uint64>(UNDO_SLICE_SIZE));
+    if (end <= begin) {
+        return 0;
+    }
+    return (end - 1) / UNDO_SLICE_SIZE - begin / UNDO_SLICE_SIZE + 1;
+}
+
+/* 写到 end 为止会覆盖尚未回收的 slice 时，等回收线程推进 */
+bool UndoSegment::WaitRingSpace(uint64 end)
+{
+    while (RingUsedSlices(end) > UNDO_RING_SLICES) {
+        /* 最老的未回收事务就是本事务时不会再有可回收的空间，单个事务的 undo 不能超过整个环 */
+        if (seghead->next_recycle_slot.load(std::memory_order_acquire) + 1 >=
+            seghead->next_free_slot.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        RequestUndoRecycle();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
 UndoRecPtr UndoSegment::InsertUndoRecord(UndoRecord *record)
 {
-    int undo_size = UndoRecTotalSize(record->m_payload);
+    uint32 undo_size = UndoRecTotalSize(record->m_payload);
     Assert(undo_size <= MAX_UNDO_RECORD_CACHE_SIZE);
-    write_to_slice(seghead->free_begin, (char *)record, undo_size);
-    UndoRecPtr ptr = AssembleUndoRecPtr(segid, seghead->free_begin);
-
-    seghead->free_begin += undo_size;
+    uint64 free_begin = m_freeBegin.load(std::memory_order_relaxed);
+    if (!WaitRingSpace(free_begin + undo_size)) {
+        return InvalidUndoRecPtr;
+    }
+    UndoRecPtr ptr = AssembleUndoRecPtr(segid, free_begin);
+    /*
+     * 整条记录一次写入并落盘。恢复时只接受 m_pre 接得上且校验和一致的记录，没写完整的记录校验和对不上。
+     * 事务的第一条记录没有 m_pre，由之后写入的事务槽 start 引用。
+     */
+    record->m_checksum = UndoRecChecksum(record);
+    AppendToTail(free_begin, (char *)record, undo_size);
+    m_freeBegin.store(free_begin + undo_size, std::memory_order_relaxed);
     return ptr;
 }
 
-void UndoSegment::write_to_slice(uint64 vptr, char *src, int len)
+/* 从 NVM 读出追加位置所在块已写入的部分，块内其余字节为 0 */
+void UndoSegment::LoadTailChunk()
 {
-    int slice_remain = SLICE_LEN - (vptr % SLICE_LEN);
-    uint32 pageno = vptr / NVM_BLCKSZ;
-    uint32 offset = vptr % NVM_BLCKSZ;
-    if (slice_remain >= len) {
-        extend(pageno);
-        errno_t ret = memcpy_s(RelpointOfPageno(pageno) + offset, len, src, len);
-        if (ret != EOK) {
-            return;
-        }
-    } else {
+    uint64 free_begin = m_freeBegin.load(std::memory_order_relaxed);
+    uint32 used = free_begin % UNDO_CHUNK_SIZE;
+    errno_t ret = memset_s(m_tail, UNDO_CHUNK_SIZE, 0, UNDO_CHUNK_SIZE);
+    SecureRetCheck(ret);
+    if (used != 0) {
+        copy_from_slice(free_begin - used, m_tail, used);
+    }
+    m_tailLoaded = true;
+}
+
+/*
+ * 记录先拼进 DRAM 中的块副本，再把新写入的 cache line 整行写回 NVM，写满一块后换下一块。
+ * 返回之前写回完成，调用者随后才修改 heap，宕机时 heap 上的修改一定有对应的 undo。
+ */
+void UndoSegment::AppendToTail(uint64 vptr, const char *src, uint32 len)
+{
+    if (!m_tailLoaded) {
+        LoadTailChunk();
+    }
+    m_writeStat.m_records++;
+    m_writeStat.m_recordBytes += len;
+    while (len > 0) {
+        uint32 offset = vptr % UNDO_CHUNK_SIZE;
+        uint32 size = std::min(UNDO_CHUNK_SIZE - offset, len);
+        errno_t ret = memcpy_s(m_tail + offset, UNDO_CHUNK_SIZE - offset, src, size);
+        SecureRetCheck(ret);
+
+        uint64 chunk = vptr - offset;
+        uint32 pageno = PhysicalPageno(chunk);
         extend(pageno);
-        extend(pageno + 1);
-        errno_t ret = memcpy_s(RelpointOfPageno(pageno) + offset, slice_remain, src, slice_remain);
-        if (ret != EOK) {
-            return;
-        }
-        Assert((pageno + 1) % SLICE_BLOCKS == 0);
-        ret = memcpy_s(RelpointOfPageno(pageno + 1), len - slice_remain, src + slice_remain, len - slice_remain);
-        if (ret != EOK) {
-            return;
+        char *dst = RelpointOfPageno(pageno) + chunk % NVM_BLCKSZ;
+        uint32 line_begin = offset / UNDO_LINE_SIZE * UNDO_LINE_SIZE;
+        uint32 line_end = (offset + size + UNDO_LINE_SIZE - 1) / UNDO_LINE_SIZE * UNDO_LINE_SIZE;
+        pmem_memcpy_nodrain(dst + line_begin, m_tail + line_begin, line_end - line_begin);
+        m_writeStat.m_nvmBytes += line_end - line_begin;
+
+        vptr += size;
+        src += size;
+        len -= size;
+        if (vptr % UNDO_CHUNK_SIZE == 0) {
+            ret = memset_s(m_tail, UNDO_CHUNK_SIZE, 0, UNDO_CHUNK_SIZE);
+            SecureRetCheck(ret);
         }
     }
+    pmem_drain();
+    m_writeStat.m_drains++;
 }
 
-void UndoSegment::copy_from_slice(uint64 vptr, char *dst, int len)
+void UndoSegment::copy_from_slice(uint64 vptr, char *dst, uint32 len)
 {
     Assert(len < SLICE_LEN);
-    int remain_size = SLICE_LEN - (vptr % SLICE_LEN);
-    uint32 pageno = vptr / NVM_BLCKSZ;
+    uint32 remain_size = SLICE_LEN - (vptr % SLICE_LEN);
+    uint32 pageno = PhysicalPageno(vptr);
     uint32 offset = vptr % NVM_BLCKSZ;
 
     if (remain_size >= len) {
@@ -281,13 +688,14 @@ void UndoSegment::copy_from_slice(uint64 vptr, char *dst, int len)
             return;
         }
     } else {
-        extend(pageno + 1);
+        uint32 next_pageno = PhysicalPageno(vptr + remain_size);
+        Assert(next_pageno % SLICE_BLOCKS == 0);
+        extend(next_pageno);
         errno_t ret = memcpy_s(dst, remain_size, RelpointOfPageno(pageno) + offset, remain_size);
         if (ret != EOK) {
             return;
         }
-        Assert((pageno + 1) % SLICE_BLOCKS == 0);
-        ret = memcpy_s(dst + remain_size, len - remain_size, RelpointOfPageno(pageno + 1), len - remain_size);
+        ret = memcpy_s(dst + remain_size, len - remain_size, RelpointOfPageno(next_pageno), len - remain_size);
         if (ret != EOK) {
             return;
         }
@@ -308,10 +716,24 @@ UndoRecord *UndoSegment::CopyUndoRecord(UndoRecPtr undo, char *undo_record_cache
     return (UndoRecord *)undo_record_cache;
 }
 
+UndoRecord *UndoSegment::GetUndoRecord(UndoRecPtr undo, char *undo_record_cache)
+{
+    Assert(UndoRecPtrGetSegment(undo) == segid);
+    uint64 ptr = UndoRecPtrGetOffset(undo);
+    uint64 remain_size = SLICE_LEN - (ptr % SLICE_LEN);
+    if (likely(remain_size >= UndoRecHeadSize)) {
+        /* 一个 slice 在文件中是连续映射的，记录不跨 slice 就可以直接访问 */
+        auto *record = (UndoRecord *)(RelpointOfPageno(PhysicalPageno(ptr)) + (ptr % NVM_BLCKSZ));
+        if (likely(remain_size >= UndoRecTotalSize(record->m_payload))) {
+            return record;
+        }
+    }
+    return CopyUndoRecord(undo, undo_record_cache);
+}
+
+/* 只推进 recycled_begin，回收的 slice 留在环上等写入者复用 */
 void UndoSegment::RecycleUndoPages(const uint64 &begin_slot, const uint64 &end_slot)
 {
-    uint32 start_sliceno = seghead->recycled_begin / SLICE_LEN;
-    uint32 end_sliceno = 0;
     uint64 recycled_end = 0;
     TransactionSlot *trx_slot = nullptr;
 
@@ -324,15 +746,11 @@ void UndoSegment::RecycleUndoPages(const uint64 &begin_slot, const uint64 &end_s
         }
         Assert(trx_slot->end != 0);
         recycled_end = UndoRecPtrGetOffset(trx_slot->end);
-        end_sliceno = recycled_end / SLICE_LEN;
-    }
-    /* first slice kept as seg header. */
-    if (start_sliceno == 0) {
-        start_sliceno = 1;
     }
-    if (start_sliceno < end_sliceno) {
+    /* end 指向事务的最后一条 undo，只回收到它所在 slice 的起点 */
+    recycled_end = recycled_end / SLICE_LEN * SLICE_LEN;
+    if (recycled_end > seghead->recycled_begin) {
         seghead->recycled_begin = recycled_end;
-        LogicFile::punch(start_sliceno, end_sliceno);
     }
 }
 
@@ -340,7 +758,7 @@ void UndoSegment::RecycleUndoPages(const uint64 &begin_slot, const uint64 &end_s
  * Note that this function is invoked by another thread, so deal with shared variables carefully.
  * If you wanna change instruction order, you'd better check GetTransactionSlot.
  */
-void UndoSegment::RecycleTransactionSlot(uint64 min_snapshot)
+bool UndoSegment::RecycleTransactionSlot(uint64 min_snapshot)
 {
     uint64 next_slot = seghead->next_recycle_slot.load(std::memory_order_relaxed);
     uint64 begin_slot = next_slot;
@@ -392,80 +810,461 @@ void UndoSegment::RecycleTransactionSlot(uint64 min_snapshot)
 
         seghead->next_recycle_slot.store(next_slot, std::memory_order_release);
     }
+    return recycled;
+}
+
+void UndoSegment::AccumulateRecycleLag(uint64 now_us, UndoRecycleStat *stat)
+{
+    uint64 recycle_slot = seghead->next_recycle_slot.load(std::memory_order_acquire);
+    uint64 free_slot = seghead->next_free_slot.load(std::memory_order_relaxed);
+    if (recycle_slot == free_slot) {
+        return;
+    }
+    if (m_lagSlot != recycle_slot || m_lagSinceUs == 0) {
+        m_lagSlot = recycle_slot;
+        m_lagSinceUs = now_us;
+    }
+    uint64 free_begin = seghead->free_begin;
+    uint64 recycled_begin = seghead->recycled_begin;
+    uint64 lag_bytes = free_begin > recycled_begin ? free_begin - recycled_begin : 0;
+    stat->m_lagSlots += free_slot - recycle_slot;
+    stat->m_lagBytes += lag_bytes;
+    /* 最老的事务已提交却没回收，是被快照拖住的；还在执行的长事务作废快照也没用 */
+    if (seghead->trxslots[recycle_slot % UNDO_TRX_SLOTS].status == TRX_COMMITTED) {
+        stat->m_heldBytes += lag_bytes;
+    }
+    stat->m_oldestSlotAgeUs = std::max(stat->m_oldestSlotAgeUs, now_us - m_lagSinceUs);
+}
+
+static uint64 RecycleNowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* 领取 segment 回收，直到本轮所有 segment 都被领走 */
+static void RecycleSegments(uint64 minSnapshot, uint64 nowUs)
+{
+    UndoRecycleStat lag{};
+    bool progress = false;
+    while (true) {
+        uint32 segid = g_recycleNextSegment.fetch_add(1, std::memory_order_relaxed);
+        if (segid >= NVMDB_UNDO_SEGMENT_NUM) {
+            break;
+        }
+        UndoSegment *undoSegment = g_undo_segments[segid];
+        if (undoSegment == nullptr) {
+            continue;
+        }
+        if (undoSegment->RecycleTransactionSlot(minSnapshot)) {
+            progress = true;
+        }
+        undoSegment->AccumulateRecycleLag(nowUs, &lag);
+    }
+    if (progress) {
+        g_recyclePassProgress.store(true, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> guard(g_recycleMtx);
+    g_recyclePassStat.m_lagSlots += lag.m_lagSlots;
+    g_recyclePassStat.m_lagBytes += lag.m_lagBytes;
+    g_recyclePassStat.m_oldestSlotAgeUs = std::max(g_recyclePassStat.m_oldestSlotAgeUs, lag.m_oldestSlotAgeUs);
+    g_recyclePassStat.m_heldBytes += lag.m_heldBytes;
+}
+
+static void UndoRecycleHelper(uint32 id)
+{
+    pthread_setname_np(pthread_self(), "NVM UndoRecycle");
+    uint64 seenGen = 0;
+    while (true) {
+        uint64 minSnapshot;
+        uint64 nowUs;
+        {
+            std::unique_lock<std::mutex> lock(g_recycleMtx);
+            auto joined = [id, &seenGen] { return g_recyclePassGen != seenGen && id < g_recyclePassWorkers; };
+            g_recyclePassCv.wait(lock, [&joined] { return joined() || !g_doRecycle; });
+            /* 已经算进本轮的辅助线程即使在停止时也要做完，协调线程在等它 */
+            if (!joined()) {
+                return;
+            }
+            seenGen = g_recyclePassGen;
+            minSnapshot = g_recyclePassSnapshot;
+            nowUs = g_recyclePassNowUs;
+        }
+        RecycleSegments(minSnapshot, nowUs);
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        if (--g_recyclePassPending == 0) {
+            g_recycleCv.notify_all();
+        }
+    }
+}
+
+/* 一轮回收，返回是否有 segment 向前推进 */
+static bool RunRecyclePass(uint64 minSnapshot, uint32 workers)
+{
+    uint64 nowUs = RecycleNowUs();
+    g_recycleNextSegment.store(0, std::memory_order_relaxed);
+    g_recyclePassProgress.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        g_recyclePassStat = UndoRecycleStat{};
+        g_recyclePassSnapshot = minSnapshot;
+        g_recyclePassNowUs = nowUs;
+        g_recyclePassWorkers = workers;
+        g_recyclePassPending = workers - 1;
+        g_recyclePassGen++;
+    }
+    if (workers > 1) {
+        g_recyclePassCv.notify_all();
+    }
+    RecycleSegments(minSnapshot, nowUs);
+
+    std::unique_lock<std::mutex> lock(g_recycleMtx);
+    g_recycleCv.wait(lock, [] { return g_recyclePassPending == 0; });
+    UndoRecycleStat &stat = g_recycleStat;
+    stat.m_workers = workers;
+    stat.m_peakWorkers = std::max(stat.m_peakWorkers, workers);
+    stat.m_passes++;
+    stat.m_lagSlots = g_recyclePassStat.m_lagSlots;
+    stat.m_lagBytes = g_recyclePassStat.m_lagBytes;
+    stat.m_oldestSlotAgeUs = g_recyclePassStat.m_oldestSlotAgeUs;
+    stat.m_heldBytes = g_recyclePassStat.m_heldBytes;
+    return g_recyclePassProgress.load(std::memory_order_relaxed);
+}
+
+/*
+ * 按保留上限作废快照，作废的快照不再计入最小快照。按字节数每轮最多作废一个最老的快照，
+ * 下一轮回收之后统计刷新了再决定要不要继续。
+ */
+static void EnforceUndoRetention(uint64 *checkedPasses)
+{
+    uint64 maxAgeMs = g_retentionAgeMs.load(std::memory_order_relaxed);
+    uint64 maxBytes = g_retentionBytes.load(std::memory_order_relaxed);
+    bool expireOldest = false;
+    {
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        if (maxBytes != 0 && g_recycleStat.m_passes != *checkedPasses && g_recycleStat.m_heldBytes > maxBytes) {
+            expireOldest = true;
+        }
+        *checkedPasses = g_recycleStat.m_passes;
+    }
+    if (maxAgeMs == 0 && !expireOldest) {
+        return;
+    }
+    uint32 expired = ExpireSnapshots(maxAgeMs * 1000, expireOldest);
+    if (expired != 0) {
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        g_recycleStat.m_expiredSnapshots += expired;
+    }
 }
 
 void UndoRecycle()
 {
     pthread_setname_np(pthread_self(), "NVM UndoRecycle");
+    std::vector<std::thread> helpers;
     uint64 minSnapshot = MIN_TRX_CSN;
-    uint64 tmpSnapshot = 0;
+    uint32 sleepUs = RECYCLE_MIN_SLEEP_US;
+    uint32 workers = 1;
+    uint64 checkedPasses = 0;
     while (g_doRecycle) {
-        tmpSnapshot = GetMinSnapshot();
+        EnforceUndoRetention(&checkedPasses);
+        uint64 tmpSnapshot = GetMinSnapshot();
         Assert(tmpSnapshot != 0);
-        if (tmpSnapshot > minSnapshot) {
-            minSnapshot = tmpSnapshot;
-        } else {
-            continue;
+        bool requested;
+        {
+            std::lock_guard<std::mutex> guard(g_recycleMtx);
+            requested = g_recycleRequested;
+            g_recycleRequested = false;
         }
-        for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
-            UndoSegment *undoSegment = g_undo_segments[i];
-            /* necessary to recycle full undo segment. */
-            if (!g_undo_segment_allocated[i] && !undoSegment->SegmentFull()) {
+        /* 退避到最长时也做一轮，快照被长事务卡住时滞后统计仍会刷新 */
+        if (tmpSnapshot > minSnapshot || requested || sleepUs == RECYCLE_MAX_SLEEP_US) {
+            minSnapshot = std::max(minSnapshot, tmpSnapshot);
+            while (helpers.size() + 1 < workers) {
+                helpers.emplace_back(UndoRecycleHelper, static_cast<uint32>(helpers.size() + 1));
+            }
+            bool progress = RunRecyclePass(minSnapshot, workers);
+
+            UndoRecycleStat stat;
+            GetUndoRecycleStat(&stat);
+            workers = static_cast<uint32>(std::min(static_cast<uint64>(NVMDB_UNDO_RECYCLE_WORKER_NUM),
+                                                   1 + stat.m_lagSlots / NVMDB_UNDO_RECYCLE_BACKLOG_PER_WORKER));
+            if (progress) {
+                sleepUs = RECYCLE_MIN_SLEEP_US;
                 continue;
             }
-            undoSegment->RecycleTransactionSlot(minSnapshot);
+        }
+        /* 快照没有前进或者一轮下来没有可回收的，退避睡眠 */
+        std::unique_lock<std::mutex> lock(g_recycleMtx);
+        g_recycleCv.wait_for(lock, std::chrono::microseconds(sleepUs),
+                             [] { return !g_doRecycle || g_recycleRequested; });
+        sleepUs = std::min(sleepUs * 2, RECYCLE_MAX_SLEEP_US);
+    }
+    {
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        g_recyclePassCv.notify_all();
+    }
+    for (auto &helper : helpers) {
+        helper.join();
+    }
+}
+
+void GetUndoWriteStat(UndoWriteStat *stat)
+{
+    *stat = UndoWriteStat{};
+    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
+        UndoSegment *segment = g_undo_segments[i];
+        if (segment != nullptr) {
+            segment->AccumulateWriteStat(stat);
         }
     }
 }
 
+void GetUndoRecycleStat(UndoRecycleStat *stat)
+{
+    std::lock_guard<std::mutex> guard(g_recycleMtx);
+    *stat = g_recycleStat;
+}
+
+void SetUndoRetention(uint64 max_age_ms, uint64 max_bytes)
+{
+    g_retentionAgeMs.store(max_age_ms, std::memory_order_relaxed);
+    g_retentionBytes.store(max_bytes, std::memory_order_relaxed);
+}
+
+static void PushFreeSegment(uint32 segid)
+{
+    std::atomic<uint64> &head = g_freeSegmentHead[segid % g_dirPathNum];
+    uint64 oldHead = head.load(std::memory_order_relaxed);
+    uint64 newHead;
+    do {
+        g_freeSegmentNext[segid].store(static_cast<uint32>(oldHead), std::memory_order_relaxed);
+        newHead = (((oldHead >> BIS_PER_U32) + 1) << BIS_PER_U32) | (segid + 1);
+    } while (!head.compare_exchange_weak(oldHead, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static uint32 PopFreeSegment(uint32 group)
+{
+    std::atomic<uint64> &head = g_freeSegmentHead[group];
+    uint64 oldHead = head.load(std::memory_order_acquire);
+    while (static_cast<uint32>(oldHead) != 0) {
+        uint32 segid = static_cast<uint32>(oldHead) - 1;
+        uint64 next = g_freeSegmentNext[segid].load(std::memory_order_relaxed);
+        uint64 newHead = (((oldHead >> BIS_PER_U32) + 1) << BIS_PER_U32) | next;
+        if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire)) {
+            return segid;
+        }
+    }
+    return InvalidSegmentId;
+}
+
+/* list 是 AcquireUndoSegment 中暂存的已满 segment，逐个放回空闲栈 */
+static void ReleaseFullSegments(uint32 list)
+{
+    while (list != 0) {
+        uint32 segid = list - 1;
+        list = g_freeSegmentNext[segid].load(std::memory_order_relaxed);
+        PushFreeSegment(segid);
+    }
+}
+
+static bool UndoSegmentIsCreated(uint32 segid)
+{
+    return (g_undoMetaData->m_created[segid / BIS_PER_U64] & (1LLU << (segid % BIS_PER_U64))) != 0;
+}
+
+/* 调用者需持有 g_undoSegmentLock；先持久化 segment 头再置位，宕机后位图中的 segment 一定完整 */
+static UndoSegment *CreateUndoSegment(uint32 segid)
+{
+    Assert(g_undo_segments[segid] == nullptr && !UndoSegmentIsCreated(segid));
+    UndoSegment *segment = new UndoSegment(g_dirPaths[segid % g_dirPathNum].c_str(), segid);
+    segment->Create();
+    pmem_persist(segment->RelpointOfPageno(0), sizeof(UndoSegmentHead));
+
+    uint64 *word = &g_undoMetaData->m_created[segid / BIS_PER_U64];
+    *word |= 1LLU << (segid % BIS_PER_U64);
+    pmem_persist(word, sizeof(uint64));
+    g_undo_segments[segid] = segment;
+    return segment;
+}
+
+static void UndoMetaMount(bool create)
+{
+    g_undoMeta = new LogicFile(g_dirPaths[0].c_str(), g_undoMetaFilename, NVM_BLCKSZ, 1);
+    static_assert(sizeof(UndoMetaData) <= NVM_BLCKSZ, "undo meta exceeds one block");
+    if (create) {
+        g_undoMeta->Create();
+    } else {
+        g_undoMeta->Mount();
+    }
+    g_undoMetaData = reinterpret_cast<UndoMetaData *>(g_undoMeta->RelpointOfPageno(0));
+    if (create) {
+        errno_t ret = memset_s(g_undoMetaData, sizeof(UndoMetaData), 0, sizeof(UndoMetaData));
+        SecureRetCheck(ret);
+        g_undoMetaData->m_magic = UNDO_META_MAGIC;
+        pmem_persist(g_undoMetaData, sizeof(UndoMetaData));
+    }
+    ALWAYS_CHECK(g_undoMetaData->m_magic == UNDO_META_MAGIC);
+}
+
 void UndoSegmentCreate(const char *dir)
 {
+    UndoMetaMount(true);
     for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
-        g_undo_segments[i] = new UndoSegment(g_dirPaths[i % g_dirPathNum].c_str(), i);
-        g_undo_segments[i]->Create();
-        g_undo_segment_allocated[i] = false;
+        g_undo_segments[i] = nullptr;
+    }
+    for (int i = 0; i < NVMDB_MAX_GROUP; i++) {
+        g_freeSegmentHead[i] = 0;
     }
+    StartUndoRecycle();
     g_undoRecycle = std::thread(UndoRecycle);
 }
 
-void UndoBGRecovery()
+/* 各 segment 的未完成事务互不相关，worker 每次领取下一个 segment 回滚 */
+static void UndoRecoveryWorker()
 {
+    pthread_setname_np(pthread_self(), "NVM UndoRecover");
     InitThreadLocalVariables();
-    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
-        auto segment = g_undo_segments[i];
-        segment->BGRecovery();
+    while (true) {
+        uint32 segid = g_recoveryNextSegment.fetch_add(1, std::memory_order_relaxed);
+        if (segid >= NVMDB_UNDO_SEGMENT_NUM) {
+            break;
+        }
+        UndoSegment *segment = g_undo_segments[segid];
+        uint32 rolledBack = segment == nullptr ? 0 : segment->BGRecovery();
+        g_recoveryRolledBackTrxs.fetch_add(rolledBack, std::memory_order_relaxed);
+        g_recoveryDoneSegments.fetch_add(1, std::memory_order_relaxed);
     }
     DestroyThreadLocalVariables();
+}
+
+void UndoBGRecovery()
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (uint32 i = 0; i < g_recoveryWorkers; i++) {
+        workers.emplace_back(UndoRecoveryWorker);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    g_recoveryElapsedUs.store(elapsed.count(), std::memory_order_relaxed);
+    g_recoveryFinished.store(true, std::memory_order_release);
+    /* 恢复完成后才能开始回收 undo */
     UndoRecycle();
 }
 
+void SetUndoRecoveryWorkers(uint32 workers)
+{
+    g_recoveryWorkers = std::max(1U, std::min(workers, static_cast<uint32>(NVMDB_UNDO_SEGMENT_NUM)));
+}
+
+void SetUndoRollbackWorkers(uint32 workers)
+{
+    workers = workers == 0 ? DefaultUndoRollbackWorkers() : std::min(workers, NVMDB_MAX_THREAD_NUM);
+    g_rollbackWorkers.store(workers, std::memory_order_relaxed);
+}
+
+void GetUndoRecoveryProgress(UndoRecoveryProgress *progress)
+{
+    /* 先读完成标志，看到完成时后面读到的计数一定是最终值 */
+    progress->m_finished = g_recoveryFinished.load(std::memory_order_acquire);
+    progress->m_workers = g_recoveryWorkers;
+    progress->m_totalSegments = NVMDB_UNDO_SEGMENT_NUM;
+    progress->m_doneSegments = std::min(g_recoveryDoneSegments.load(std::memory_order_relaxed),
+                                        static_cast<uint32>(NVMDB_UNDO_SEGMENT_NUM));
+    progress->m_pendingTrxs = g_recoveryPendingTrxs.load(std::memory_order_relaxed);
+    progress->m_rolledBackTrxs = g_recoveryRolledBackTrxs.load(std::memory_order_relaxed);
+    progress->m_elapsedUs = g_recoveryElapsedUs.load(std::memory_order_relaxed);
+}
+
+/* 各 segment 的挂载和扫描互不相关，worker 每次领取下一个 segment，最后汇总最大的 CSN */
+static void UndoMountWorker(std::atomic<uint32> *nextSegment, std::atomic<uint64> *maxUndoCsn)
+{
+    pthread_setname_np(pthread_self(), "NVM UndoMount");
+    uint64 localMaxCsn = MIN_TRX_CSN;
+    while (true) {
+        uint32 segid = nextSegment->fetch_add(1, std::memory_order_relaxed);
+        if (segid >= NVMDB_UNDO_SEGMENT_NUM) {
+            break;
+        }
+        if (!UndoSegmentIsCreated(segid)) {
+            g_undo_segments[segid] = nullptr;
+            continue;
+        }
+        UndoSegment *segment = new UndoSegment(g_dirPaths[segid % g_dirPathNum].c_str(), segid);
+        segment->Mount();
+        segment->Recovery(localMaxCsn);
+        g_undo_segments[segid] = segment;
+    }
+    uint64 maxCsn = maxUndoCsn->load(std::memory_order_relaxed);
+    while (maxCsn < localMaxCsn && !maxUndoCsn->compare_exchange_weak(maxCsn, localMaxCsn)) {
+    }
+}
+
 /* must be invoked after undo tablespace is mounted */
 void UndoSegmentMount(const char *dir)
 {
-    uint64 max_undo_csn = MIN_TRX_CSN;
-    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
-        g_undo_segments[i] = new UndoSegment(g_dirPaths[i % g_dirPathNum].c_str(), i);
-        g_undo_segments[i]->Mount();
-        g_undo_segment_allocated[i] = false;
-        g_undo_segments[i]->Recovery(max_undo_csn);
+    g_recoveryNextSegment = 0;
+    g_recoveryDoneSegments = 0;
+    g_recoveryPendingTrxs = 0;
+    g_recoveryRolledBackTrxs = 0;
+    g_recoveryElapsedUs = 0;
+    g_recoveryFinished = false;
+
+    UndoMetaMount(false);
+    std::atomic<uint32> nextSegment{0};
+    std::atomic<uint64> maxUndoCsn{MIN_TRX_CSN};
+    std::vector<std::thread> workers;
+    for (uint32 i = 0; i < NVMDB_UNDO_MOUNT_WORKER_NUM; i++) {
+        workers.emplace_back(UndoMountWorker, &nextSegment, &maxUndoCsn);
     }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    RecoveryCSN(maxUndoCsn.load(std::memory_order_relaxed));
 
-    RecoveryCSN(max_undo_csn);
+    /* 倒序放入，编号小的在栈顶先被使用 */
+    for (int i = 0; i < NVMDB_MAX_GROUP; i++) {
+        g_freeSegmentHead[i] = 0;
+    }
+    for (int segid = NVMDB_UNDO_SEGMENT_NUM - 1; segid >= 0; segid--) {
+        if (g_undo_segments[segid] != nullptr) {
+            PushFreeSegment(segid);
+        }
+    }
+}
+
+void UndoSegmentStartRecovery()
+{
     // the recycle thread will do the recovery first
+    StartUndoRecycle();
     g_undoRecycle = std::thread(UndoBGRecovery);
 }
 
 void UndoSegmentUnmount()
 {
-    g_doRecycle = false;
+    {
+        std::lock_guard<std::mutex> guard(g_recycleMtx);
+        g_doRecycle = false;
+        g_recycleCv.notify_all();
+    }
     g_undoRecycle.join();
+    /* 恢复线程已经结束，不会再有并行回滚 */
+    StopUndoRollbackPool();
+    /* 各线程缓存的事务状态随之作废 */
+    g_undoMountEpoch.fetch_add(1, std::memory_order_relaxed);
+    /* 仍绑定在未结束事务上的 segment 一并卸载，相当于宕机 */
     for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
-        Assert(!g_undo_segment_allocated[i]);
-        g_undo_segments[i]->UnMount();
-        delete g_undo_segments[i];
-        g_undo_segments[i] = NULL;
+        UndoSegment *segment = g_undo_segments[i].exchange(nullptr);
+        if (segment != nullptr) {
+            segment->UnMount();
+            delete segment;
+        }
     }
-    clock_sweep = 0;
+    g_undoMeta->UnMount();
+    delete g_undoMeta;
+    g_undoMeta = nullptr;
+    g_undoMetaData = nullptr;
 }
 
 UndoSegment *GetUndoSegment(int segid)
@@ -473,55 +1272,61 @@ UndoSegment *GetUndoSegment(int segid)
     return g_undo_segments[segid];
 }
 
-void InitLocalUndoSegment()
+/* 为 group 对应的目录创建一个新的 segment，都已创建时返回 InvalidSegmentId */
+static uint32 CreateGroupUndoSegment(uint32 group)
 {
-    if (t_undo_segment == NULL) {
-        g_undoSegmentLock.lock();
-        while (true) {
-            clock_sweep++;
-            my_clock = clock_sweep % NVMDB_UNDO_SEGMENT_NUM;
-            if (g_undo_segment_allocated[my_clock]) {
-                continue;
-            }
-            t_undo_segment = g_undo_segments[my_clock];
-            Assert(g_dirPathNum == g_dirPaths.size());
-            if (t_undo_segment->MyId() % g_dirPathNum != GetCurrentGroupId() % g_dirPathNum) {
-                continue;
-            }
-            if (t_undo_segment->SegmentFull()) {
-                continue;
-            }
-            g_undo_segment_allocated[my_clock] = true;
-            break;
+    std::lock_guard<std::mutex> guard(g_undoSegmentLock);
+    for (uint32 segid = group; segid < NVMDB_UNDO_SEGMENT_NUM; segid += g_dirPathNum) {
+        if (g_undo_segments[segid] == nullptr) {
+            CreateUndoSegment(segid);
+            return segid;
         }
-        g_undoSegmentLock.unlock();
     }
+    return InvalidSegmentId;
 }
 
-void DestroyLocalUndoSegment()
+UndoSegment *AcquireUndoSegment()
 {
-    if (t_undo_segment != NULL) {
-        /* todo: undo_segment can be reused by other threads */
-        t_undo_segment = NULL;
-        g_undo_segment_allocated[my_clock] = false;
+    Assert(g_dirPathNum == g_dirPaths.size() && g_dirPathNum <= NVMDB_MAX_GROUP);
+    uint32 group = GetCurrentGroupId() % g_dirPathNum;
+    /* 取出来的已满 segment 先用 next 串起来，拿到可用的之后再放回 */
+    uint32 full = 0;
+    UndoSegment *segment = nullptr;
+    while (segment == nullptr) {
+        uint32 segid = PopFreeSegment(group);
+        if (segid == InvalidSegmentId) {
+            /* 优先复用已创建的 segment，都在使用或已满时才创建新的 */
+            segid = CreateGroupUndoSegment(group);
+        }
+        if (segid == InvalidSegmentId) {
+            ReleaseFullSegments(full);
+            full = 0;
+            RequestUndoRecycle();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        UndoSegment *candidate = g_undo_segments[segid];
+        if (candidate->SegmentFull()) {
+            RequestUndoRecycle();
+            g_freeSegmentNext[segid].store(full, std::memory_order_relaxed);
+            full = segid + 1;
+            continue;
+        }
+        segment = candidate;
     }
+    ReleaseFullSegments(full);
+    return segment;
 }
 
-UndoSegment *PickSegmentForTrx()
+void ReleaseUndoSegment(UndoSegment *segment)
 {
-    Assert(t_undo_segment != NULL);
-    return t_undo_segment;
+    PushFreeSegment(segment->MyId());
 }
 
-void SwitchUndoSegmentIfFull()
+static inline uint32 TrxInfoCacheIndex(TransactionSlotPtr trx_ptr)
 {
-    Assert(t_undo_segment != NULL);
-    if (!t_undo_segment->SegmentFull()) {
-        return;
-    }
-    DestroyLocalUndoSegment();
-    InitLocalUndoSegment();
-    Assert(!t_undo_segment->SegmentFull());
+    return (TrxSlotPtrGetTrxId(trx_ptr) ^ (TrxSlotPtrGetSegmentId(trx_ptr) * TRX_INFO_CACHE_SEG_STRIDE)) %
+           TRX_INFO_CACHE_SIZE;
 }
 
 bool GetTransactionInfo(TransactionSlotPtr trx_ptr, TransactionInfo *trx_info)
@@ -529,8 +1334,35 @@ bool GetTransactionInfo(TransactionSlotPtr trx_ptr, TransactionInfo *trx_info)
     uint32 segid = TrxSlotPtrGetSegmentId(trx_ptr);
     Assert(segid < NVMDB_UNDO_SEGMENT_NUM);
     UndoSegment *undo_segment = g_undo_segments[segid];
-    uint32 slotid = TrxSlotPtrGetTrxId(trx_ptr);
-    return undo_segment->GetTransactionInfo(slotid, trx_info);
+    uint64 slotid = TrxSlotPtrGetTrxId(trx_ptr);
+    uint32 epoch = g_undoMountEpoch.load(std::memory_order_relaxed);
+    TrxInfoCacheEntry &entry = t_trxInfoCache[TrxInfoCacheIndex(trx_ptr)];
+    if (entry.m_trxPtr == trx_ptr && entry.m_epoch == epoch) {
+        if (undo_segment->TrxSlotRecycled(slotid)) {
+            entry.m_epoch = 0;
+            return false;
+        }
+        trx_info->CSN = entry.m_csn;
+        trx_info->status = entry.m_status;
+        t_trxInfoCacheStat.m_hits++;
+        return true;
+    }
+    t_trxInfoCacheStat.m_misses++;
+    if (!undo_segment->GetTransactionInfo(slotid, trx_info)) {
+        return false;
+    }
+    if (trx_info->status == TRX_COMMITTED || trx_info->status == TRX_ROLLBACKED) {
+        entry.m_trxPtr = trx_ptr;
+        entry.m_csn = trx_info->CSN;
+        entry.m_status = trx_info->status;
+        entry.m_epoch = epoch;
+    }
+    return true;
+}
+
+void GetTrxInfoCacheStat(TrxInfoCacheStat *stat)
+{
+    *stat = t_trxInfoCacheStat;
 }
 
 }  // namespace NVMDB
\ No newline at end of file
@@ -36,6 +36,7 @@ enum HAM_STATUS {
     HAM_UPDATE_CONFLICT,         // another transaction are updating this version
     HAM_ROW_DELETED,             // the row is deleted
     HAM_TRANSACTION_WAIT_ABORT,  // an error happens so the transaction has to be aborted
+    HAM_SNAPSHOT_TOO_OLD,        // the undo needed by the snapshot exceeds the retention limit
 };
 
 RowId HeapUpperRowId(Table *table);
@@ -48,6 +49,12 @@ HAM_STATUS HeapUpdate(Transaction *trx, Table *table, RowId rowid, RAMTuple *new
 
 HAM_STATUS HeapDelete(Transaction *trx, Table *table, RowId rowid);
 
+/*
+ * 把所有 tuple 都已失效（未使用，或删除已提交且对所有快照可见）的 leaf page 归还给 tablespace，
+ * 返回归还的页数。调用者需独占该表（如 VACUUM FULL）。
+ */
+uint32 HeapShrink(Table *table);
+
 }  // namespace NVMDB
 
 #endif  // NVMDB_HEAP_ACCESS_H
\ No newline at end of file
@@ -29,9 +29,14 @@
 
 namespace NVMDB {
 
+/*
+ * 按 64 位一个 unit 组织，unit 再按 CHUNK_UNITS 个一组分配：位图按表的最大容量设定大小，
+ * 实际只为用到的部分分配内存，小表只占一个 chunk。
+ */
 class GlobalBitMap {
 public:
     constexpr static uint32 BITMAP_UNIT_SIZE = 64;
+    constexpr static uint32 CHUNK_UNITS = 1024;
 
     GlobalBitMap(size_t _size);
 
@@ -41,13 +46,18 @@ public:
 
     void SyncRelease(uint32 bit);
 
+    /* 直接占用指定的 bit，用于重启后标记已经用满的 range */
+    void SyncSet(uint32 bit);
+
     inline uint32 get_highest_bit() const
     {
         Assert(m_highestBit >= 0 && m_highestBit < m_size);
         return m_highestBit;
     }
 private:
-    uint64 *m_map{nullptr};
+    std::atomic<uint64 *> *m_chunks{nullptr};
+    size_t m_chunkNum{0};
+    size_t m_unitNum{0};
     size_t m_size{0};
     std::atomic<uint32> m_startHint{};
     std::atomic<uint32> m_highestBit{};
@@ -64,6 +74,9 @@ private:
         return bit % BITMAP_UNIT_SIZE;
     }
 
+    /* 第 aryoff 个 unit，所在 chunk 第一次用到时分配 */
+    uint64 *GetUnit(uint32 aryoff);
+
     uint32 FFZAndSet(uint64 *data);
 
     void UpdateHint(uint32 arroff, uint32 bit);
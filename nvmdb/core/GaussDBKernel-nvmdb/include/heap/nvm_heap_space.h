@@ -32,6 +32,12 @@ void HeapBootStrap(const char *dir);
 
 void HeapExitProcess();
 
+/* 后台回收整个 segment；调用者保证事务已结束且之后不再访问该 segment。回收队列满时等待空出槽位 */
+void HeapFreeSegmentAsync(uint32 seghead);
+
+/* 逻辑删除表：删除表目录项并把 segment 交给后台回收，O(1) */
+void HeapDropTable(uint32 oid);
+
 extern TableSpace *g_heapSpace;
 
 }  // namespace NVMDB
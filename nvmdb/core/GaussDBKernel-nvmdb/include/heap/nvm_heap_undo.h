@@ -25,6 +25,7 @@
 #include "nvm_types.h"
 #include "nvm_undo_ptr.h"
 #include "nvm_transaction.h"
+#include "nvm_undo_rollback.h"
 
 namespace NVMDB {
 
@@ -35,14 +36,28 @@ UndoRecPtr PrepareUpdateUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMT
 
 UndoRecPtr PrepareDeleteUndo(Transaction *trx, uint32 seghead, RowId rowid, NVMTuple *old_tuple);
 
-void UndoInsert(UndoRecord *undo);
+struct TruncateUndoData {
+    uint32 m_oid;
+    uint32 m_oldSeg;
+    uint32 m_newSeg;
+};
 
-void UndoUpdate(UndoRecord *undo);
+UndoRecPtr PrepareTruncateUndo(Transaction *trx, uint32 oid, uint32 old_seg, uint32 new_seg);
 
-void UndoDelete(UndoRecord *undo);
+void UndoInsert(UndoRecord *undo, UndoReplayContext *context);
+
+void UndoUpdate(UndoRecord *undo, UndoReplayContext *context);
+
+void UndoDelete(UndoRecord *undo, UndoReplayContext *context);
+
+void UndoTruncate(UndoRecord *undo, UndoReplayContext *context);
+
+uint64 HeapUndoLane(UndoRecord *undo);
 
 void UndoUpdate(UndoRecord *undo, RAMTuple *tuple);
 
+void UndoDelete(UndoRecord *undo, RAMTuple *tuple);
+
 }  // namespace NVMDB
 
 #endif  // NVMDB_HEAP_UNDO_H
\ No newline at end of file
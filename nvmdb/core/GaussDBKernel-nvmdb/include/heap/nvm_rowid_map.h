@@ -33,27 +33,102 @@
 
 namespace NVMDB {
 
-/* flag1 */
-#define ROWID_LOCKED 0x01000000
-#define ROWID_VALID 0x02000000
+/* RowIdMapPage::m_rowFlags */
+#define ROWID_LOCKED 0x01
+#define ROWID_CACHED 0x02
 
-constexpr int SEGMENT_CAP = 16;
+/*
+ * 一个 leaf page 在 DRAM 中的描述。tuple 的 NVM 地址和 DRAM 缓存地址都由页内下标算出，
+ * 每行只保留一个字节的标志（行锁、是否已缓存）。
+ */
+struct RowIdMapPage {
+    char *m_nvmPage;                 /* leaf page 中第一个 tuple 的地址 */
+    std::atomic<char *> m_dramPage;  /* 整页的 DRAM 缓存，第一次缓存该页的 tuple 时分配 */
+    uint32 m_tupleLen;
+    uint32 m_tupleNum;
+    volatile uint8 *m_rowFlags;
+
+    RowIdMapPage(char *nvmPage, uint32 tupleLen, uint32 tupleNum)
+        : m_nvmPage(nvmPage), m_dramPage(nullptr), m_tupleLen(tupleLen), m_tupleNum(tupleNum)
+    {
+        m_rowFlags = new uint8[m_tupleNum]();
+    }
+
+    ~RowIdMapPage()
+    {
+        delete[] m_rowFlags;
+        delete[] m_dramPage.load();
+    }
+
+    char *GetDramPage()
+    {
+        char *dramPage = m_dramPage.load(std::memory_order_acquire);
+        if (dramPage == nullptr) {
+            /* 只分配不初始化，未缓存的 tuple 不会被访问，物理内存按实际缓存的部分占用 */
+            char *newPage = new char[static_cast<size_t>(m_tupleLen) * m_tupleNum];
+            if (m_dramPage.compare_exchange_strong(dramPage, newPage)) {
+                dramPage = newPage;
+            } else {
+                delete[] newPage;
+            }
+        }
+        return dramPage;
+    }
+
+    size_t MetaSize() const
+    {
+        return sizeof(RowIdMapPage) + m_tupleNum * sizeof(uint8);
+    }
+};
+
+/* 一行在 RowIdMap 中的句柄，按值传递；无效句柄表示对应的 leaf page 不存在 */
+class RowIdMapEntry {
+    RowIdMapPage *m_page{nullptr};
+    uint32 m_slot{0};
+
+    volatile uint8 &Flag() const
+    {
+        return m_page->m_rowFlags[m_slot];
+    }
+
+    char *DramAddr() const
+    {
+        return m_page->GetDramPage() + static_cast<size_t>(m_slot) * m_page->m_tupleLen;
+    }
+
+public:
+    RowIdMapEntry() = default;
+
+    RowIdMapEntry(RowIdMapPage *page, uint32 slot) : m_page(page), m_slot(slot)
+    {
+        Assert(m_slot < m_page->m_tupleNum);
+    }
 
-struct RowIdMapEntry {
-    char *m_nvmAddr;
-    char *m_dramCache;
-    volatile uint32 m_flag1;
-    volatile uint32 m_flag2;
+    bool IsValid() const
+    {
+        return m_page != nullptr;
+    }
+
+    char *NvmAddr() const
+    {
+        return m_page->m_nvmPage + static_cast<size_t>(m_slot) * m_page->m_tupleLen;
+    }
+
+    /* 持有行锁时调用，没有缓存返回 NULL */
+    char *DramCache() const
+    {
+        return (Flag() & ROWID_CACHED) ? DramAddr() : nullptr;
+    }
 
     void Lock()
     {
         do {
-            uint32 old_flag = m_flag1;
+            uint8 old_flag = Flag();
             if (old_flag & ROWID_LOCKED) {
                 continue;
             }
-            uint32 new_flag = old_flag | ROWID_LOCKED;
-            if (__sync_bool_compare_and_swap(&m_flag1, old_flag, new_flag)) {
+            uint8 new_flag = old_flag | ROWID_LOCKED;
+            if (__sync_bool_compare_and_swap(&Flag(), old_flag, new_flag)) {
                 return;
             }
         } while (true);
@@ -61,99 +136,68 @@ struct RowIdMapEntry {
 
     void Unlock()
     {
-        uint32 old_flag = m_flag1;
+        uint8 old_flag = Flag();
         Assert(old_flag & ROWID_LOCKED);
-        uint32 new_flag = old_flag & ~ROWID_LOCKED;
+        uint8 new_flag = old_flag & ~ROWID_LOCKED;
         std::atomic_thread_fence(std::memory_order_acq_rel);
-        m_flag1 = new_flag;
-    }
-
-    bool IsValid() const
-    {
-        return m_flag1 & ROWID_VALID;
+        Flag() = new_flag;
     }
 
-    void SetValid()
+    void sync_dram_cache(uint32 tuple_size)
     {
-        m_flag1 |= ROWID_VALID;
-    }
-
-    void sync_dram_cache(int tuple_size)
-    {
-        Assert(tuple_size <= MAX_TUPLE_LEN);
-        if (m_dramCache == nullptr) {
-            m_dramCache = new char[tuple_size];
-        }
-        errno_t ret = memcpy_s(m_dramCache, tuple_size, m_nvmAddr, tuple_size);
+        Assert(tuple_size <= m_page->m_tupleLen);
+        errno_t ret = memcpy_s(DramAddr(), tuple_size, NvmAddr(), tuple_size);
         SecureRetCheck(ret);
+        Flag() |= ROWID_CACHED;
     }
 
     void sync_dram_cache_deleted()
     {
-        if (m_dramCache != nullptr) {
-            errno_t ret = memcpy_s(m_dramCache, NVMTupleHeadSize, m_nvmAddr, NVMTupleHeadSize);
+        char *dramCache = DramCache();
+        if (dramCache != nullptr) {
+            errno_t ret = memcpy_s(dramCache, NVMTupleHeadSize, NvmAddr(), NVMTupleHeadSize);
             SecureRetCheck(ret);
         }
     }
 
-    char *read_dram_cache(int tuple_size)
+    char *read_dram_cache(uint32 tuple_size)
     {
-        if (m_dramCache == nullptr) {
-            Assert(tuple_size <= MAX_TUPLE_LEN);
-            m_dramCache = new char[tuple_size];
-            errno_t ret = memcpy_s(m_dramCache, tuple_size, m_nvmAddr, tuple_size);
-            SecureRetCheck(ret);
+        if (!(Flag() & ROWID_CACHED)) {
+            sync_dram_cache(tuple_size);
         }
-        return m_dramCache;
+        return DramAddr();
     }
 };
 
+/*
+ * 页面描述放在一个两级的目录中：第一级在构造时按表的最大 leaf page 数一次分配好，第二级 segment 按需用 CAS 装入，
+ * 装入后不再移动，查找时不需要加锁或重试。
+ */
 class RowIdMap {
-    static constexpr int EXTEND_FACTOR = 2;
-    std::atomic<uint32> extend_flag;
-    std::atomic<RowIdMapEntry **> m_segments{};
-    std::atomic<int> segment_number{};
-    std::atomic<int> m_segmentCapacity{};
+    std::atomic<std::atomic<RowIdMapPage *> *> *m_segments{nullptr};
+    uint32 m_segmentNum{0};
 
     VecStore *m_vecstore;
 
-    static const int segment_len = 128 * 1024;
+    static const int segment_len = 4096;
     uint32 row_len;
-    std::mutex mtx;
+    RowId m_maxRowId;
 
-    void SetExtendFlag()
-    {
-        extend_flag.fetch_add(1);
-    }
-
-    void ResetExtendFlag()
-    {
-        extend_flag.fetch_add(1);
-    }
-
-    uint32 GetExtendVersion()
-    {
-        uint32 res = extend_flag.load();
-        while (res & 1) {
-            res = extend_flag.load();
-        }
-        return res;
-    }
-
-    RowIdMapEntry *GetSegment(int seg_id);
-    void Extend(int seg_id);
+    std::atomic<RowIdMapPage *> *GetSegment(uint32 seg_id);
 
 public:
-    RowIdMap(TableSpace *space, uint32 seghead, uint32 _row_len) : row_len(_row_len), extend_flag(0)
+    RowIdMap(TableSpace *space, uint32 seghead, uint32 _row_len) : row_len(_row_len)
     {
-        m_segmentCapacity = SEGMENT_CAP;
-
-        m_segments.store(new RowIdMapEntry *[m_segmentCapacity]());
-
         m_vecstore = new VecStore(space, seghead, _row_len);
-        segment_number = 0;
+        m_maxRowId = m_vecstore->GetMaxRowId();
+
+        uint32 maxPageNum = m_vecstore->GetMaxLeafPageNum();
+        m_segmentNum = (maxPageNum + segment_len - 1) / segment_len;
+        m_segments = new std::atomic<std::atomic<RowIdMapPage *> *>[m_segmentNum]();
     }
 
+    ~RowIdMap();
+
     RowId InsertVersion()
     {
         return m_vecstore->InsertVersion();
@@ -169,15 +213,33 @@ public:
         return m_vecstore->GetUpperRowId();
     }
 
-    RowIdMapEntry *GetEntry(RowId rowId, bool is_read = false);
+    RowIdMapEntry GetEntry(RowId rowId, bool is_read = false);
+
+    VecStore *GetVecStore()
+    {
+        return m_vecstore;
+    }
+
+    /* 作废 leaf page 上所有 RowId 的缓存并归还该页面；调用者需独占该表 */
+    void ReleaseLeafPage(uint32 pageIdx);
+
+    /* 行描述占用的 DRAM 字节数，不含 tuple 的 DRAM 缓存 */
+    size_t GetMetaMemorySize();
 };
 
 RowIdMap *GetRowIdMap(uint32 seghead, uint32 row_len);
 
+/*
+ * segment 即将被回收：把它的 RowIdMap 从注册表中摘除并释放。
+ * 各线程按 seghead 缓存的其他状态记录了建立时的 epoch，与注册表中的不一致即已作废。
+ */
+void DropRowIdMap(uint32 seghead);
+
+/* seghead 当前注册的 RowIdMap 的 epoch，未注册时返回 0 */
+uint64 GetRowIdMapEpoch(uint32 seghead);
+
 void InitGlobalRowIdMapCache();
-void InitLocalRowIdMapCache();
 void DestroyGlobalRowIdMapCache();
-void DestroyLocalRowIdMapCache();
 
 }  // namespace NVMDB
 
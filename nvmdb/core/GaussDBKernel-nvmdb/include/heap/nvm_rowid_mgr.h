@@ -22,26 +22,79 @@
 #ifndef NVMDB_ROWID_MGR_H
 #define NVMDB_ROWID_MGR_H
 
+#include <algorithm>
 #include <mutex>
+#include <libpmem.h>
 
 #include "nvm_types.h"
 #include "nvm_table_space.h"
+#include "nvm_page_dlist.h"
 
 namespace NVMDB {
 
 static const ExtentSizeType HEAP_EXTENT_SIZE = EXTSZ_2M;
 
+/* 自适应增长的表，前 HEAP_SMALL_PAGES 个 leaf page 使用 HEAP_SMALL_EXTENT_SIZE，之后使用表的 extent 大小 */
+static const ExtentSizeType HEAP_SMALL_EXTENT_SIZE = EXTSZ_64K;
+static const uint32 HEAP_SMALL_PAGES = 16;
+
+/*
+ * 表的 leaf page 布局，建表时确定，记在 root page 中。全 0 表示默认布局：所有 leaf page 都是 HEAP_EXTENT_SIZE。
+ * 同一张表的 leaf page 大小在建表后不再变化，RowId 与 (leaf page, 页内下标) 之间按布局直接换算。
+ */
+struct HeapLeafLayout {
+    uint8 m_extent;      /* leaf page 的 extent 大小 */
+    uint8 m_smallExtent; /* 前 m_smallPages 个 leaf page 的 extent 大小 */
+    uint8 m_smallPages;
+    uint8 m_valid;
+};
+
+static_assert(sizeof(HeapLeafLayout) == sizeof(uint32), "HeapLeafLayout is stored in one page map slot");
+
+/*
+ * leaf page 的页号表，放在 segment head（root page）中：
+ *     [MaxPageNum][直接映射的页号 ... ][generation][HeapLeafLayout][一级间接页][二级间接页]
+ * root page 和 leaf page 一样大（最大 2M），小表只占两个小 extent。前 direct_num 个 leaf page 直接记在
+ * root page 中，更多的 leaf page 记在间接页中；间接页是 segment 上的 2M extent，第一次用到时分配，随 segment 一起回收。
+ * generation 是表 truncate 的次数，每换一个 segment 加一，编码在索引 key 中用来区分新旧 segment 上的索引项。
+ */
 class RowIDMgr {
+    static constexpr uint32 MAP_PAGE_LEN = (GetExtentSize(EXTSZ_2M) - PageHeaderSize) / sizeof(uint32);
+    /* debug 版本缩小一级间接页的容量，少量页面即可覆盖各级映射 */
+    static constexpr uint32 SINGLE_INDIRECT_NUM = CompileValue(MAP_PAGE_LEN, 4U);
+    /* 页数上限决定了 DRAM 中页面目录和空闲位图的大小；小 extent 的表容量相应变小 */
+    static constexpr uint32 MAX_LEAF_PAGE_NUM = 1U << 23;
+
     uint32 seghead;
     uint32 tuple_len;
-    uint32 tuples_perpage;
     TableSpace *tblspc;
     std::mutex mtx;
 
+    HeapLeafLayout layout;
+    ExtentSizeType leaf_extent;
+    uint32 tuples_perpage;
+    uint32 small_pages;
+    uint32 small_tuples_perpage;
+    RowId small_rows;
+    uint32 max_leaf_pages;
+
+    /* root page 中页号表的布局 */
+    uint32 root_generation;
+    uint32 root_layout;
+    uint32 root_single_indirect;
+    uint32 root_double_indirect;
+    uint32 direct_num;
+
+    static uint32 TuplesPerPage(ExtentSizeType extent, uint32 tupleLen)
+    {
+        return PageContentSize(extent) / tupleLen;
+    }
+
     std::pair<uint32, uint32> RowIdToLeafPageLocation(RowId rid)
     {
-        int pageid = rid / tuples_perpage;
-        int page_offset = rid % tuples_perpage;
+        uint32 pageid = LeafPageOfRowId(rid);
+        Assert(pageid < max_leaf_pages);
+        uint32 page_offset = rid - LeafPageFirstRowId(pageid);
         return std::make_pair(pageid, page_offset);
     }
 
@@ -53,6 +106,51 @@ class RowIDMgr {
         return map;
     }
 
+    /* 间接页的页号表；*slot 无效时按需分配，不分配则返回 NULL */
+    uint32 *GetMapPage(uint32 *slot, bool alloc, uint32 spaceno)
+    {
+        if (NVMBlockNumberIsInvalid(__atomic_load_n(slot, __ATOMIC_ACQUIRE))) {
+            if (!alloc) {
+                return NULL;
+            }
+            std::lock_guard<std::mutex> lock_guard(mtx);
+            if (NVMBlockNumberIsInvalid(*slot)) {
+                tblspc->AllocNewExtent(slot, EXTSZ_2M, seghead, spaceno);
+                pmem_persist(slot, sizeof(uint32));
+            }
+        }
+        return (uint32 *)PageGetContent(tblspc->RelpointOfPageno(*slot));
+    }
+
+    /* leaf page 页号在页号表中的位置；所在的间接页不存在且 alloc 为 false 时返回 NULL */
+    uint32 *LeafPageSlot(uint32 leaf_page_idx, bool alloc)
+    {
+        Assert(leaf_page_idx < max_leaf_pages);
+        uint32 *map = GetRootPageMap();
+        if (likely(leaf_page_idx < direct_num)) {
+            return &map[leaf_page_idx];
+        }
+        uint32 spaceno = leaf_page_idx % g_dirPathNum;
+        uint64 idx = leaf_page_idx - direct_num;
+        if (idx < SINGLE_INDIRECT_NUM) {
+            uint32 *single = GetMapPage(&map[root_single_indirect], alloc, spaceno);
+            return single == NULL ? NULL : &single[idx];
+        }
+        idx -= SINGLE_INDIRECT_NUM;
+        uint32 *top = GetMapPage(&map[root_double_indirect], alloc, spaceno);
+        if (top == NULL) {
+            return NULL;
+        }
+        uint32 *mid = GetMapPage(&top[idx / MAP_PAGE_LEN], alloc, spaceno);
+        return mid == NULL ? NULL : &mid[idx % MAP_PAGE_LEN];
+    }
+
+    uint32 LeafPageNo(uint32 leaf_page_idx)
+    {
+        uint32 *slot = LeafPageSlot(leaf_page_idx, false);
+        return slot == NULL ? NVMInvalidBlockNumber : __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    }
+
     inline void SetMaxPageNum(uint32 &page_num)
     {
         char *rootpage = tblspc->RelpointOfPageno(seghead);
@@ -68,53 +166,262 @@ class RowIDMgr {
         return *(uint32 *)PageGetContent(rootpage);
     }
 
-    void try_alloc_new_page(uint32 leaf_page_idx)
+    /* 页面归还后，把 MaxPageNum 降到最高的一个仍存在的 leaf page */
+    void ShrinkMaxPageNum()
     {
-        uint32 *map = GetRootPageMap();
+        char *rootpage = tblspc->RelpointOfPageno(seghead);
+        uint32 *max_page_num = (uint32 *)PageGetContent(rootpage);
+        uint32 page_num = *max_page_num;
+        while (page_num > 0 && NVMBlockNumberIsInvalid(LeafPageNo(page_num))) {
+            page_num--;
+        }
+        if (page_num != *max_page_num) {
+            *max_page_num = page_num;
+            pmem_persist(max_page_num, sizeof(uint32));
+        }
+    }
 
+    void try_alloc_new_page(uint32 *slot, uint32 leaf_page_idx)
+    {
         std::lock_guard<std::mutex> lock_guard(mtx);
-        if (NVMBlockNumberIsValid(map[leaf_page_idx])) {
+        if (NVMBlockNumberIsValid(*slot)) {
             return;
         }
         /* leaf page idx is logic page number. allocate physical page from space no. */
         uint32 spaceno = leaf_page_idx % g_dirPathNum;
-        tblspc->AllocNewExtent(&map[leaf_page_idx], HEAP_EXTENT_SIZE, seghead, spaceno);
+        tblspc->AllocNewExtent(slot, LeafPageExtent(leaf_page_idx), seghead, spaceno);
+    }
+
+    /* 能放下 tuple_len 的 extent 大小：在一个 slice 以内，且每页 tuple 数不超过已占用计数的范围 */
+    static bool LeafExtentFits(TableSpace *space, ExtentSizeType extent, uint32 tupleLen)
+    {
+        uint32 tpp = TuplesPerPage(extent, tupleLen);
+        return GetExtentBlockCount(extent) <= space->SLICE_BLOCKS && tpp > 0 && tpp <= MAX_UINT16;
+    }
+
+    /* 取不超过 extent 的最大合适大小，都不合适时取超过 extent 的最小合适大小 */
+    static ExtentSizeType FitLeafExtent(TableSpace *space, ExtentSizeType extent, uint32 tupleLen)
+    {
+        int below = -1;
+        int above = -1;
+        for (int i = 0; i < EXTSZ_TYPE_NUM; i++) {
+            ExtentSizeType cur = static_cast<ExtentSizeType>(i);
+            if (!LeafExtentFits(space, cur, tupleLen)) {
+                continue;
+            }
+            if (GetExtentBlockCount(cur) <= GetExtentBlockCount(extent)) {
+                if (below < 0 || GetExtentBlockCount(cur) > GetExtentBlockCount(below)) {
+                    below = i;
+                }
+            } else if (above < 0 || GetExtentBlockCount(cur) < GetExtentBlockCount(above)) {
+                above = i;
+            }
+        }
+        ALWAYS_CHECK(below >= 0 || above >= 0);
+        return static_cast<ExtentSizeType>(below >= 0 ? below : above);
     }
 
 public:
     RowIDMgr(TableSpace *_space, uint32 _seghead, uint32 _tuple_len)
         : tblspc(_space), seghead(_seghead), tuple_len(_tuple_len)
     {
-        tuples_perpage = PageContentSize(HEAP_EXTENT_SIZE) / tuple_len;
+        NVMPageHeader *rootHeader = reinterpret_cast<NVMPageHeader *>(tblspc->RelpointOfPageno(seghead));
+        uint32 root_map_len = PageContentSize(rootHeader->m_blksz) / sizeof(uint32) - 1;
+        root_generation = root_map_len - 4;
+        root_layout = root_map_len - 3;
+        root_single_indirect = root_map_len - 2;
+        root_double_indirect = root_map_len - 1;
+        direct_num = CompileValue(root_generation, std::min(root_generation, 4U));
+
+        uint32 word = __atomic_load_n(&GetRootPageMap()[root_layout], __ATOMIC_ACQUIRE);
+        errno_t ret = memcpy_s(&layout, sizeof(layout), &word, sizeof(word));
+        SecureRetCheck(ret);
+        if (layout.m_valid) {
+            leaf_extent = static_cast<ExtentSizeType>(layout.m_extent);
+            small_pages = layout.m_smallPages;
+        } else {
+            leaf_extent = HEAP_EXTENT_SIZE;
+            small_pages = 0;
+        }
+        tuples_perpage = TuplesPerPage(leaf_extent, tuple_len);
+        Assert(tuples_perpage > 0 && tuples_perpage <= MAX_UINT16);
+        small_tuples_perpage = small_pages > 0 ? TuplesPerPage(ExtentSizeType(layout.m_smallExtent), tuple_len) : 0;
+        small_rows = (RowId)small_pages * small_tuples_perpage;
+
+        /* 上限取 RowId、页号表、tablespace 容量和 MAX_LEAF_PAGE_NUM 中最小的 */
+        uint64 max_pages = small_pages + (MaxRowId - small_rows) / tuples_perpage;
+        uint64 map_capacity = direct_num + SINGLE_INDIRECT_NUM + 1LLU * MAP_PAGE_LEN * MAP_PAGE_LEN;
+        uint64 space_capacity = tblspc->MAX_SLICE_NUM * tblspc->SLICE_BLOCKS / GetExtentBlockCount(leaf_extent);
+        max_pages = std::min(std::min(max_pages, map_capacity), std::min(space_capacity, (uint64)MAX_LEAF_PAGE_NUM));
+        max_leaf_pages = max_pages;
+    }
+
+    /*
+     * 按 tuple 长度把建表时指定的 extent 大小调整为可用的大小，adaptive 为 true 时前几个 leaf page 使用小 extent。
+     * 得到的布局传给 CreateSegment。
+     */
+    static HeapLeafLayout MakeLayout(TableSpace *space, uint32 tupleLen, ExtentSizeType extent, bool adaptive)
+    {
+        HeapLeafLayout res{};
+        res.m_extent = FitLeafExtent(space, extent, tupleLen);
+        if (adaptive) {
+            ExtentSizeType small = FitLeafExtent(space, HEAP_SMALL_EXTENT_SIZE, tupleLen);
+            if (GetExtentBlockCount(small) < GetExtentBlockCount(res.m_extent)) {
+                res.m_smallExtent = small;
+                res.m_smallPages = HEAP_SMALL_PAGES;
+            }
+        }
+        res.m_valid = 1;
+        return res;
+    }
+
+    /* 按布局新建一个 segment，root page 与 leaf page 一样大（最大 2M），返回 root page 页号 */
+    static uint32 CreateSegment(TableSpace *space, const HeapLeafLayout &layout, uint32 generation = 0)
+    {
+        Assert(layout.m_valid);
+        ExtentSizeType rootExtent = static_cast<ExtentSizeType>(layout.m_smallPages > 0 ? layout.m_smallExtent
+                                                                                        : layout.m_extent);
+        if (GetExtentBlockCount(rootExtent) > GetExtentBlockCount(EXTSZ_2M)) {
+            rootExtent = EXTSZ_2M;
+        }
+        uint32 seghead = NVMInvalidBlockNumber;
+        space->AllocNewExtent(&seghead, rootExtent);
+
+        char *rootpage = space->RelpointOfPageno(seghead);
+        uint32 root_map_len = PageContentSize(rootExtent) / sizeof(uint32) - 1;
+        uint32 *slot = (uint32 *)PageGetContent(rootpage) + 1 + root_map_len - 3;
+        errno_t ret = memcpy_s(slot, sizeof(uint32), &layout, sizeof(layout));
+        SecureRetCheck(ret);
+        slot[-1] = generation;
+        pmem_persist(PageGetContent(rootpage), PageContentSize(rootExtent));
+        return seghead;
+    }
+
+    HeapLeafLayout GetLayout() const
+    {
+        return layout;
+    }
+
+    uint32 GetGeneration()
+    {
+        return GetRootPageMap()[root_generation];
+    }
+
+    ExtentSizeType LeafPageExtent(uint32 leaf_page_idx) const
+    {
+        return leaf_page_idx < small_pages ? static_cast<ExtentSizeType>(layout.m_smallExtent) : leaf_extent;
+    }
+
+    uint32 LeafPageOfRowId(RowId rid) const
+    {
+        if (unlikely(rid < small_rows)) {
+            return rid / small_tuples_perpage;
+        }
+        return small_pages + (rid - small_rows) / tuples_perpage;
+    }
+
+    RowId LeafPageFirstRowId(uint32 leaf_page_idx) const
+    {
+        if (unlikely(leaf_page_idx < small_pages)) {
+            return (RowId)leaf_page_idx * small_tuples_perpage;
+        }
+        return small_rows + (RowId)(leaf_page_idx - small_pages) * tuples_perpage;
+    }
+
+    uint32 LeafPageTupleNum(uint32 leaf_page_idx) const
+    {
+        return leaf_page_idx < small_pages ? small_tuples_perpage : tuples_perpage;
+    }
+
+    /* 表能容纳的 RowId 上界（不含） */
+    RowId GetMaxRowId() const
+    {
+        return LeafPageFirstRowId(max_leaf_pages);
+    }
+
+    /* 一张表最多的 leaf page 数 */
+    uint32 GetMaxLeafPageNum() const
+    {
+        return max_leaf_pages;
     }
 
     char *version_pointer(RowId rowid, bool append = true)
     {
         auto leaf_page_loc = RowIdToLeafPageLocation(rowid);
-        uint32 *map = GetRootPageMap();
 
         /* 1. check leaf page existing. If not, try to allocate a new page */
-        if (NVMBlockNumberIsInvalid(map[leaf_page_loc.first])) {
+        uint32 *slot = LeafPageSlot(leaf_page_loc.first, append);
+        if (slot == NULL || NVMBlockNumberIsInvalid(__atomic_load_n(slot, __ATOMIC_ACQUIRE))) {
             if (append) {
                 SetMaxPageNum(leaf_page_loc.first);
-                try_alloc_new_page(leaf_page_loc.first);
+                try_alloc_new_page(slot, leaf_page_loc.first);
             } else {
                 return NULL;
             }
         }
 
-        uint32 pagenum = map[leaf_page_loc.first];
+        uint32 pagenum = *slot;
         Assert(NVMBlockNumberIsValid(pagenum));
         char *leafpage = tblspc->RelpointOfPageno(pagenum);
         char *leafdata = (char *)PageGetContent(leafpage);
-        char *tuple = leafdata + leaf_page_loc.second * tuple_len;
+        char *tuple = leafdata + (uint64)leaf_page_loc.second * tuple_len;
 
         return tuple;
     }
 
     inline RowId GetUpperRowId()
     {
-        return (GetMaxPageNum() + 1) * tuples_perpage;
+        return LeafPageFirstRowId(GetMaxPageNum() + 1);
+    }
+
+    inline uint32 GetLeafPageNum()
+    {
+        return GetMaxPageNum() + 1;
+    }
+
+    /* leaf page 中第一个 tuple 的地址，页面不存在时返回 NULL */
+    char *leaf_page_pointer(uint32 leaf_page_idx)
+    {
+        uint32 pagenum = LeafPageNo(leaf_page_idx);
+        if (NVMBlockNumberIsInvalid(pagenum)) {
+            return NULL;
+        }
+        return (char *)PageGetContent(tblspc->RelpointOfPageno(pagenum));
+    }
+
+    /* leaf page 头部的已占用 tuple 计数，页面不存在时返回 NULL */
+    uint16 *leaf_page_used_count(uint32 leaf_page_idx)
+    {
+        uint32 pagenum = LeafPageNo(leaf_page_idx);
+        if (NVMBlockNumberIsInvalid(pagenum)) {
+            return NULL;
+        }
+        return &reinterpret_cast<NVMPageHeader *>(tblspc->RelpointOfPageno(pagenum))->m_usedCount;
+    }
+
+    /*
+     * 把 leaf page 归还给 tablespace，调用者需保证没有并发访问该页。
+     * 先断开页号表中的映射再从 segment 链表摘除：宕机时该 extent 最多仍挂在 segment 上，
+     * 随表一起回收；摘除之后、归还之前宕机会丢失这一个 extent。间接页不归还。
+     */
+    void release_leaf_page(uint32 leaf_page_idx)
+    {
+        uint32 *slot = LeafPageSlot(leaf_page_idx, false);
+        if (slot == NULL) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock_guard(mtx);
+        uint32 pagenum = *slot;
+        if (NVMBlockNumberIsInvalid(pagenum)) {
+            return;
+        }
+        __atomic_store_n(slot, NVMInvalidBlockNumber, __ATOMIC_RELEASE);
+        pmem_persist(slot, sizeof(uint32));
+
+        page_dlist_delete(tblspc, PageSegmentDListOffset, pagenum);
+        tblspc->FreeExtent(&pagenum);
+        ShrinkMaxPageNum();
     }
 };
 
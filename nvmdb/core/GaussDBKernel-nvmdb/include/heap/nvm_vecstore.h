@@ -23,6 +23,8 @@
 #define NVMDB_VECSTORE_H
 
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 #include "nvm_block.h"
 #include "nvm_table_space.h"
@@ -31,26 +33,41 @@
 
 namespace NVMDB {
 /*
- * All tuples in a table are logically in a vector indexed by row id. The vector is implemented as a two-level page
- * table. The segment head of the table is the first level page (root page), storing page number of all second level
- * pages (leaf pages). Leaf pages store tuples.
+ * All tuples in a table are logically in a vector indexed by row id. The vector is implemented as a multi-level page
+ * table. The segment head of the table is the first level page (root page), storing page number of leaf pages
+ * directly or through indirect map pages. Leaf pages store tuples. The size of leaf pages is chosen per table when
+ * the table is created (see HeapLeafLayout).
  *
  * The procedure of allocated an new RowID:
  *     1. Find a unique RowID according to local cache and global bitmap.
  *     2. If corresponding physic page does not exist, allocating a new one.
  *     3. If corresponding physic page exists, and corresponding tuple is used, then return to step 1 and find a new
- *        RowId. This scenario happens after recovery, as global bitmap is reset. In future, if we make FSM info
- *        persistent, this step can be eliminated.
+ *        RowId. This scenario happens after recovery, as global bitmap is reset.
+ *
+ * Each leaf page header keeps a count of used tuples. When the VecStore is built (e.g. after restart), pages whose
+ * count shows them full are set in the global bitmap. Slots of a page are handed out in order, so the first range
+ * allocated from a partially used page starts at its used count instead of its first slot; step 3 then only probes
+ * used slots left above the holes of deleted tuples, and those holes are not reused.
  */
 class VecStore {
     RowId TryNextRowid();
 
+    void RebuildBitmap();
+
     uint32 m_seghead{0};
     uint32 m_tupleLen{0};
-    uint32 m_tuplesPerpage{0};
+    /* 进程内唯一，segment 页号被复用后各线程据此识别旧的线程局部缓存 */
+    uint64 m_epoch{0};
     RowIDMgr *m_rowidMgr{nullptr};
 
     std::mutex mtx;
+    /* 重启时未写满的 leaf page -> 第一次分配时的起始下标，由 mtx 保护，取用一次后删除 */
+    std::unordered_map<uint32, uint32> m_startHints;
+    std::atomic<bool> m_hasStartHints{false};
+    /* InsertVersion 中 TryAt 碰到已占用 tuple 的次数 */
+    std::atomic<uint64> m_tryAtMisses{0};
+
+    uint32 TakeStartHint(uint32 pageIdx);
 
     TableSpace *m_tblspc{nullptr};
     GlobalBitMap **m_gbm{nullptr};
@@ -63,10 +80,78 @@ public:
     char *TryAt(RowId rid);
 
     RowId InsertVersion();
+
+    uint64 GetTryAtMisses() const
+    {
+        return m_tryAtMisses.load(std::memory_order_relaxed);
+    }
+
+    /* 维护 leaf page 的已占用计数，插入写下 undo 之后调用 MarkUsed，回滚插入时调用 MarkUnused */
+    void MarkUsed(RowId rid);
+    void MarkUnused(RowId rid);
+
+    /* leaf page 头部记录的已占用 tuple 个数，页面不存在时返回 0 */
+    uint32 GetLeafPageUsedCount(uint32 pageIdx);
     char *VersionPoint(RowId row_id);
 
     /* upper bound RowId in highest allocated range */
     RowId GetUpperRowId();
+
+    uint32 GetTupleLen() const
+    {
+        return m_tupleLen;
+    }
+
+    uint64 GetEpoch() const
+    {
+        return m_epoch;
+    }
+
+    /* 一张表最多的 leaf page 数 */
+    uint32 GetMaxLeafPageNum() const
+    {
+        return m_rowidMgr->GetMaxLeafPageNum();
+    }
+
+    RowId GetMaxRowId() const
+    {
+        return m_rowidMgr->GetMaxRowId();
+    }
+
+    HeapLeafLayout GetLeafLayout() const
+    {
+        return m_rowidMgr->GetLayout();
+    }
+
+    uint32 GetGeneration() const
+    {
+        return m_rowidMgr->GetGeneration();
+    }
+
+    /* RowId 与 leaf page 的换算，见 HeapLeafLayout */
+    uint32 LeafPageOfRowId(RowId rid) const
+    {
+        return m_rowidMgr->LeafPageOfRowId(rid);
+    }
+
+    RowId LeafPageFirstRowId(uint32 pageIdx) const
+    {
+        return m_rowidMgr->LeafPageFirstRowId(pageIdx);
+    }
+
+    uint32 LeafPageTupleNum(uint32 pageIdx) const
+    {
+        return m_rowidMgr->LeafPageTupleNum(pageIdx);
+    }
+
+    /* 逻辑 leaf page 的个数（含中间已被归还的空洞） */
+    uint32 GetLeafPageNum();
+
+    /* leaf page 中第一个 tuple 的地址，页面不存在时返回 NULL */
+    char *LeafPagePoint(uint32 pageIdx);
+
+    /* 归还 leaf page；GlobalBitMap 中对应的 range 不释放，再次插入时会重新分配页面 */
+    void ReleaseLeafPage(uint32 pageIdx);
 };
 
 }  // namespace NVMDB
@@ -30,19 +30,26 @@
 
 namespace NVMDB {
 
-/* idx id + tag + row id */
-static constexpr uint32 KEY_EXTRA_LENGTH = sizeof(uint32)  + 1  + sizeof(uint32) ;
+/* idx id + generation + tag + row id */
+static constexpr uint32 KEY_EXTRA_LENGTH = sizeof(uint32) + sizeof(uint32) + 1 + sizeof(RowId);
 static constexpr uint32 KEY_DATA_LENGTH = KEYLENGTH - KEY_EXTRA_LENGTH;
 
 void IndexBootstrap(const char *dir);
 void IndexExitProcess();
 void InitLocalIndex(int grpId);
 void DestroyLocalIndex();
+/* 在后台物理删除索引 idxId 中 generation 小于 generation 的全部索引项 */
+void IndexPurgeGenerationsAsync(TableId idxId, uint32 generation);
 IndexColumnDesc *IndexDescCreate(uint32 colCount);
 void IndexDescDelete(IndexColumnDesc *desc);
 
 class NVMIndex {
     TableId m_idxId;
+    /*
+     * 所属表当前 segment 的 generation，编码在索引 key 中 idx id 之后。truncate 换上新 segment 后旧索引项不再落在
+     * 任何查找范围内，索引不用逐行删除；回滚时随表切回旧 segment，旧索引项重新可见；提交后由后台按范围物理删除。
+     */
+    uint32 m_generation = 0;
     uint32 m_colCnt = 0;
     uint64 m_rowLen = 0;
     IndexColumnDesc *m_indexDes = nullptr;
@@ -58,15 +65,23 @@ public:
         IndexDescDelete(m_indexDes);
     }
 
-    void Encode(DRAMIndexTuple *tuple, Key_t *key, RowId rowId)
+    /* 只含 idx id 和 generation 的 key，比该 generation 的所有索引项都小、比更早 generation 的都大 */
+    static void EncodeGeneration(TableId idxId, uint32 generation, Key_t *key)
     {
         char *data = key->getData();
-        EncodeUint32(data, m_idxId);
-        data += sizeof(uint32);
+        EncodeUint32(data, idxId);
+        EncodeUint32(data + sizeof(uint32), generation);
+        key->keyLength = sizeof(uint32) + sizeof(uint32);
+    }
+
+    void Encode(DRAMIndexTuple *tuple, Key_t *key, RowId rowId)
+    {
+        EncodeGeneration(m_idxId, m_generation, key);
+        char *data = key->getData() + key->keyLength;
         int len = tuple->Encode(data);
         data += len;
         *data = CODE_ROWID;
-        EncodeUint32(data + 1, rowId);
+        EncodeUint64(data + 1, rowId);
         key->keyLength = KEY_EXTRA_LENGTH + len;
         Assert(key->keyLength <= KEYLENGTH);
     }
@@ -78,7 +93,7 @@ public:
         Key_t kb;
         Key_t ke;
         Encode(begin, &kb, 0);
-        Encode(end, &ke, 0xffffffff);
+        Encode(end, &ke, InvalidRowId);
 
         auto iter = new NVMIndexIter(kb, ke, snapshot, max_range, reverse);
         return iter;
@@ -150,6 +165,18 @@ public:
     {
         return m_idxId;
     }
+
+    /* 由 Table 在挂载、切换 segment 时设置，调用者需独占该表 */
+    void SetGeneration(uint32 generation) noexcept
+    {
+        m_generation = generation;
+    }
+
+    /* 删除早于当前 generation 的索引项，即已提交的 truncate 留下的旧数据 */
+    void PurgeStaleGenerations()
+    {
+        IndexPurgeGenerationsAsync(m_idxId, m_generation);
+    }
 };
 
 }  // namespace NVMDB
@@ -43,9 +43,9 @@ class NVMIndexIter {
     RowId Decode(Key_t *key)
     {
         char *buf = key->getData();
-        buf += key->keyLength - 1 - sizeof(uint32);
+        buf += key->keyLength - 1 - sizeof(RowId);
         Assert(*buf == CODE_ROWID);
-        return (RowId)DecodeUint32(buf + 1);
+        return (RowId)DecodeUint64(buf + 1);
     }
 
     void search(Key_t &kb, Key_t &ke, int max_range, LookupSnapshot snapshot, bool reverse)
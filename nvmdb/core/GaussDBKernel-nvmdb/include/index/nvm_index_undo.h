@@ -24,16 +24,19 @@
 
 #include "index/nvm_index.h"
 #include "nvm_transaction.h"
+#include "nvm_undo_rollback.h"
 
 namespace NVMDB {
 
-void PrepareIndexInsertUndo(Transaction *trx, Key_t &key, uint64 CSN);
+UndoRecPtr PrepareIndexInsertUndo(Transaction *trx, Key_t &key, uint64 CSN);
 
-void PrepareIndexDeleteUndo(Transaction *trx, Key_t &key);
+UndoRecPtr PrepareIndexDeleteUndo(Transaction *trx, Key_t &key);
 
-void UndoIndexInsert(UndoRecord *undo);
+void UndoIndexInsert(UndoRecord *undo, UndoReplayContext *context);
 
-void UndoIndexDelete(UndoRecord *undo);
+void UndoIndexDelete(UndoRecord *undo, UndoReplayContext *context);
+
+uint64 IndexUndoLane(UndoRecord *undo);
 
 }  // namespace NVMDB
 
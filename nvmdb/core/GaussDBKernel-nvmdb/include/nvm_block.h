@@ -28,9 +28,14 @@
 
 namespace NVMDB {
 
+/* 取值记录在页头的 m_blksz 中，新的大小只能追加在末尾 */
 enum ExtentSizeType {
     EXTSZ_8K,
     EXTSZ_2M,
+    EXTSZ_64K,
+    EXTSZ_512K,
+    EXTSZ_16M,
+    EXTSZ_64M,
 
     EXTSZ_TYPE_NUM,
 };
@@ -39,21 +44,34 @@ struct ExtentSizeInfo {
     uint32 block_count;
 };
 
-static constexpr ExtentSizeInfo gBlockSizeInfo[] = {{1}, {256}};
+static constexpr ExtentSizeInfo gBlockSizeInfo[] = {{1}, {256}, {8}, {64}, {2048}, {8192}};
+static_assert(sizeof(gBlockSizeInfo) / sizeof(ExtentSizeInfo) == EXTSZ_TYPE_NUM, "missing extent size info");
 
 const uint32 NVM_BLCKSZ = 8192;
 const uint32 NVMInvalidBlockNumber = 0;
 
-static inline uint32 GetExtentBlockCount(int extType)
+static constexpr inline uint32 GetExtentBlockCount(int extType)
 {
     return gBlockSizeInfo[extType].block_count;
 }
 
-static inline uint32 GetExtentSize(int extType)
+static constexpr inline uint32 GetExtentSize(int extType)
 {
     return GetExtentBlockCount(extType) * NVM_BLCKSZ;
 }
 
+/* 不超过 blockCount 个 block 的最大 extent；blockCount 为 0 时返回 EXTSZ_8K */
+static inline ExtentSizeType LargestExtentWithin(uint32 blockCount)
+{
+    ExtentSizeType res = EXTSZ_8K;
+    for (int i = 0; i < EXTSZ_TYPE_NUM; i++) {
+        if (GetExtentBlockCount(i) <= blockCount && GetExtentBlockCount(i) > GetExtentBlockCount(res)) {
+            res = static_cast<ExtentSizeType>(i);
+        }
+    }
+    return res;
+}
+
 static inline PointerOffset BlockNumberToOffset(uint32 blkno)
 {
     return (PointerOffset)(1LLU * blkno * NVM_BLCKSZ);
@@ -74,9 +92,16 @@ typedef char *Page;
 typedef struct NVMPageHeader {
     PageDListNode m_blkList;
     uint8 m_blksz;
+    /*
+     * heap leaf page 上已占用的 tuple 个数，占用原有的对齐空洞，不改变页面布局。
+     * 只作为重启后重建空闲位图的提示：宕机可能让它偏小，但不会偏大。
+     */
+    uint16 m_usedCount;
     uint32 m_blkno;
 } NVMPageHeader;
 
+static_assert(sizeof(NVMPageHeader) == 16, "NVMPageHeader layout is persistent");
+
 #define PageSegmentDListOffset 0
 
 #define PageHeaderSize (sizeof(NVMPageHeader))
@@ -31,9 +31,24 @@ static constexpr int NVMDB_MAX_GROUP = 4;
 // Always greater than the number of concurrent connections
 static constexpr uint32 NVMDB_MAX_THREAD_NUM = 1024;
 
-// for undo
+// for undo；segment 只在写事务执行期间绑定，个数不限制连接数
 static constexpr int NVMDB_UNDO_SEGMENT_NUM = 2048;
-static_assert(NVMDB_UNDO_SEGMENT_NUM >= NVMDB_MAX_THREAD_NUM);
+// 崩溃恢复时回滚未完成事务的默认线程数
+static constexpr uint32 NVMDB_UNDO_RECOVERY_WORKER_NUM = 8;
+// 启动时并行挂载、扫描 undo segment 的线程数
+static constexpr uint32 NVMDB_UNDO_MOUNT_WORKER_NUM = 8;
+// 后台回收 undo 的最大线程数；未回收的事务槽每积压这么多就多用一个线程
+static constexpr uint32 NVMDB_UNDO_RECYCLE_WORKER_NUM = 4;
+static constexpr uint64 NVMDB_UNDO_RECYCLE_BACKLOG_PER_WORKER = CompileValue(64 * 1024, 4 * 1024);
+// 大事务回滚时并行回放 undo 的最大线程数（不超过 CPU 数）；事务的 undo 每有这么多字节就多用一个线程。
+// 按线程 CPU 时间实测：4 个线程时分发线程的开销约为串行回滚的 80%，算上唤醒和收尾的固定开销，
+// undo 到 2MB 左右并行才更快；线程再多受分发线程读 undo 的速度限制，不再变快。
+static constexpr uint32 NVMDB_UNDO_ROLLBACK_WORKER_NUM = 4;
+static constexpr uint64 NVMDB_UNDO_ROLLBACK_BYTES_PER_WORKER = 1LLU << 20;
+// undo 保留上限：快照建立超过这么久（0 不限制），或因快照不能回收的 undo 总共超过这么多字节时，
+// 作废最老的快照，读旧版本时报 snapshot too old
+static constexpr uint64 NVMDB_UNDO_RETENTION_AGE_MS = 0;
+static constexpr uint64 NVMDB_UNDO_RETENTION_BYTES = CompileValue(16LLU << 30, 256LLU << 20);
 
 // for pactree oplog
 static constexpr int NVMDB_NUM_LOGS_PER_THREAD = 512;
@@ -26,6 +26,8 @@
 #include <string>
 #include <vector>
 
+#include "nvm_types.h"
+
 namespace NVMDB {
 
 /* 创建数据库初始环境 */
@@ -34,6 +36,16 @@ void InitDB(const char *dir);
 /* 数据库启动，进行必要的初始化。 */
 void BootStrap(const char *dir);
 
+/* 最近一次 BootStrap 各阶段的耗时，单位微秒。各阶段并行执行，总耗时约为最慢的阶段 */
+struct StartupStat {
+    uint64 m_heapMountUs;
+    uint64 m_indexMountUs;
+    uint64 m_undoMountUs; /* 挂载并扫描所有 undo segment，不含后台回滚（见 GetUndoRecoveryProgress） */
+    uint64 m_totalUs;
+};
+
+void GetStartupStat(StartupStat *stat);
+
 /* 进程退出时调用，清理内存变量 */
 void ExitDBProcess();
 
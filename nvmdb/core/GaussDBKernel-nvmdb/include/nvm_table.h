@@ -30,6 +30,8 @@
 
 namespace NVMDB {
 
+class Transaction;
+
 typedef struct TableDesc {
     ColumnDesc *col_desc = nullptr;
     uint32 col_cnt = 0;
@@ -57,12 +59,24 @@ public:
         return m_rowidMap != NULL;
     }
 
-    /* 新建的表必须先申请一个 segment, 返回 segment 页号 */
-    uint32 CreateSegment();
+    /*
+     * 新建的表必须先申请一个 segment, 返回 segment 页号。leafExtent 为 leaf page 的大小，会按行长调整到可用的大小；
+     * adaptive 为 true 时表先用小 extent，写满几个页面后再用 leafExtent。
+     */
+    uint32 CreateSegment(ExtentSizeType leafExtent = HEAP_EXTENT_SIZE, bool adaptive = false);
 
     /* 已经建好的表，重启之后需要 mount segment，传参的是 segment 页号 */
     void Mount(uint32 seghead);
 
+    /*
+     * 换上一个空 segment 来清空表，O(1)。表目录中的映射随事务原子切换：
+     * 提交后旧 segment 在后台回收，回滚时切回旧 segment。新 segment 的 generation 加一，旧的索引项随之失效，
+     * 提交后由 PurgeStaleIndexes 在后台删除。
+     * 调用者需独占该表（如持有 AccessExclusiveLock）。
+     * undo 写不下时返回 false，表不变，事务进入 TX_WAIT_ABORT。
+     */
+    bool Truncate(Transaction *trx);
+
     uint32 SegmentHead()
     {
         return m_seghead;
@@ -107,11 +121,22 @@ public:
         }
     }
 
+    /* 重启前未删完的旧 generation 索引项在挂载索引时重新登记删除 */
     void AddIndex(NVMIndex *i)
     {
+        i->SetGeneration(m_generation);
+        i->PurgeStaleGenerations();
         index.push_back(i);
     }
 
+    /* truncate 提交后调用，后台删除所有索引中早于当前 generation 的索引项 */
+    void PurgeStaleIndexes()
+    {
+        for (NVMIndex *i : index) {
+            i->PurgeStaleGenerations();
+        }
+    }
+
     NVMIndex *DelIndex(TableId id)
     {
         NVMIndex *ret = nullptr;
@@ -172,6 +197,7 @@ private:
 
     TableId m_tableId{0};
     uint32 m_seghead{0};
+    uint32 m_generation{0};
     TableDesc m_desc;
     std::vector<NVMDB::NVMIndex *> index;
     std::atomic<uint32> refCount{0};
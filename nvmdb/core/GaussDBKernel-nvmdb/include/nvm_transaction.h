@@ -33,6 +33,8 @@
 
 namespace NVMDB {
 
+class Table;
+
 enum TransactionStatus {
     TX_EMPTY,
     TX_IN_PROGRESS,
@@ -112,28 +114,44 @@ public:
         return min_snapshot;
     }
 
+    /* 快照因超过 undo 保留上限被回收线程作废，之后不能再读旧版本 */
+    bool SnapshotTooOld();
+
+    /* undo 写不下时返回 InvalidUndoRecPtr，事务进入 TX_WAIT_ABORT，调用者不能再修改数据 */
     UndoRecPtr InsertUndoRecord(UndoRecord *record)
     {
-        return undo_trx->InsertUndoRecord(record);
+        UndoRecPtr undo = undo_trx->InsertUndoRecord(record);
+        if (UndoRecPtrIsInValid(undo)) {
+            WaitAbort();
+        }
+        return undo;
     }
 
     TM_Result VersionIsVisible(NVMTuple *tuple);
     TM_Result SatisifiedUpdate(NVMTuple *tuple);
 
-    void PushWriteSet(RowIdMapEntry *row)
+    void PushWriteSet(const RowIdMapEntry &row)
     {
         write_set.push_back(row);
     }
+
+    /* 被 truncate 换下的旧 segment：提交后回收，回滚时挂回 table */
+    void PushTruncatedTable(Table *table, uint32 old_seghead)
+    {
+        truncated_tables.push_back({table, old_seghead});
+    }
 private:
     constexpr static uint32 INVALID_PROC_ARRAY_INDEX = 0xffffffff;
     uint32 local_proc_array_idx{INVALID_PROC_ARRAY_INDEX};
     TransactionSlotPtr trx_slot_ptr;
     UndoTrxContext *undo_trx;
     uint64 snapshot;
+    uint64 snapshot_seq{0};
     uint64 csn;
     uint64 min_snapshot;  // 后台线程检测出来的所以事务中最小的 snapshot，
     TransactionStatus tx_status;
-    std::vector<RowIdMapEntry *> write_set;
+    std::vector<RowIdMapEntry> write_set;
+    std::vector<std::pair<Table *, uint32>> truncated_tables;
 
     void InstallSnapshot();
     void UninstallSnapshot();
@@ -145,6 +163,12 @@ Transaction *GetCurrentTrxContext();
 
 uint64 GetMinSnapshot();
 
+/*
+ * 作废持有过久的快照，作废后它们不再拖住 undo 回收：max_age_us 不为 0 时作废建立早于这个时长的快照，
+ * expire_oldest 为 true 时再作废当前最老的快照。返回作废的个数，只由回收线程调用。
+ */
+uint32 ExpireSnapshots(uint64 max_age_us, bool expire_oldest);
+
 void RecoveryCSN(const uint64 &max_undo_csn);
 
 void InitGlobalProcArray();
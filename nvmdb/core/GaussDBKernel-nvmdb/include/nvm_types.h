@@ -42,9 +42,10 @@ static const size_t MAX_TUPLE_LEN = 8192;
 typedef uint64 PointerOffset;
 typedef uint32 BlockNumber;
 
-typedef uint32 RowId;
-static const RowId InvalidRowId = 0xFFFFFFFF;
-static const RowId MaxRowId = InvalidRowId - 1;
+/* RowId 要能放进 FDW 的 ctid（6 个字节，offset number 不能为 0），有效位数限制在 47 位 */
+typedef uint64 RowId;
+static const RowId InvalidRowId = 0xFFFFFFFFFFFFFFFF;
+static const RowId MaxRowId = (1LLU << 47) - 1;
 #define RowIdIsValid(x) ((x) != InvalidRowId)
 
 typedef uint32 TableId;
@@ -54,6 +55,7 @@ static const uint32 InvalidColId = 0xFFFFFFFF;
 
 static const uint32 BIS_PER_BYTE = 8;
 static const uint32 BIS_PER_U32 = BIS_PER_BYTE * sizeof(uint32);
+static const uint32 BIS_PER_U64 = BIS_PER_BYTE * sizeof(uint64);
 }  // namespace NVMDB
 
 #endif // NVMDB_TYPES_H
\ No newline at end of file
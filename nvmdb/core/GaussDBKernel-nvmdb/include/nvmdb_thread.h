@@ -28,6 +28,7 @@
 namespace NVMDB {
 
 struct ThreadLocalTableCache {
+    uint64 m_epoch{0}; /* 建立时 segment 的 epoch */
     RowIdCache m_rowidCache;
     VecRange m_range;
 };
@@ -37,7 +38,7 @@ struct ThreadLocalStorage {
     int groupId;
 };
 
-ThreadLocalTableCache *GetThreadLocalTableCache(TableId tid);
+ThreadLocalTableCache *GetThreadLocalTableCache(uint32 seghead, uint64 epoch);
 int GetCurrentGroupId();
 void InitGlobalThreadStorageMgr();
 void InitThreadLocalStorage();
@@ -25,6 +25,7 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <atomic>
 #include <unistd.h>
 
 #include "nvm_types.h"
@@ -42,6 +43,39 @@ extern uint32 g_dirPathNum;
 void ParseDirectoryConfig(const char *dir_names, bool is_init = false, uint32 &_dir_path_num = g_dirPathNum,
                           std::vector<std::string> &_dir_paths = g_dirPaths);
 
+/* slice 映射之后如何建立页表 */
+enum MMapPrefault {
+    MMAP_PREFAULT_NONE,  /* 首次访问时缺页 */
+    MMAP_PREFAULT_SYNC,  /* 映射时同步建立整个 slice 的页表 */
+    MMAP_PREFAULT_ASYNC, /* 交给后台线程按 2MB 逐段建立 */
+};
+
+/* 访问模式，映射后通过 madvise 告知内核 */
+enum MMapAccessPattern {
+    MMAP_ACCESS_NORMAL,
+    MMAP_ACCESS_SEQUENTIAL,
+    MMAP_ACCESS_RANDOM,
+};
+
+struct MMapOptions {
+    MMapPrefault m_prefault;
+    MMapAccessPattern m_access;
+    bool m_hugePage; /* 申请透明大页；pmem_map_file 本身已按 2MB/1GB 对齐映射地址 */
+};
+
+static const MMapOptions DEFAULT_MMAP_OPTIONS = {MMAP_PREFAULT_NONE, MMAP_ACCESS_NORMAL, false};
+
+/* slice 映射相关的统计，缺页数为整个进程的累计值 */
+struct MMapStat {
+    uint64 m_mappedSlices;
+    uint64 m_prefaultedBytes;
+    uint64 m_pendingPrefaults; /* 等待后台预取的 slice 数 */
+    uint64 m_minorFaults;
+    uint64 m_majorFaults;
+};
+
+void GetMMapStat(MMapStat *stat);
+
 /*
  *  一个逻辑上的大文件，向外展示连续的页号；给定一个页号会翻译成对应的虚拟地址。
  *  内部实现会切成多个slice，每个slice是一个物理文件，mmap到虚拟地址空间中。支持不同长度的slice。
@@ -55,44 +89,44 @@ public:
     size_t MAX_SLICE_NUM;
     size_t SLICE_BLOCKS;
 
-    /*  slice_addr 数组初始化的时候就设够足够大，否则当数组扩展的时候，会影响并发的读 */
-    LogicFile(const char *dir, const char *name, size_t slice_len, size_t max_slice_num)
-        : m_spcname(name), SLICE_LEN(slice_len), MAX_SLICE_NUM(max_slice_num), SLICE_BLOCKS(slice_len / NVM_BLCKSZ)
+    /*
+     * slice 地址表分两级：目录按 MAX_SLICE_NUM 一次分配好，每 SLICE_CHUNK_LEN 个 slice 一个 chunk，
+     * 用到时才分配。chunk 一旦发布就不再移动或释放，读者无需加锁。
+     */
+    LogicFile(const char *dir, const char *name, size_t slice_len, size_t max_slice_num,
+              const MMapOptions &mmap_options = DEFAULT_MMAP_OPTIONS)
+        : m_spcname(name), SLICE_LEN(slice_len), MAX_SLICE_NUM(max_slice_num), SLICE_BLOCKS(slice_len / NVM_BLCKSZ),
+          m_mmapOptions(mmap_options)
     {
         ParseDirectoryConfig(dir, false, m_dirPathNum, m_dirPaths);
-        m_sliceAddr.reserve(max_slice_num);
+        m_sliceDirLen = (max_slice_num + SLICE_CHUNK_LEN - 1) >> SLICE_CHUNK_SHIFT;
+        m_sliceDir = new std::atomic<std::atomic<char *> *>[m_sliceDirLen]();
+    }
+
+    virtual ~LogicFile()
+    {
+        for (uint32 i = 0; i < m_sliceDirLen; i++) {
+            delete[] m_sliceDir[i].load();
+        }
+        delete[] m_sliceDir;
     }
 
+    /* 已存在的 slice 个数，不要求都已映射 */
     uint32 SliceNumber()
     {
-        return m_sliceAddr.size();
+        return m_sliceNum.load(std::memory_order_acquire);
     }
 
     virtual void Create()
     {
-        Assert(m_sliceAddr.size() == 0);
+        Assert(SliceNumber() == 0);
         MMapFile(0, true);
     }
 
-    virtual void Mount()
-    {
-        bool exist = true;
-        for (int i = 0; i < MAX_SLICE_NUM; i++) {
-            exist = MMapFile(i, false);
-            if (!exist) {
-                break;
-            }
-        }
-        MMapFile(0, false);
-    }
+    /* 只映射 slice 0，其余 slice 在首次访问时映射（异步预取时由后台线程提前映射） */
+    virtual void Mount();
 
-    virtual void UnMount()
-    {
-        for (uint32 i = 0; i < m_sliceAddr.size(); i++) {
-            UMMapFile(i);
-        }
-        m_sliceAddr.clear();
-    }
+    virtual void UnMount();
 
     void extend(uint32 pageno)
     {
@@ -119,25 +153,59 @@ public:
         return (char *)(RelpointOfPageno(blkno) + (ptr % NVM_BLCKSZ));
     }
 
-    /* 语法糖，页号的虚拟地址 */
+    /* 语法糖，页号的虚拟地址；slice 已映射时无锁 */
     char *RelpointOfPageno(uint32 blkno)
     {
         uint32 sliceno = blkno / SLICE_BLOCKS;
-        Assert(sliceno < m_sliceAddr.size() && m_sliceAddr[sliceno] != nullptr);
-        return m_sliceAddr[sliceno] + ((uint64)(blkno % SLICE_BLOCKS) * NVM_BLCKSZ);
+        Assert(sliceno < MAX_SLICE_NUM);
+        char *addr = SliceAddr(sliceno);
+        if (unlikely(addr == nullptr)) {
+            addr = MapSliceOnDemand(sliceno);
+        }
+        return addr + ((uint64)(blkno % SLICE_BLOCKS) * NVM_BLCKSZ);
     }
+
+    /* slice 的映射地址，未映射时返回 NULL */
+    inline char *SliceAddr(uint32 sliceno)
+    {
+        std::atomic<char *> *chunk = m_sliceDir[sliceno >> SLICE_CHUNK_SHIFT].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        return chunk[sliceno & (SLICE_CHUNK_LEN - 1)].load(std::memory_order_acquire);
+    }
+
+    /* 后台线程调用：逐段建立 slice 的页表，slice 被解除映射或者取消时提前结束 */
+    void PrefaultSlice(uint32 sliceno);
+
 protected:
     std::string m_spcname;
-    std::vector<char *> m_sliceAddr;
+    static constexpr uint32 SLICE_CHUNK_SHIFT = 6;
+    static constexpr uint32 SLICE_CHUNK_LEN = 1U << SLICE_CHUNK_SHIFT;
+
+    std::atomic<std::atomic<char *> *> *m_sliceDir;
+    uint32 m_sliceDirLen;
+    std::atomic<uint32> m_sliceNum{0};
     std::mutex m_spcMtx;
 
     uint32 m_dirPathNum;
     std::vector<std::string> m_dirPaths;
 
-    bool MMapFile(uint32 sliceno, bool create);
+    MMapOptions m_mmapOptions;
+    std::atomic<bool> m_prefaultCanceled{false};
+
+    bool MMapFile(uint32 sliceno, bool create, bool submitPrefault = true);
     void UMMapFile(uint32 sliceno, bool destroy = false);
 
+    /* 丢弃本文件尚未完成的后台预取，并等待正在进行的预取退出 */
+    void CancelPrefault();
+
 private:
+    void AdviseSlice(char *addr);
+    char *MapSliceOnDemand(uint32 sliceno);
+    /* 需持有 m_spcMtx */
+    void SetSliceAddr(uint32 sliceno, char *addr);
+
     inline std::string GetFilename(int sliceno)
     {
         return m_dirPaths[sliceno % m_dirPathNum] + "/" + m_spcname + '.' + std::to_string(sliceno);
@@ -25,7 +25,9 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 
+#include "nvm_cfg.h"
 #include "nvm_types.h"
 #include "nvm_block.h"
 #include "nvm_utils.h"
@@ -40,6 +42,9 @@ struct TableSegMetaData {
 
 /* mmap 之后，core dump中读不到mmap中的数据 */
 
+/* heap 页面随机访问；重启后由后台线程预取页表，避免首次访问的缺页落在前台 */
+static const MMapOptions HEAP_MMAP_OPTIONS = {MMAP_PREFAULT_ASYNC, MMAP_ACCESS_RANDOM, true};
+
 /* 第一个page为tablespace元数据页面，第二个页面为应用根页面 */
 class TableSpace : public LogicFile {
     /* 存在元数据页中 */
@@ -57,20 +62,80 @@ class TableSpace : public LogicFile {
         FreeBlockLists m_freeBlockLists[EXTSZ_TYPE_NUM];
     } SpaceMetaData;
 
+    /*
+     * oid -> seghead 的持久化哈希目录，存放在 1 号 page。
+     * 目录由若干层开放寻址哈希表组成，每层占一个 2M extent；某层探测窗口内无空位时写入下一层，
+     * 层只增不减，因此无需 rehash。每个槽位 8 字节，以单次原子写更新，读者无锁。
+     */
+    static const uint32 TABLE_CATALOG_MAGIC = 0x4E564354; /* "NVCT" */
+    static const uint32 TABLE_CATALOG_MAX_LEVEL = 16;
+    static const uint32 TABLE_CATALOG_PROBE_LEN = 64;
+    /* 已删除槽位，seghead 为非法值，oid 不会命中任何查找 */
+    static const uint32 TABLE_CATALOG_DELETED_OID = 0xFFFFFFFF;
+
     typedef struct TableMetaData {
-        uint32 m_tableNum;
-        TableSegMetaData m_segheads[0];
+        uint32 m_magic;
+        uint32 m_levelNum;
+        uint32 m_levels[TABLE_CATALOG_MAX_LEVEL];
     } TableMetaData;
 
     void FblInit(ExtentSizeType extsz, uint32 spaceno);
-    /* TD: ensure atomic of insert and pop */
+    /* 调用者需持有 m_fblMtx[spaceno][extsz] */
     void FblInsert(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno);
-    void FblInsertList(ExtentSizeType extsz, uint32 *seghead);
     bool FblPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno);
+    /* 加锁版本，空链表时无锁快速返回 */
+    void FblLockedInsert(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno);
+    bool FblLockedPop(ExtentSizeType extsz, uint32 *ptr, uint32 spaceno);
+    bool FblIsEmpty(ExtentSizeType extsz, uint32 spaceno)
+    {
+        FreeBlockLists *fbl = &m_spaceMetadata[spaceno].m_freeBlockLists[extsz];
+        return __atomic_load_n(&fbl->m_root, __ATOMIC_ACQUIRE) == NVMInvalidBlockNumber;
+    }
+
+    /*
+     * 待回收 segment 队列，存放在 0 号 page 中 SpaceMetaData 之后。每项 8 字节原子更新，
+     * seghead 为非法值表示空闲；oid 为 TABLE_CATALOG_DELETED_OID 表示没有需要删除的表目录项。
+     */
+    static const uint32 RECLAIM_QUEUE_OFFSET = 512;
+    static const uint32 RECLAIM_QUEUE_LEN = (NVM_BLCKSZ - RECLAIM_QUEUE_OFFSET) / sizeof(TableSegMetaData);
+
+    typedef struct ReclaimQueue {
+        TableSegMetaData m_items[RECLAIM_QUEUE_LEN];
+    } ReclaimQueue;
 
     /* 存在第一个 page 中, TableSpace结构体存指向它的虚拟地址的指针 */
     SpaceMetaData *m_spaceMetadata;
     TableMetaData *m_tableMetadata;
+    ReclaimQueue *m_reclaimQueue;
+
+    /*
+     * 锁按 (space, extent size) 拆分：不同目录、不同大小的 extent 分配互不阻塞。
+     * 加锁顺序固定为 m_hwmMtx -> m_fblMtx，避免死锁。
+     */
+    std::mutex m_hwmMtx[NVMDB_MAX_GROUP];
+    std::mutex m_fblMtx[NVMDB_MAX_GROUP][EXTSZ_TYPE_NUM];
+    std::mutex m_catalogMtx;
+    std::mutex m_reclaimMtx;
+    std::condition_variable m_reclaimCv; /* 队列有槽位被清除 */
+
+    static uint32 CatalogLevelCapacity()
+    {
+        return PageContentSize(EXTSZ_2M) / sizeof(TableSegMetaData);
+    }
+    static uint32 CatalogHash(uint32 oid)
+    {
+        return oid * 0x9E3779B1U;
+    }
+    TableSegMetaData *CatalogLevel(uint32 level)
+    {
+        return reinterpret_cast<TableSegMetaData *>(PageGetContent(RelpointOfPageno(m_tableMetadata->m_levels[level])));
+    }
+    /* 找到 oid 对应的有效槽位并返回其内容，找不到返回 nullptr */
+    TableSegMetaData *CatalogLookup(uint32 oid, TableSegMetaData *value);
+    /* 在第 level 层为 oid 找一个空槽或已删除槽 */
+    TableSegMetaData *CatalogFreeSlot(uint32 level, uint32 oid);
+    void CatalogAddLevel();
+    void CatalogStore(TableSegMetaData *slot, const TableSegMetaData &value);
 
     /* 最后一个slice剩余的blocks数目 */
     uint32 CurrentSliceRestBlocks(uint32 spaceno)
@@ -85,7 +150,8 @@ public:
     static const size_t HEAP_SPACE_MAX_SLICE_NUM = 16 * 1024; /* 实际中最多16TB */
 
     /*  slice_addr 数组初始化的时候就设够足够大，否则当数组扩展的时候，会影响并发的读 */
-    TableSpace(const char *dir, const char *name) : LogicFile(dir, name, HEAP_SPACE_SLICE_LEN, HEAP_SPACE_MAX_SLICE_NUM)
+    TableSpace(const char *dir, const char *name)
+        : LogicFile(dir, name, HEAP_SPACE_SLICE_LEN, HEAP_SPACE_MAX_SLICE_NUM, HEAP_MMAP_OPTIONS)
     {}
 
     uint32 high_water_mark(uint32 spaceno = 0)
@@ -132,13 +198,39 @@ public:
     /* *ptr 对应一个segment 的root，回收整个 segment，并且置 *ptr 为NULL */
     void FreeSegment(uint32 *ptr);
 
-    /* 将存储oid->表地址的映射写入表空间的1号page */
+    /*
+     * 从 segment 尾部最多回收 maxExtents 个 extent，每个 extent 单独加锁归还，不会长时间阻塞分配。
+     * 只剩 segment head 时返回 true，head 需调用者另行 FreeExtent。
+     */
+    bool FreeSegmentChunk(uint32 seghead, uint32 maxExtents);
+
+    /*
+     * 持久化地登记一个待回收 segment，登记成功后才删除 oid 的表目录项（如指定）；返回槽位号。
+     * 队列满时等待后台回收清出槽位，segment 在任何时刻都可从表目录或队列中找到。
+     */
+    int ReclaimEnqueue(uint32 seghead, uint32 oid = TABLE_CATALOG_DELETED_OID);
+
+    static uint32 ReclaimQueueCapacity()
+    {
+        return RECLAIM_QUEUE_LEN;
+    }
+
+    /* 回收完成（只剩 head）时清除槽位 */
+    void ReclaimDone(int slot);
+
+    /* 重启后取出所有未完成的回收任务，补做未完成的表目录删除 */
+    void ReclaimPending(std::vector<std::pair<int, uint32>> *pending);
+
+    /* 将 oid->表地址的映射写入表目录 */
     void CreateTable(const TableSegMetaData &oid2Seg);
 
-    /* 根据oid在表空间中寻找表地址 */
+    /* 根据oid在表目录中寻找表地址，不加锁；找不到返回 NVMInvalidBlockNumber */
     uint32 SearchTable(uint32 oid);
 
-    /* 根据表地址将drop的表数据从表空间中删除 */
+    /* 原子地把 oid 指向新的 segment；oid 不存在时返回 false */
+    bool UpdateTable(uint32 oid, uint32 seg);
+
+    /* 将drop的表从表目录中删除 */
     void DropTable(uint32 oid);
 };
 
@@ -34,11 +34,20 @@ void UndoCreate(const char *dir);
 /* 数据库启动时调用，初始化基本信息，启动清理线程。 */
 void UndoBootStrap(const char *dir);
 
+/*
+ * UndoBootStrap 拆成的两步：UndoMount 只读 undo 文件，可以和 heap、索引的挂载并行；
+ * UndoStartRecovery 启动后台回滚，回滚要访问 heap 和索引，需在二者挂载完成后调用。
+ */
+void UndoMount(const char *dir);
+void UndoStartRecovery();
+
 /* 事务启动时调用，绑定事务的 undo context；事务执行过程中通过UndoLocalContext插入undo日志 */
 UndoTrxContext *AllocUndoContext();
 
 /* 根据 undo ptr 获得具体的 undo record */
 extern UndoRecord *CopyUndoRecord(UndoRecPtr ptr, char* undo_record_cache);
+/* 同上，但尽量不拷贝，直接返回 NVM 上的记录，调用者不能修改 */
+extern UndoRecord *GetUndoRecord(UndoRecPtr ptr, char* undo_record_cache);
 
 /* 事务结束时（完成提交或者回滚）,把对应undo页面标记位待回收的状态。 */
 void ReleaseTrxUndoContext(UndoTrxContext* undo_trx);
@@ -32,6 +32,7 @@ class UndoTrxContext {
     uint64 trxslot_id;
     TransactionSlot *trxslot;
     UndoSegment *undo_segment;
+    UndoRecPtr m_end{InvalidUndoRecPtr}; /* 事务的最后一条 undo，事务结束时才写回 trxslot->end */
 public:
     UndoTrxContext(UndoSegment *_undo_segment, uint32 _trxslot_id)
         : trxslot_id(_trxslot_id), undo_segment(_undo_segment)
@@ -49,14 +50,28 @@ public:
         trxslot->status = status;
     }
 
+    UndoSegment *BoundSegment()
+    {
+        return undo_segment;
+    }
+
     TransactionSlotPtr GetTrxSlotLocation()
     {
         return GenerateTrxSlotPtr(undo_segment->MyId(), trxslot_id);
     }
 
     UndoRecPtr InsertUndoRecord(UndoRecord *record);
+
+    /* 提交、回滚之前调用，之后事务槽上的 start/end 才完整 */
+    void PublishUndo()
+    {
+        trxslot->end = m_end;
+        undo_segment->PublishFreeBegin();
+    }
+
     inline void RollBack(char* undo_record_cache)
     {
+        PublishUndo();
         undo_segment->RollBack(trxslot, undo_record_cache);
     }
 };
@@ -34,8 +34,9 @@ typedef struct UndoRecord {
     uint16 m_rowLen; // row length
     uint16 m_deltaLen; // total delta data length
     uint32 m_seghead; // tuple 对应的 segment head
-    RowId m_rowId;
     uint32 m_payload; // undo 数据长度
+    uint32 m_checksum; // 整条记录（不含本字段）的校验和，恢复时据此判断记录是否完整落盘
+    RowId m_rowId;
     UndoRecPtr m_pre;
 #ifndef NDEBUG
     uint32 m_trxSlot;
@@ -47,6 +48,7 @@ typedef struct UndoRecord {
 static const int UndoRecHeadSize = sizeof(UndoRecord);
 
 UndoRecord *CopyUndoRecord(UndoRecPtr ptr, char* undo_record_cache);
+UndoRecord *GetUndoRecord(UndoRecPtr ptr, char* undo_record_cache);
 
 enum UndoRecordType {
     InvalidUndoRecordType = 0,
@@ -57,14 +59,19 @@ enum UndoRecordType {
     IndexInsertUndo,
     IndexDeleteUndo,
 
+    TableTruncateUndo,
+
     MaxUndoRecordType,
 };
 
-static inline int UndoRecTotalSize(uint32 len)
+static inline uint32 UndoRecTotalSize(uint32 len)
 {
     return len + UndoRecHeadSize;
 }
 
+/* 计算 record 的校验和，跳过 m_checksum 本身；record 需按 8 字节对齐 */
+uint32 UndoRecChecksum(const UndoRecord *record);
+
 static inline bool UndoRecordTypeIsValid(UndoRecordType type)
 {
     return type > InvalidUndoRecordType && type < MaxUndoRecordType;
@@ -26,7 +26,21 @@
 
 namespace NVMDB {
 
-void UndoRecordRollBack(UndoRecord *record);
+class RowIdMap;
+
+/* 一个事务回滚过程中在 undo 记录之间复用的状态；同一事务的记录大多落在同一张表上 */
+struct UndoReplayContext {
+    uint32 m_seghead{0};
+    RowIdMap *m_rowidMap{nullptr};
+};
+
+void UndoRecordRollBack(UndoRecord *record, UndoReplayContext *context);
+
+/*
+ * 大事务按 lane 并行回滚：lane 相同的记录按写入的逆序回放，不同 lane 之间互不影响。
+ * 返回 false 的记录是屏障，比它晚的记录全部回放完才能回放它，比它早的记录要等它回放完。
+ */
+bool UndoRecordRollBackLane(UndoRecord *record, uint64 *lane);
 
 }
 
@@ -36,8 +36,16 @@ namespace NVMDB {
 
 static const int UNDO_TRX_SLOTS = CompileValue(512 * 1024, 8 * 1024);
 static const size_t UNDO_SLICE_SIZE = CompileValue(64 * 1024 * 1024, 1024 * 1024);
-static const size_t UNDO_MAX_SLICE_NUM = 16;
-static const size_t UNDO_MAX_OFFSET = 1llu << 40;
+/*
+ * undo 偏移只增不减，是逻辑偏移。slice 0 存放 segment 头，之后的逻辑 slice 按取模映射到 UNDO_RING_SLICES 个
+ * 物理 slice 上循环使用：回收后原地复用，不再删除、重建文件。
+ */
+static const size_t UNDO_RING_SLICES = CompileValue(256, 32);
+static const size_t UNDO_MAX_SLICE_NUM = 1 + UNDO_RING_SLICES;
+/* undo 追加写到 NVM 的对齐粒度，与 NVM 介质内部的写单元一致 */
+static const uint32 UNDO_CHUNK_SIZE = 256;
+static const uint32 UNDO_LINE_SIZE = 64;
+static_assert(NVM_BLCKSZ % UNDO_CHUNK_SIZE == 0, "undo chunk must not cross a block");
 
 /*
  * 前16位， segment id,  后48位，segment 内 trx slot id
@@ -87,25 +95,73 @@ static inline uint64 TrxSlotPtrGetTrxId(TransactionSlotPtr ptr)
     return ptr & TSP_SLOT_ID_MASK;
 }
 
+/* undo 写入 NVM 的统计：记录本身的字节数、实际写到 NVM 的字节数和等待落盘的次数 */
+struct UndoWriteStat {
+    uint64 m_records;
+    uint64 m_recordBytes;
+    uint64 m_nvmBytes;
+    uint64 m_drains;
+};
+
+/* undo 回收的滞后情况，每一轮回收结束时更新 */
+struct UndoRecycleStat {
+    uint32 m_workers;         /* 最近一轮的回收线程数 */
+    uint32 m_peakWorkers;
+    uint64 m_passes;
+    uint64 m_lagSlots;        /* 尚未回收的事务槽数 */
+    uint64 m_lagBytes;        /* 尚未回收的 undo 字节数 */
+    uint64 m_oldestSlotAgeUs; /* 最老的未回收事务槽从成为最老起已等待的时间 */
+    uint64 m_heldBytes;       /* 其中最老的事务已提交、因快照不能回收的 undo 字节数 */
+    uint64 m_expiredSnapshots; /* 因超过保留上限作废的快照数，累计值 */
+};
+
 class UndoSegment : public LogicFile {
     uint32 segid;
     UndoSegmentHead *seghead; /* pointer to segment head, note that it's non-volatile */
     std::string filename;
     std::mutex mtx;
 
+    /* 只在 DRAM 中，由回收线程维护：当前最老的未回收事务槽，以及从何时起它是最老的 */
+    uint64 m_lagSlot{0};
+    uint64 m_lagSinceUs{0};
+
+    /*
+     * 写入端的 DRAM 状态，只由绑定该 segment 的线程修改。m_freeBegin 是真正的追加位置，seghead->free_begin 和
+     * 事务槽的 end 只在事务结束时更新；m_tail 是追加位置所在 256 字节块的副本，追加时只把新写入的 cache line
+     * 从这里整行写回 NVM。
+     */
+    std::atomic<uint64> m_freeBegin{0};
+    char m_tail[UNDO_CHUNK_SIZE];
+    bool m_tailLoaded{false};
+    UndoWriteStat m_writeStat{};
+
+    void LoadTailChunk();
+    void AppendToTail(uint64 vptr, const char *src, uint32 len);
+    /* 宕机时事务槽的 end 可能落后，沿 m_pre 接得上的记录向后找到最后一条，返回其后的偏移 */
+    uint64 RecoverTrxSlotEnd(TransactionSlot *trx_slot);
+
     bool trxslot_is_full();
     bool trxslot_is_empty();
     static bool trxslot_is_available(TransactionSlot *trx_slot);
     static bool trxslot_is_recyclable(TransactionSlot *trx_slot, uint64 min_csn);
 
-    void write_to_slice(uint64 vptr, char *src, int len);
-    void copy_from_slice(uint64 vptr, char *dst, int len);
+    /* 逻辑偏移对应的物理页号 */
+    static uint32 PhysicalPageno(uint64 vptr);
+    /* 环上还没有被回收的逻辑 slice 数 */
+    uint64 RingUsedSlices(uint64 end);
+    /* 返回 false 表示本事务的 undo 已经占满整个环 */
+    bool WaitRingSpace(uint64 end);
+
+    void copy_from_slice(uint64 vptr, char *dst, uint32 len);
 
     /* Return false means the transaction slot is recycled */
     bool GetTransactionSlot(uint64 slot_id, TransactionSlot* trx_slot);
 
     void RecycleUndoPages(const uint64& begin_slot, const uint64& end_slot);
 
+    /* 沿 m_pre 读出事务的 undo，按 lane 分给多个线程并行回放 */
+    void BatchRollBack(TransactionSlot* trx_slot, uint32 workers, char* undo_record_cache);
+
 public:
     UndoSegment(const char *dir, uint32 segment_id);
 
@@ -113,13 +169,16 @@ public:
 
     void Recovery(uint64& max_undo_csn);
 
-    void BGRecovery();
+    /* 回滚 Recovery 中发现的未完成事务，返回回滚的事务数 */
+    uint32 BGRecovery();
 
     void Create() override
     {
         LogicFile::Create();
         seghead = (UndoSegmentHead *)RelpointOfPageno(0);
         UndoSegmentInitHead(seghead);
+        m_freeBegin = seghead->free_begin;
+        m_tailLoaded = false;
     }
 
     void Mount() override
@@ -127,6 +186,8 @@ public:
         LogicFile::Mount();
         Assert(SliceNumber() > 0);
         seghead = (UndoSegmentHead *)RelpointOfPageno(0);
+        m_freeBegin = seghead->free_begin;
+        m_tailLoaded = false;
     }
 
     uint32 MyId() const
@@ -137,6 +198,26 @@ public:
     bool SegmentFull();
     bool SegmentEmpty();
 
+    /* 下一条 undo 的逻辑偏移 */
+    uint64 UndoFreeBegin() const
+    {
+        return m_freeBegin.load(std::memory_order_relaxed);
+    }
+
+    /* 事务结束时把追加位置写回 segment 头 */
+    void PublishFreeBegin()
+    {
+        seghead->free_begin = m_freeBegin.load(std::memory_order_relaxed);
+    }
+
+    void AccumulateWriteStat(UndoWriteStat *stat) const
+    {
+        stat->m_records += m_writeStat.m_records;
+        stat->m_recordBytes += m_writeStat.m_recordBytes;
+        stat->m_nvmBytes += m_writeStat.m_nvmBytes;
+        stat->m_drains += m_writeStat.m_drains;
+    }
+
     uint64 GetNextTrxSlot();
     inline void AdvanceTrxSlot()
     {
@@ -146,25 +227,67 @@ public:
     /* Return false means the transaction slot is recycled */
     bool GetTransactionInfo(uint64 slot_id, TransactionInfo *trx_info);
 
+    bool TrxSlotRecycled(uint64 slot_id) const
+    {
+        return slot_id < seghead->min_slot_id.load(std::memory_order_acquire);
+    }
+
     TransactionSlot *GetTransactionSlot(uint64 slot_id);
 
-    /* Any transaction with csn smaller than min_csn can be recycled */
-    void RecycleTransactionSlot(uint64 min_csn);
+    /* Any transaction with csn smaller than min_csn can be recycled; return false if nothing recycled */
+    bool RecycleTransactionSlot(uint64 min_csn);
+
+    /* 把本 segment 的回收滞后累加到 stat 中，只由回收线程调用 */
+    void AccumulateRecycleLag(uint64 now_us, UndoRecycleStat *stat);
 
+    /* 本事务的 undo 超过整个环时返回 InvalidUndoRecPtr，事务只能回滚 */
     UndoRecPtr InsertUndoRecord(UndoRecord *record);
     UndoRecord *CopyUndoRecord(UndoRecPtr undo, char* undo_record_cache);
+    /* 记录不跨 slice 时直接返回 NVM 上的地址，否则拷贝到 undo_record_cache；返回的记录只读 */
+    UndoRecord *GetUndoRecord(UndoRecPtr undo, char* undo_record_cache);
 };
 
 void UndoSegmentCreate(const char *dir);
+/* 挂载所有 segment 并恢复 CSN；未完成事务由 UndoSegmentStartRecovery 启动的后台线程回滚 */
 void UndoSegmentMount(const char *dir);
+void UndoSegmentStartRecovery();
 void UndoSegmentUnmount();
-UndoSegment *PickSegmentForTrx();
-void SwitchUndoSegmentIfFull();
+
+/* 崩溃恢复的进度，m_pendingTrxs 为挂载时发现的未完成事务数 */
+struct UndoRecoveryProgress {
+    uint32 m_workers;
+    uint32 m_totalSegments;
+    uint32 m_doneSegments;
+    uint64 m_pendingTrxs;
+    uint64 m_rolledBackTrxs;
+    uint64 m_elapsedUs;
+    bool m_finished;
+};
+
+/* 设置崩溃恢复的并行度，需在 UndoSegmentMount 之前调用 */
+void SetUndoRecoveryWorkers(uint32 workers);
+/* 设置大事务回滚的最大并行度，0 表示取 NVMDB_UNDO_ROLLBACK_WORKER_NUM 和 CPU 数中较小的一个 */
+void SetUndoRollbackWorkers(uint32 workers);
+void GetUndoRecoveryProgress(UndoRecoveryProgress *progress);
+void GetUndoRecycleStat(UndoRecycleStat *stat);
+/* 设置 undo 保留上限，见 NVMDB_UNDO_RETENTION_AGE_MS 和 NVMDB_UNDO_RETENTION_BYTES，0 表示不限制 */
+void SetUndoRetention(uint64 max_age_ms, uint64 max_bytes);
+/* 汇总所有 segment 的写入统计，计数在重新挂载后清零 */
+void GetUndoWriteStat(UndoWriteStat *stat);
+/* 事务第一次写 undo 时从本线程所在目录的空闲 segment 中取一个未满的，事务结束时放回 */
+UndoSegment *AcquireUndoSegment();
+void ReleaseUndoSegment(UndoSegment *segment);
 bool GetTransactionInfo(TransactionSlotPtr trx_ptr, TransactionInfo *trx_info);
-UndoSegment *GetUndoSegment(int segid);
 
-void InitLocalUndoSegment();
-void DestroyLocalUndoSegment();
+/* GetTransactionInfo 线程本地缓存的命中统计，只统计当前线程 */
+struct TrxInfoCacheStat {
+    uint64 m_hits;
+    uint64 m_misses;
+};
+
+void GetTrxInfoCacheStat(TrxInfoCacheStat *stat);
+/* segment 的文件尚未创建时返回 NULL */
+UndoSegment *GetUndoSegment(int segid);
 
 }
 
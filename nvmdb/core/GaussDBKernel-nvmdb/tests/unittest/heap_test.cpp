@@ -21,6 +21,8 @@
  */
 #include <glog/logging.h>
 #include <gtest/gtest.h>  // googletest header file
+#include <map>
+#include <condition_variable>
 #include <thread>
 
 #include "nvm_dbcore.h"
@@ -28,6 +30,9 @@
 #include "nvm_transaction.h"
 #include "nvm_access.h"
 #include "nvmdb_thread.h"
+#include "nvm_heap_space.h"
+#include "index/nvm_index_access.h"
+#include "nvm_rowid_map.h"
 #include "test_declare.h"
 
 using namespace NVMDB;
@@ -668,4 +673,1260 @@ TEST_F(HeapTest, ConcurrentPressureTest)
     PressureScanAll(&table, &table_cnt, cnt_rowid, success_update);
 }
 
+TEST_F(HeapTest, TruncateTest)
+{
+    static const uint32 TABLE_OID = 100;
+    static const int ROW_NUM = 1000;
+    Table *table = new Table(TABLE_OID, row_len);
+    uint32 seghead = table->CreateSegment();
+    g_heapSpace->CreateTable(TableSegMetaData{TABLE_OID, seghead});
+
+    std::vector<RowId> rowids;
+    Transaction *trx = GetCurrentTrxContext();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        RAMTuple *tuple = GenRow(true, i, i);
+        rowids.push_back(HeapInsert(trx, table, tuple));
+        delete tuple;
+    }
+    trx->Commit();
+
+    /* 回滚的 truncate 不影响原有数据，同一事务中多次 truncate 也能正确回滚 */
+    trx->Begin();
+    table->Truncate(trx);
+    ASSERT_NE(table->SegmentHead(), seghead);
+    RAMTuple *tuple = GenRow(true, -1, -1);
+    HeapInsert(trx, table, tuple);
+    table->Truncate(trx);
+    HeapInsert(trx, table, tuple);
+    trx->Abort();
+    ASSERT_EQ(table->SegmentHead(), seghead);
+    ASSERT_EQ(g_heapSpace->SearchTable(TABLE_OID), seghead);
+
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(dstTuple, 0, i));
+    }
+    trx->Commit();
+
+    trx->Begin();
+    table->Truncate(trx);
+    RowId newRowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+    uint32 newSeghead = table->SegmentHead();
+    ASSERT_EQ(g_heapSpace->SearchTable(TABLE_OID), newSeghead);
+
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        if (rowids[i] != newRowid) {
+            ASSERT_NE(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        }
+    }
+    trx->Commit();
+
+    /* 重启后表目录指向新的 segment */
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    InitThreadLocalVariables();
+    ASSERT_EQ(g_heapSpace->SearchTable(TABLE_OID), newSeghead);
+    Table *mounted = new Table(TABLE_OID, row_len);
+    mounted->Mount(newSeghead);
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, mounted, newRowid, dstTuple), HAM_SUCCESS);
+    ASSERT_TRUE(dstTuple->EqualRow(tuple));
+    trx->Commit();
+
+    delete tuple;
+    delete dstTuple;
+}
+
+/* 索引项带着表的 generation，truncate 后旧索引项查不到，回滚和重启后查找结果仍然正确 */
+TEST_F(HeapTest, TruncateIndexTest)
+{
+    static const uint32 TABLE_OID = 102;
+    static const int ROW_NUM = 1000;
+    IndexColumnDesc indexDesc[] = {{0}};
+    uint64 indexLen = 0;
+    uint32 indexColCnt = 1;
+    InitIndexDesc(&indexDesc[0], &TestColDesc[0], indexColCnt, indexLen);
+    NVMIndex *index = new NVMIndex(1);
+    index->SetIndexDesc(&indexDesc[0], indexColCnt, indexLen);
+    Table *table = new Table(TABLE_OID, row_len);
+    table->AddIndex(index);
+    g_heapSpace->CreateTable(TableSegMetaData{TABLE_OID, table->CreateSegment()});
+
+    DRAMIndexTuple indexTuple(&TestColDesc[0], &indexDesc[0], indexColCnt, indexLen);
+    /* 第一列是索引列，取 [col2, col2 + ROW_NUM) */
+    auto insertRows = [&](Transaction *trx, int col2) {
+        for (int i = 0; i < ROW_NUM; i++) {
+            RAMTuple *tuple = GenRow(true, col2 + i, col2);
+            RowId rowid = HeapInsert(trx, table, tuple);
+            indexTuple.ExtractFromTuple(tuple);
+            IndexInsert(trx, index, &indexTuple, rowid);
+            delete tuple;
+        }
+    };
+    /* 扫描整个索引，返回查到的行数，每一行的第二列都必须是 col2 */
+    auto scanIndex = [&](Transaction *trx, int col2) {
+        int begin = 0;
+        int end = ROW_NUM * 2;
+        DRAMIndexTuple beginTuple(&TestColDesc[0], &indexDesc[0], indexColCnt, indexLen);
+        DRAMIndexTuple endTuple(&TestColDesc[0], &indexDesc[0], indexColCnt, indexLen);
+        beginTuple.SetCol(0, (char *)&begin);
+        endTuple.SetCol(0, (char *)&end);
+        RAMTuple *dstTuple = GenRow();
+        int found = 0;
+        trx->Begin();
+        NVMIndexIter *iter = index->GenerateIter(&beginTuple, &endTuple, GetIndexLookupSnapshot(trx), 0, false);
+        for (; iter->Valid(); iter->Next()) {
+            if (HeapRead(trx, table, iter->Curr(), dstTuple) == HAM_SUCCESS) {
+                EXPECT_TRUE(ColEqual(dstTuple, 1, col2));
+                found++;
+            }
+        }
+        delete iter;
+        trx->Commit();
+        delete dstTuple;
+        return found;
+    };
+
+    /* 数 generation 下的索引项个数，不管它们指向的行 */
+    auto countKeys = [&](Transaction *trx, uint32 generation, uint32 current) {
+        int begin = 0;
+        int end = ROW_NUM * 2;
+        DRAMIndexTuple beginTuple(&TestColDesc[0], &indexDesc[0], indexColCnt, indexLen);
+        DRAMIndexTuple endTuple(&TestColDesc[0], &indexDesc[0], indexColCnt, indexLen);
+        beginTuple.SetCol(0, (char *)&begin);
+        endTuple.SetCol(0, (char *)&end);
+        int found = 0;
+        index->SetGeneration(generation);
+        trx->Begin();
+        NVMIndexIter *iter = index->GenerateIter(&beginTuple, &endTuple, GetIndexLookupSnapshot(trx), 0, false);
+        for (; iter->Valid(); iter->Next()) {
+            found++;
+        }
+        delete iter;
+        trx->Commit();
+        index->SetGeneration(current);
+        return found;
+    };
+
+    Transaction *trx = GetCurrentTrxContext();
+    trx->Begin();
+    insertRows(trx, 1);
+    trx->Commit();
+
+    trx->Begin();
+    ASSERT_TRUE(table->Truncate(trx));
+    insertRows(trx, 2);
+    trx->Abort();
+    ASSERT_EQ(scanIndex(trx, 1), ROW_NUM);
+
+    /* 新 segment 复用同样的 RowId，旧索引项的 key 与新行不同，不能指向新插入的行 */
+    trx->Begin();
+    ASSERT_TRUE(table->Truncate(trx));
+    trx->Commit();
+    ASSERT_EQ(scanIndex(trx, 3), 0);
+    /* 提交后旧 generation 的索引项由后台物理删除 */
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (countKeys(trx, 0, 1) != 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(countKeys(trx, 0, 1), 0);
+    trx->Begin();
+    insertRows(trx, 3);
+    trx->Commit();
+    ASSERT_EQ(scanIndex(trx, 3), ROW_NUM);
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    InitThreadLocalVariables();
+    table->Mount(g_heapSpace->SearchTable(TABLE_OID));
+    trx = GetCurrentTrxContext();
+    ASSERT_EQ(scanIndex(trx, 3), ROW_NUM);
+}
+
+TEST_F(HeapTest, ShrinkTest)
+{
+    static const uint32 TABLE_OID = 101;
+    Table *table = new Table(TABLE_OID, row_len);
+    uint32 seghead = table->CreateSegment();
+    g_heapSpace->CreateTable(TableSegMetaData{TABLE_OID, seghead});
+
+    /* 只有一个 leaf page 时，upper rowid 即为每页的 tuple 数 */
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 0, 0);
+    trx->Begin();
+    std::vector<RowId> rowids{HeapInsert(trx, table, tuple)};
+    trx->Commit();
+    RowId tuplesPerPage = HeapUpperRowId(table);
+
+    trx->Begin();
+    while (rowids.size() < 2 * tuplesPerPage + 10) {
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+    ASSERT_EQ(HeapUpperRowId(table), 3 * tuplesPerPage);
+
+    /* 删除后两页的数据；删除未提交前页面不能归还 */
+    trx->Begin();
+    for (RowId rowid : rowids) {
+        if (rowid >= tuplesPerPage) {
+            ASSERT_EQ(HeapDelete(trx, table, rowid), HAM_SUCCESS);
+        }
+    }
+    ASSERT_EQ(HeapShrink(table), 0);
+    trx->Commit();
+
+    /* 与 VACUUM FULL 一样在新事务中执行，此时删除对所有快照可见 */
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    ASSERT_EQ(HeapShrink(table), 2);
+    ASSERT_EQ(HeapUpperRowId(table), tuplesPerPage);
+    ASSERT_EQ(HeapRead(trx, table, rowids[0], dstTuple), HAM_SUCCESS);
+    ASSERT_EQ(HeapRead(trx, table, rowids.back(), dstTuple), HAM_READ_ROW_NOT_USED);
+    trx->Commit();
+
+    /* 被归还的页面再次插入时重新分配 */
+    trx->Begin();
+    RowId rowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+    ASSERT_GE(rowid, 2 * tuplesPerPage);
+    ASSERT_EQ(HeapUpperRowId(table), 3 * tuplesPerPage);
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+    ASSERT_TRUE(dstTuple->EqualRow(tuple));
+    trx->Commit();
+
+    delete tuple;
+    delete dstTuple;
+}
+
+/* 模拟宕机时有多个未完成的事务，重启后按不同并行度回滚（耗时见 benchmarks/recovery.cpp） */
+TEST_F(HeapTest, ParallelRecoveryTest)
+{
+    static const int INFLIGHT_TRXS = 64;
+    static const int ROWS_PER_TRX = 200;
+    Table *table = new Table(0, row_len);
+    uint32 seghead = table->CreateSegment();
+
+    for (uint32 workers : {1U, NVMDB_UNDO_RECOVERY_WORKER_NUM}) {
+        std::vector<RowId> rowids[INFLIGHT_TRXS];
+        std::vector<std::thread> threads;
+        for (int i = 0; i < INFLIGHT_TRXS; i++) {
+            threads.emplace_back([table, &rowids, i] {
+                InitThreadLocalVariables();
+                Transaction *trx = GetCurrentTrxContext();
+                trx->Begin();
+                RAMTuple *tuple = GenRow(true, i, i);
+                for (int j = 0; j < ROWS_PER_TRX; j++) {
+                    rowids[i].push_back(HeapInsert(trx, table, tuple));
+                }
+                delete tuple;
+                /* 不提交直接退出，事务保持 IN_PROGRESS */
+                DestroyThreadLocalVariables();
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+        SetUndoRecoveryWorkers(workers);
+        BootStrap(space_dir);
+        table->Mount(seghead);
+        InitThreadLocalVariables();
+
+        UndoRecoveryProgress progress;
+        do {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            GetUndoRecoveryProgress(&progress);
+        } while (!progress.m_finished);
+        ASSERT_EQ(progress.m_workers, workers);
+        ASSERT_EQ(progress.m_pendingTrxs, INFLIGHT_TRXS);
+        ASSERT_EQ(progress.m_rolledBackTrxs, INFLIGHT_TRXS);
+        ASSERT_EQ(progress.m_doneSegments, progress.m_totalSegments);
+
+        Transaction *trx = GetCurrentTrxContext();
+        RAMTuple *dstTuple = GenRow();
+        trx->Begin();
+        for (int i = 0; i < INFLIGHT_TRXS; i++) {
+            for (RowId rowid : rowids[i]) {
+                ASSERT_NE(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+            }
+        }
+        trx->Commit();
+        delete dstTuple;
+    }
+    SetUndoRecoveryWorkers(NVMDB_UNDO_RECOVERY_WORKER_NUM);
+}
+
+/* 写满的 leaf page 在重启后不会再分配给插入，未写满的从已占用的个数开始分配，不必逐个探测 */
+TEST_F(HeapTest, RestartFullPageTest)
+{
+    Table *table = new Table(0, row_len);
+    uint32 seghead = table->CreateSegment();
+
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 1, 1);
+    trx->Begin();
+    std::vector<RowId> rowids{HeapInsert(trx, table, tuple)};
+    trx->Commit();
+    RowId tuplesPerPage = HeapUpperRowId(table);
+
+    trx->Begin();
+    while (rowids.size() < 2 * tuplesPerPage + 10) {
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+    /* 回滚的插入不占计数 */
+    trx->Begin();
+    for (int i = 0; i < 10; i++) {
+        HeapInsert(trx, table, tuple);
+    }
+    trx->Abort();
+
+    std::map<RowId, RowId> pageUsed;
+    for (RowId rowid : rowids) {
+        pageUsed[rowid / tuplesPerPage]++;
+    }
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table->Mount(seghead);
+    InitThreadLocalVariables();
+
+    VecStore *vecStore = table->m_rowidMap->GetVecStore();
+    for (auto &page : pageUsed) {
+        ASSERT_EQ(vecStore->GetLeafPageUsedCount(page.first), page.second);
+    }
+
+    uint64 misses = vecStore->GetTryAtMisses();
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    for (int i = 0; i < 10; i++) {
+        RowId rowid = HeapInsert(trx, table, tuple);
+        ASSERT_LT(pageUsed[rowid / tuplesPerPage], tuplesPerPage);
+        pageUsed[rowid / tuplesPerPage]++;
+    }
+    trx->Commit();
+    ASSERT_EQ(vecStore->GetTryAtMisses(), misses);
+
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    for (RowId rowid : rowids) {
+        ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(dstTuple->EqualRow(tuple));
+    }
+    trx->Commit();
+
+    delete tuple;
+    delete dstTuple;
+}
+
+/* RowIdMap 每行只保留一个字节的标志，tuple 地址由页面描述算出 */
+TEST_F(HeapTest, RowIdMapMemoryTest)
+{
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 1, 2);
+    trx->Begin();
+    std::vector<RowId> rowids{HeapInsert(trx, table, tuple)};
+    trx->Commit();
+    RowId tuplesPerPage = HeapUpperRowId(table);
+
+    trx->Begin();
+    while (rowids.size() < 2 * tuplesPerPage + 10) {
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    for (RowId rowid : rowids) {
+        ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(dstTuple->EqualRow(tuple));
+    }
+    trx->Commit();
+
+    size_t metaSize = table->m_rowidMap->GetMetaMemorySize();
+    ASSERT_LT(metaSize, 2 * rowids.size());
+
+    delete tuple;
+    delete dstTuple;
+}
+
+/* 多个线程同时首次访问同一批页面，拿到的页面描述和地址一致 */
+TEST_F(HeapTest, RowIdMapConcurrentLookupTest)
+{
+    static const int THREAD_NUM = 8;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 1, 2);
+    trx->Begin();
+    std::vector<RowId> rowids{HeapInsert(trx, table, tuple)};
+    trx->Commit();
+    RowId tuplesPerPage = HeapUpperRowId(table);
+    trx->Begin();
+    while (rowids.size() < 3 * tuplesPerPage) {
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+    delete tuple;
+
+    /* 新的 RowIdMap 中还没有任何页面描述 */
+    RowIdMap *rowidMap = new RowIdMap(g_heapSpace, table->SegmentHead(), row_len);
+    VecStore *vecStore = rowidMap->GetVecStore();
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatch{0};
+    for (int i = 0; i < THREAD_NUM; i++) {
+        threads.emplace_back([&rowids, rowidMap, vecStore, &mismatch, i] {
+            for (size_t j = i; j < rowids.size() + i; j++) {
+                RowId rowid = rowids[j % rowids.size()];
+                RowIdMapEntry entry = rowidMap->GetEntry(rowid, true);
+                if (!entry.IsValid() || entry.NvmAddr() != vecStore->VersionPoint(rowid)) {
+                    mismatch++;
+                }
+                entry.Lock();
+                entry.Unlock();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(mismatch.load(), 0);
+    ASSERT_FALSE(rowidMap->GetEntry(MaxRowId - 1, true).IsValid());
+    delete rowidMap;
+}
+
+/* seghead -> RowIdMap 注册表：同一 segment 总是得到同一个 RowIdMap，摘除后重新注册 */
+TEST_F(HeapTest, RowIdMapRegistryTest)
+{
+    static const int TABLE_NUM = 16;
+    std::vector<uint32> segheads;
+    std::vector<RowIdMap *> maps;
+    for (int i = 0; i < TABLE_NUM; i++) {
+        Table *table = new Table(0, row_len);
+        segheads.push_back(table->CreateSegment());
+        maps.push_back(table->m_rowidMap);
+    }
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatch{0};
+    for (int i = 0; i < TABLE_NUM; i++) {
+        threads.emplace_back([&segheads, &maps, &mismatch] {
+            for (int j = 0; j < TABLE_NUM; j++) {
+                if (GetRowIdMap(segheads[j], row_len) != maps[j]) {
+                    mismatch++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(mismatch.load(), 0);
+
+    uint64 oldEpoch = GetRowIdMapEpoch(segheads[0]);
+    ASSERT_EQ(oldEpoch, maps[0]->GetVecStore()->GetEpoch());
+    DropRowIdMap(segheads[0]);
+    ASSERT_EQ(GetRowIdMapEpoch(segheads[0]), 0);
+    RowIdMap *rowidMap = GetRowIdMap(segheads[0], row_len);
+    ASSERT_NE(rowidMap, nullptr);
+    ASSERT_EQ(GetRowIdMap(segheads[0], row_len), rowidMap);
+    ASSERT_EQ(GetRowIdMap(segheads[1], row_len), maps[1]);
+    /* 同一个 seghead 重新注册后 epoch 不同，线程局部缓存据此作废 */
+    ASSERT_NE(GetRowIdMapEpoch(segheads[0]), oldEpoch);
+}
+
+/* 跨过直接映射、一级和二级间接页，以及超过 32 位的 RowId */
+TEST_F(HeapTest, LargeRowIdTest)
+{
+    static const uint32 TUPLE_LEN = NVMTupleHeadSize + 1;
+    uint32 seghead = NVMInvalidBlockNumber;
+    g_heapSpace->AllocNewExtent(&seghead, EXTSZ_2M);
+    RowIDMgr *rowidMgr = new RowIDMgr(g_heapSpace, seghead, TUPLE_LEN);
+    RowId tuplesPerPage = PageContentSize(HEAP_EXTENT_SIZE) / TUPLE_LEN;
+
+    std::vector<RowId> rowids;
+    for (RowId page = 0; page < 16; page++) {
+        rowids.push_back(page * tuplesPerPage + page);
+    }
+    rowids.push_back((1LLU << BIS_PER_U32) + 7);
+    ASSERT_LT(rowids.back() / tuplesPerPage, rowidMgr->GetMaxLeafPageNum());
+
+    for (RowId rowid : rowids) {
+        ASSERT_EQ(rowidMgr->version_pointer(rowid, false), nullptr);
+        char *tuple = rowidMgr->version_pointer(rowid, true);
+        ASSERT_NE(tuple, nullptr);
+        *reinterpret_cast<RowId *>(tuple) = rowid;
+    }
+    ASSERT_EQ(rowidMgr->GetUpperRowId(), (rowids.back() / tuplesPerPage + 1) * tuplesPerPage);
+    for (RowId rowid : rowids) {
+        char *tuple = rowidMgr->version_pointer(rowid, false);
+        ASSERT_NE(tuple, nullptr);
+        ASSERT_EQ(*reinterpret_cast<RowId *>(tuple), rowid);
+    }
+
+    /* 归还最高的页面后，上界退回到次高的页面 */
+    rowidMgr->release_leaf_page(rowids.back() / tuplesPerPage);
+    ASSERT_EQ(rowidMgr->version_pointer(rowids.back(), false), nullptr);
+    ASSERT_EQ(rowidMgr->GetUpperRowId(), 16 * tuplesPerPage);
+    delete rowidMgr;
+}
+
+/* 建表时指定 leaf page 的大小；自适应的表先用小页面，之后用指定的大小，重启后布局不变 */
+TEST_F(HeapTest, LeafExtentSizeTest)
+{
+    uint32 tupleLen = row_len + NVMTupleHeadSize;
+    RAMTuple *tuple = GenRow(true, 1, 1);
+    Transaction *trx = GetCurrentTrxContext();
+
+    Table *small = new Table(0, row_len);
+    uint32 smallSeg = small->CreateSegment(EXTSZ_64K);
+    NVMPageHeader *rootHeader = reinterpret_cast<NVMPageHeader *>(g_heapSpace->RelpointOfPageno(smallSeg));
+    ASSERT_EQ(rootHeader->m_blksz, EXTSZ_64K);
+    trx->Begin();
+    RowId rowid = HeapInsert(trx, small, tuple);
+    trx->Commit();
+    ASSERT_EQ(HeapUpperRowId(small), PageContentSize(EXTSZ_64K) / tupleLen);
+    VecStore *vecStore = small->m_rowidMap->GetVecStore();
+    char *leaf = vecStore->LeafPagePoint(vecStore->LeafPageOfRowId(rowid));
+    ASSERT_EQ(reinterpret_cast<NVMPageHeader *>(leaf - PageHeaderSize)->m_blksz, EXTSZ_64K);
+
+    Table *adaptive = new Table(1, row_len);
+    uint32 adaptiveSeg = adaptive->CreateSegment(EXTSZ_2M, true);
+    RowId smallRows = HEAP_SMALL_PAGES * (PageContentSize(HEAP_SMALL_EXTENT_SIZE) / tupleLen);
+    RowId largeRows = PageContentSize(EXTSZ_2M) / tupleLen;
+    std::vector<RowId> rowids;
+    trx->Begin();
+    while (rowids.size() < smallRows + 10) {
+        rowids.push_back(HeapInsert(trx, adaptive, tuple));
+    }
+    trx->Commit();
+    ASSERT_EQ(HeapUpperRowId(adaptive), smallRows + largeRows);
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    small->Mount(smallSeg);
+    adaptive->Mount(adaptiveSeg);
+    InitThreadLocalVariables();
+
+    ASSERT_EQ(HeapUpperRowId(small), PageContentSize(EXTSZ_64K) / tupleLen);
+    vecStore = adaptive->m_rowidMap->GetVecStore();
+    ASSERT_EQ(vecStore->LeafPageTupleNum(0), smallRows / HEAP_SMALL_PAGES);
+    ASSERT_EQ(vecStore->LeafPageTupleNum(HEAP_SMALL_PAGES), largeRows);
+    ASSERT_EQ(vecStore->LeafPageOfRowId(smallRows), HEAP_SMALL_PAGES);
+    ASSERT_EQ(vecStore->GetLeafPageUsedCount(HEAP_SMALL_PAGES), 10);
+    ASSERT_EQ(HeapUpperRowId(adaptive), smallRows + largeRows);
+
+    RAMTuple *dstTuple = GenRow();
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, small, rowid, dstTuple), HAM_SUCCESS);
+    for (RowId id : rowids) {
+        ASSERT_EQ(HeapRead(trx, adaptive, id, dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(dstTuple->EqualRow(tuple));
+    }
+    trx->Commit();
+
+    delete tuple;
+    delete dstTuple;
+}
+
+/* heap、索引、undo 并行挂载，每个阶段的耗时都计入且不超过总耗时 */
+TEST_F(HeapTest, StartupStatTest)
+{
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    InitThreadLocalVariables();
+
+    StartupStat stat;
+    GetStartupStat(&stat);
+    ASSERT_GT(stat.m_undoMountUs, 0);
+    ASSERT_GE(stat.m_totalUs, stat.m_heapMountUs);
+    ASSERT_GE(stat.m_totalUs, stat.m_indexMountUs);
+    ASSERT_GE(stat.m_totalUs, stat.m_undoMountUs);
+
+    UndoRecoveryProgress progress;
+    do {
+        GetUndoRecoveryProgress(&progress);
+    } while (!progress.m_finished);
+    ASSERT_EQ(progress.m_doneSegments, progress.m_totalSegments);
+}
+
+/* undo segment 在第一次被事务绑定时才创建，重启后只挂载已创建的 segment */
+static int CreatedUndoSegmentNum()
+{
+    int num = 0;
+    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {
+        if (GetUndoSegment(i) != nullptr) {
+            num++;
+        }
+    }
+    return num;
+}
+
+TEST_F(HeapTest, UndoLazySegmentTest)
+{
+    static const int threadNum = 4;
+    int created = CreatedUndoSegmentNum();
+    ASSERT_LT(created, NVMDB_UNDO_SEGMENT_NUM);
+
+    Table *table = new Table(0, row_len);
+    uint32 seghead = table->CreateSegment();
+    std::vector<RowId> rowids(threadNum);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadNum; i++) {
+        workers.emplace_back([table, &rowids, i]() {
+            InitThreadLocalVariables();
+            Transaction *trx = GetCurrentTrxContext();
+            trx->Begin();
+            RAMTuple *tuple = GenRow(true, i, i);
+            rowids[i] = HeapInsert(trx, table, tuple);
+            trx->Commit();
+            delete tuple;
+            DestroyThreadLocalVariables();
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    created = CreatedUndoSegmentNum();
+    ASSERT_LE(created, threadNum + 1);
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table->Mount(seghead);
+    InitThreadLocalVariables();
+    ASSERT_EQ(CreatedUndoSegmentNum(), created);
+
+    Transaction *trx = GetCurrentTrxContext();
+    trx->Begin();
+    RAMTuple *dstTuple = GenRow();
+    for (int i = 0; i < threadNum; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(dstTuple, 0, i));
+    }
+    trx->Commit();
+    delete dstTuple;
+}
+
+/* undo 逻辑偏移绕环一圈以上后，slice 文件数不再增长，回滚仍能读到环上复用过的 undo */
+TEST_F(HeapTest, UndoRingReuseTest)
+{
+    /* 越过环的长度再多写一个 slice，保证第一个物理 slice 已被复用 */
+    static const uint64 wrapBytes = (UNDO_RING_SLICES + 2) * UNDO_SLICE_SIZE;
+    static const int maxRounds = 4000000;
+    static const int updatesPerTrx = 16;
+    Table *table = new Table(0, row_len);
+    uint32 seghead = table->CreateSegment();
+
+    Transaction *trx = GetCurrentTrxContext();
+    trx->Begin();
+    RAMTuple *tuple = GenRow(true, 0, 0);
+    RowId rowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+
+    /* 等回收线程跟上再开始下一个事务，空闲栈后进先出，单线程时每个事务都拿回同一个 segment */
+    UndoSegment *segment = GetUndoSegment(TrxSlotPtrGetSegmentId(trx->GetTrxSlotLocation()));
+    int round = 0;
+    while (round < maxRounds && segment->UndoFreeBegin() < wrapBytes) {
+        while (segment->SegmentFull()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        trx->Begin();
+        for (int i = 0; i < updatesPerTrx; i++) {
+            round++;
+            ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, round, round), HAM_SUCCESS);
+        }
+        trx->Commit();
+    }
+    ASSERT_EQ(GetUndoSegment(TrxSlotPtrGetSegmentId(trx->GetTrxSlotLocation())), segment);
+    ASSERT_GE(segment->UndoFreeBegin(), wrapBytes);
+    ASSERT_LE(segment->SliceNumber(), UNDO_MAX_SLICE_NUM);
+
+    trx->Begin();
+    ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, -1, -1), HAM_SUCCESS);
+    trx->Abort();
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table->Mount(seghead);
+    InitThreadLocalVariables();
+
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    RAMTuple *dstTuple = GenRow();
+    ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+    ASSERT_TRUE(ColEqual(dstTuple, 0, round));
+    trx->Commit();
+    delete tuple;
+    delete dstTuple;
+}
+
+/* 长事务卡住快照时回收滞后持续增长，放开后按积压量多线程回收 */
+TEST_F(HeapTest, UndoRecycleLagTest)
+{
+    static const int trxNum = 3 * NVMDB_UNDO_RECYCLE_BACKLOG_PER_WORKER;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+    std::thread holder([&]() {
+        InitThreadLocalVariables();
+        Transaction *trx = GetCurrentTrxContext();
+        trx->Begin();
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            started = true;
+            cv.notify_all();
+            cv.wait(lock, [&release] { return release; });
+        }
+        trx->Commit();
+        DestroyThreadLocalVariables();
+    });
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&started] { return started; });
+    }
+
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 1, 1);
+    for (int i = 0; i < trxNum; i++) {
+        trx->Begin();
+        HeapInsert(trx, table, tuple);
+        trx->Commit();
+    }
+    delete tuple;
+
+    UndoRecycleStat stat;
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        GetUndoRecycleStat(&stat);
+    } while (stat.m_lagSlots < trxNum);
+    ASSERT_GT(stat.m_lagBytes, 0);
+    ASSERT_GT(stat.m_oldestSlotAgeUs, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        release = true;
+        cv.notify_all();
+    }
+    holder.join();
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        GetUndoRecycleStat(&stat);
+    } while (stat.m_lagSlots >= NVMDB_UNDO_RECYCLE_BACKLOG_PER_WORKER);
+    ASSERT_GT(stat.m_peakWorkers, 1);
+}
+
+/* undo 按 cache line 整行写入 NVM，每条记录落盘一次；未提交事务没有发布的 undo 在重启后仍能找到并回滚 */
+TEST_F(HeapTest, UndoWriteStatTest)
+{
+    static const int ROW_NUM = 20000;
+    Table *table = new Table(0, row_len);
+    uint32 seghead = table->CreateSegment();
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 1, 1);
+    std::vector<RowId> rowids;
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+
+    UndoWriteStat before;
+    GetUndoWriteStat(&before);
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, i, i), HAM_SUCCESS);
+    }
+    trx->Commit();
+    UndoWriteStat after;
+    GetUndoWriteStat(&after);
+    uint64 recordBytes = after.m_recordBytes - before.m_recordBytes;
+    uint64 nvmBytes = after.m_nvmBytes - before.m_nvmBytes;
+    ASSERT_EQ(after.m_records - before.m_records, ROW_NUM);
+    ASSERT_EQ(nvmBytes % UNDO_LINE_SIZE, 0);
+    ASSERT_GE(nvmBytes, recordBytes);
+    /* 每条记录只落盘一次 */
+    ASSERT_EQ(after.m_drains - before.m_drains, ROW_NUM);
+
+    /* 更新后不提交直接重启 */
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, -1, -1), HAM_SUCCESS);
+    }
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table->Mount(seghead);
+    InitThreadLocalVariables();
+    UndoRecoveryProgress progress;
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        GetUndoRecoveryProgress(&progress);
+    } while (!progress.m_finished);
+
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], tuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(tuple, 0, i));
+        ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, i + 1, i + 1), HAM_SUCCESS);
+    }
+    trx->Commit();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], tuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(tuple, 0, i + 1));
+    }
+    trx->Commit();
+    delete tuple;
+}
+
+/* 版本链上的 undo 记录直接从 NVM 访问，内容与拷贝出来的一致 */
+TEST_F(HeapTest, UndoRecordZeroCopyTest)
+{
+    static const int UPDATE_NUM = 200;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 0, 0);
+    trx->Begin();
+    RowId rowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+    for (int i = 1; i <= UPDATE_NUM; i++) {
+        trx->Begin();
+        ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, i, i), HAM_SUCCESS);
+        trx->Commit();
+    }
+
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, table, rowid, tuple), HAM_SUCCESS);
+    char *copyCache = new char[MAX_UNDO_RECORD_CACHE_SIZE];
+    int hops = 0;
+    int direct = 0;
+    UndoRecPtr undoPtr = tuple->m_prev;
+    while (!UndoRecPtrIsInValid(undoPtr)) {
+        UndoRecord *record = GetUndoRecord(undoPtr, trx->undoRecordCache);
+        UndoRecord *copy = CopyUndoRecord(undoPtr, copyCache);
+        ASSERT_EQ(record->m_undoType, HeapUpdateUndo);
+        ASSERT_EQ(memcmp(record, copy, UndoRecTotalSize(copy->m_payload)), 0);
+        if ((char *)record != trx->undoRecordCache) {
+            direct++;
+        }
+        hops++;
+        undoPtr = reinterpret_cast<NVMTuple *>(record->data)->m_prev;
+    }
+    trx->Commit();
+    ASSERT_EQ(hops, UPDATE_NUM);
+    ASSERT_EQ(direct, UPDATE_NUM);
+    delete[] copyCache;
+    delete tuple;
+}
+
+/* 删除的 undo 只有 tuple 头；回滚和旧快照读都从 NVM 上原样保留的数据恢复 */
+TEST_F(HeapTest, CompactDeleteUndoTest)
+{
+    static const int ROW_NUM = 1000;
+    static const uint64 WIDE_LEN = 1024;
+    ColumnDesc wideDesc[] = {
+        COL_DESC(COL_TYPE_INT),               /* id */
+        VAR_DESC(COL_TYPE_VARCHAR, WIDE_LEN)  /* payload */
+    };
+    uint64 wideRowLen = 0;
+    InitColumnDesc(&wideDesc[0], sizeof(wideDesc) / sizeof(ColumnDesc), wideRowLen);
+    Table *table = new Table(0, wideRowLen);
+    table->CreateSegment();
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = new RAMTuple(&wideDesc[0], wideRowLen);
+    char payload[WIDE_LEN];
+    std::vector<RowId> rowids;
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        memset(payload, 'a' + i % 26, WIDE_LEN);
+        tuple->SetCol(0, (char *)&i);
+        tuple->SetCol(1, payload);
+        rowids.push_back(HeapInsert(trx, table, tuple));
+    }
+    trx->Commit();
+
+    /* 回滚删除 */
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapDelete(trx, table, rowids[i]), HAM_SUCCESS);
+    }
+    trx->Abort();
+
+    Transaction *reader = new Transaction();
+    reader->Begin();
+    UndoWriteStat before;
+    GetUndoWriteStat(&before);
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapDelete(trx, table, rowids[i]), HAM_SUCCESS);
+    }
+    trx->Commit();
+    UndoWriteStat after;
+    GetUndoWriteStat(&after);
+    uint64 bytesPerDelete = (after.m_recordBytes - before.m_recordBytes) / ROW_NUM;
+    ASSERT_LT(bytesPerDelete * 10, wideRowLen);
+
+    /* 删除之前开始的事务仍能看到完整的数据 */
+    for (int i = 0; i < ROW_NUM; i++) {
+        memset(payload, 'a' + i % 26, WIDE_LEN);
+        ASSERT_EQ(HeapRead(reader, table, rowids[i], tuple), HAM_SUCCESS);
+        ASSERT_TRUE(tuple->ColEqual(0, (char *)&i));
+        ASSERT_TRUE(tuple->ColEqual(1, payload));
+    }
+    reader->Commit();
+    delete reader;
+
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], tuple), HAM_ROW_DELETED);
+    }
+    trx->Commit();
+    delete tuple;
+}
+
+/* 空闲连接不占用 segment，远多于 segment 数的连接轮流执行写事务时复用同一批 segment */
+TEST_F(HeapTest, UndoSegmentPoolTest)
+{
+    static const int sessionNum = 64;
+    static const int trxPerSession = 16;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+    int created = CreatedUndoSegmentNum();
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    int ready = 0;
+    int turn = -1;
+    std::vector<std::thread> sessions;
+    for (int i = 0; i < sessionNum; i++) {
+        sessions.emplace_back([&, i]() {
+            InitThreadLocalVariables();
+            std::unique_lock<std::mutex> lock(mtx);
+            ready++;
+            cv.notify_all();
+            cv.wait(lock, [&turn, i] { return turn == i; });
+            Transaction *trx = GetCurrentTrxContext();
+            RAMTuple *tuple = GenRow(true, i, i);
+            for (int j = 0; j < trxPerSession; j++) {
+                trx->Begin();
+                HeapInsert(trx, table, tuple);
+                trx->Commit();
+            }
+            delete tuple;
+            turn++;
+            cv.notify_all();
+            lock.unlock();
+            DestroyThreadLocalVariables();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&ready] { return ready == sessionNum; });
+        /* 所有连接都已建立但还没有写事务 */
+        ASSERT_EQ(CreatedUndoSegmentNum(), created);
+        turn = 0;
+        cv.notify_all();
+    }
+    for (auto &session : sessions) {
+        session.join();
+    }
+    ASSERT_LE(CreatedUndoSegmentNum(), created + 1);
+}
+
+/* 长事务的快照超过 undo 保留上限后被作废，读旧版本时报 snapshot too old，写入者的 undo 照常回收 */
+TEST_F(HeapTest, UndoRetentionTest)
+{
+    static const uint64 retentionBytes = 1024 * 1024;
+    static const int maxRounds = 1000000;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+    Transaction *trx = GetCurrentTrxContext();
+    RAMTuple *tuple = GenRow(true, 0, 0);
+    trx->Begin();
+    RowId rowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+
+    /* 按字节数：undo 持续增长时作废最老的快照 */
+    SetUndoRetention(0, retentionBytes);
+    Transaction *reader = new Transaction();
+    reader->Begin();
+    ASSERT_EQ(HeapRead(reader, table, rowid, tuple), HAM_SUCCESS);
+    UndoRecycleStat stat;
+    int round = 0;
+    do {
+        round++;
+        trx->Begin();
+        ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, round, round), HAM_SUCCESS);
+        trx->Commit();
+        GetUndoRecycleStat(&stat);
+    } while (stat.m_expiredSnapshots == 0 && round < maxRounds);
+    ASSERT_GT(stat.m_expiredSnapshots, 0);
+    ASSERT_EQ(HeapRead(reader, table, rowid, tuple), HAM_SNAPSHOT_TOO_OLD);
+    reader->Commit();
+    /* 快照放开之后回收线程追上 */
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        GetUndoRecycleStat(&stat);
+    } while (stat.m_heldBytes > retentionBytes);
+
+    /* 按时长：快照建立太久后作废，重新开始的事务不受影响 */
+    SetUndoRetention(50, 0);
+    reader->Begin();
+    trx->Begin();
+    ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, -1, -1), HAM_SUCCESS);
+    trx->Commit();
+    while (!reader->SnapshotTooOld()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(HeapRead(reader, table, rowid, tuple), HAM_SNAPSHOT_TOO_OLD);
+    reader->Commit();
+    reader->Begin();
+    ASSERT_EQ(HeapRead(reader, table, rowid, tuple), HAM_SUCCESS);
+    ASSERT_TRUE(ColEqual(tuple, 0, -1));
+    reader->Commit();
+    delete reader;
+    delete tuple;
+    SetUndoRetention(NVMDB_UNDO_RETENTION_AGE_MS, NVMDB_UNDO_RETENTION_BYTES);
+}
+
+TEST_F(HeapTest, UndoBatchRollbackTest)
+{
+    static const uint32 TABLE_OID = 200;
+    static const int ROW_NUM = 20000;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+    Table *truncated = new Table(TABLE_OID, row_len);
+    uint32 truncatedSeg = truncated->CreateSegment();
+    g_heapSpace->CreateTable(TableSegMetaData{TABLE_OID, truncatedSeg});
+
+    Transaction *trx = GetCurrentTrxContext();
+    std::vector<RowId> rowids;
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        RAMTuple *tuple = GenRow(true, i, i);
+        rowids.push_back(HeapInsert(trx, table, tuple));
+        delete tuple;
+    }
+    trx->Commit();
+
+    RAMTuple *tuple = GenRow(true, -1, -1);
+    RAMTuple *dstTuple = GenRow();
+    for (uint32 workers : {1U, NVMDB_UNDO_ROLLBACK_WORKER_NUM}) {
+        SetUndoRollbackWorkers(workers);
+        /* 每行更新两次，中间夹一个 truncate 作为屏障，再删除一部分行、插入新行 */
+        std::vector<RowId> inserted;
+        trx->Begin();
+        for (int i = 0; i < ROW_NUM; i++) {
+            ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, -1, i), HAM_SUCCESS);
+        }
+        truncated->Truncate(trx);
+        HeapInsert(trx, truncated, tuple);
+        for (int i = 0; i < ROW_NUM; i++) {
+            ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, -2, i), HAM_SUCCESS);
+            if (i % 4 == 0) {
+                ASSERT_EQ(HeapDelete(trx, table, rowids[i]), HAM_SUCCESS);
+            }
+            if (i % 2 == 0) {
+                inserted.push_back(HeapInsert(trx, table, tuple));
+            }
+        }
+        trx->Abort();
+        ASSERT_EQ(truncated->SegmentHead(), truncatedSeg);
+        ASSERT_EQ(g_heapSpace->SearchTable(TABLE_OID), truncatedSeg);
+
+        trx->Begin();
+        for (int i = 0; i < ROW_NUM; i++) {
+            ASSERT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+            ASSERT_TRUE(ColEqual(dstTuple, 0, i));
+            ASSERT_TRUE(ColEqual(dstTuple, 1, i));
+        }
+        for (RowId rowid : inserted) {
+            ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_READ_ROW_NOT_USED);
+        }
+        trx->Commit();
+    }
+
+    /* 宕机后由恢复线程回滚同样大的事务 */
+    uint32 seghead = table->SegmentHead();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, -1, i), HAM_SUCCESS);
+        ASSERT_EQ(UpdateRow(trx, table, rowids[i], tuple, -2, i), HAM_SUCCESS);
+    }
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table->Mount(seghead);
+    InitThreadLocalVariables();
+    UndoRecoveryProgress progress;
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        GetUndoRecoveryProgress(&progress);
+    } while (!progress.m_finished);
+
+    trx = GetCurrentTrxContext();
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(dstTuple, 0, i));
+    }
+    trx->Commit();
+    delete tuple;
+    delete dstTuple;
+    SetUndoRollbackWorkers(0);
+}
+
+TEST_F(HeapTest, TrxInfoCacheTest)
+{
+    static const int ROW_NUM = 1000;
+    static const int SCAN_ROUNDS = 10;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+
+    /* 另一个线程持有更早的快照，释放之前写入事务的 slot 不会被回收 */
+    std::atomic<bool> holding{false};
+    std::atomic<bool> release{false};
+    std::thread holder([&holding, &release] {
+        InitThreadLocalVariables();
+        Transaction *oldTrx = GetCurrentTrxContext();
+        oldTrx->Begin();
+        holding = true;
+        while (!release) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        oldTrx->Commit();
+        DestroyThreadLocalVariables();
+    });
+    while (!holding) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Transaction *trx = GetCurrentTrxContext();
+    std::vector<RowId> rowids;
+    trx->Begin();
+    for (int i = 0; i < ROW_NUM; i++) {
+        RAMTuple *tuple = GenRow(true, i, i);
+        rowids.push_back(HeapInsert(trx, table, tuple));
+        delete tuple;
+    }
+    trx->Commit();
+    TransactionSlotPtr committedTrx = trx->GetTrxSlotLocation();
+
+    /* 所有行都由同一个事务写入，只有第一次需要读 slot */
+    TrxInfoCacheStat before;
+    GetTrxInfoCacheStat(&before);
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    for (int round = 0; round < SCAN_ROUNDS; round++) {
+        for (int i = 0; i < ROW_NUM; i++) {
+            EXPECT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        }
+    }
+    trx->Commit();
+    TrxInfoCacheStat after;
+    GetTrxInfoCacheStat(&after);
+    EXPECT_EQ(after.m_misses - before.m_misses, 1);
+    EXPECT_EQ(after.m_hits - before.m_hits, ROW_NUM * SCAN_ROUNDS - 1);
+
+    /* 回滚的事务同样缓存 */
+    RAMTuple *tuple = GenRow(true, -1, -1);
+    trx->Begin();
+    EXPECT_EQ(UpdateRow(trx, table, rowids[0], tuple, -1, -1), HAM_SUCCESS);
+    trx->Abort();
+    TransactionSlotPtr abortedTrx = trx->GetTrxSlotLocation();
+    TransactionInfo trxInfo;
+    for (int i = 0; i < 2; i++) {
+        EXPECT_TRUE(GetTransactionInfo(abortedTrx, &trxInfo));
+        EXPECT_EQ(trxInfo.status, TRX_ROLLBACKED);
+    }
+    EXPECT_TRUE(GetTransactionInfo(committedTrx, &trxInfo));
+    EXPECT_EQ(trxInfo.status, TRX_COMMITTED);
+    release = true;
+    holder.join();
+
+    /* slot 被回收后缓存不再命中，结果和直接读 slot 一致 */
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (GetTransactionInfo(committedTrx, &trxInfo) && std::chrono::steady_clock::now() < deadline) {
+        trx->Begin();
+        ASSERT_EQ(UpdateRow(trx, table, rowids[1], tuple, -1, -1), HAM_SUCCESS);
+        trx->Commit();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_FALSE(GetTransactionInfo(committedTrx, &trxInfo));
+    trx->Begin();
+    for (int i = 2; i < ROW_NUM; i++) {
+        ASSERT_EQ(HeapRead(trx, table, rowids[i], dstTuple), HAM_SUCCESS);
+        ASSERT_TRUE(ColEqual(dstTuple, 0, i));
+    }
+    trx->Commit();
+    delete tuple;
+    delete dstTuple;
+}
+
+/* 单个事务的 undo 写满整个环时只回滚该事务，数据库继续可用 */
+TEST_F(HeapTest, UndoRingOverflowTest)
+{
+    static const int maxRounds = 4000000;
+    Table *table = new Table(0, row_len);
+    table->CreateSegment();
+
+    Transaction *trx = GetCurrentTrxContext();
+    trx->Begin();
+    RAMTuple *tuple = GenRow(true, 0, 0);
+    RowId rowid = HeapInsert(trx, table, tuple);
+    trx->Commit();
+
+    trx->Begin();
+    HAM_STATUS status = HAM_SUCCESS;
+    int round = 0;
+    while (round < maxRounds && status == HAM_SUCCESS) {
+        round++;
+        status = UpdateRow(trx, table, rowid, tuple, round, round);
+    }
+    ASSERT_EQ(status, HAM_TRANSACTION_WAIT_ABORT);
+    ASSERT_EQ(trx->GetTrxStatus(), TX_WAIT_ABORT);
+    trx->Abort();
+
+    RAMTuple *dstTuple = GenRow();
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+    ASSERT_TRUE(ColEqual(dstTuple, 0, 0));
+    ASSERT_EQ(UpdateRow(trx, table, rowid, tuple, 1, 1), HAM_SUCCESS);
+    trx->Commit();
+
+    trx->Begin();
+    ASSERT_EQ(HeapRead(trx, table, rowid, dstTuple), HAM_SUCCESS);
+    ASSERT_TRUE(ColEqual(dstTuple, 0, 1));
+    trx->Commit();
+    delete tuple;
+    delete dstTuple;
+}
+
 }  // namespace heap_test
\ No newline at end of file
@@ -20,7 +20,10 @@
  * -------------------------------------------------------------------------
  */
 #include <gtest/gtest.h>  // googletest header file
+#include <atomic>
+#include <chrono>
 #include <set>
+#include <thread>
 
 #include "nvm_table_space.h"
 #include "test_declare.h"
@@ -140,3 +143,266 @@ TEST_F(TableSpaceTest, TestAllocPage)
 
     ASSERT_EQ(space->high_water_mark(), old_hwm);
 }
+
+TEST_F(TableSpaceTest, TestConcurrentAlloc)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+
+    static const int THREADS = 4;
+    static const int EXTENTS = 200;
+    uint32 segments[THREADS];
+    std::vector<uint32> blocks[THREADS];
+    std::thread workers[THREADS];
+
+    for (int i = 0; i < THREADS; i++) {
+        workers[i] = std::thread([&, i]() {
+            /* 一半线程分配 8K extent，一半分配 2M extent */
+            ExtentSizeType extsz = (i % 2) ? EXTSZ_8K : EXTSZ_2M;
+            space->AllocNewExtent(&segments[i], extsz);
+            for (int j = 0; j < EXTENTS; j++) {
+                uint32 blkno;
+                space->AllocNewExtent(&blkno, extsz, segments[i]);
+                blocks[i].push_back(blkno);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    std::set<uint32> blockset;
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(blockset.count(segments[i]), 0);
+        blockset.insert(segments[i]);
+        for (uint32 blkno : blocks[i]) {
+            ASSERT_EQ(blockset.count(blkno), 0);
+            blockset.insert(blkno);
+        }
+    }
+
+    uint32 oldHwm = space->high_water_mark();
+    for (int i = 0; i < THREADS; i++) {
+        workers[i] = std::thread([&, i]() { space->FreeSegment(&segments[i]); });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    /* 回收后再次分配应全部复用空闲链表 */
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(segments[i], NVMInvalidBlockNumber);
+        for (int j = 0; j <= EXTENTS; j++) {
+            uint32 blkno;
+            space->AllocNewExtent(&blkno, (i % 2) ? EXTSZ_8K : EXTSZ_2M);
+        }
+    }
+    ASSERT_EQ(space->high_water_mark(), oldHwm);
+}
+
+TEST_F(TableSpaceTest, TestTableCatalog)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+
+    static const uint32 TABLES = 20000;
+    static const uint32 OID_BASE = 16384;
+    for (uint32 i = 0; i < TABLES; i++) {
+        space->CreateTable(TableSegMetaData{OID_BASE + i, i + 2});
+    }
+    for (uint32 i = 0; i < TABLES; i += 2) {
+        space->DropTable(OID_BASE + i);
+    }
+    /* 已删除的槽位可以被复用 */
+    for (uint32 i = 0; i < TABLES; i += 4) {
+        space->CreateTable(TableSegMetaData{OID_BASE + TABLES + i, i + 3});
+    }
+
+    auto check = [&]() {
+        for (uint32 i = 0; i < TABLES; i++) {
+            uint32 expect = (i % 2) ? i + 2 : NVMInvalidBlockNumber;
+            ASSERT_EQ(space->SearchTable(OID_BASE + i), expect);
+            expect = (i % 4) ? NVMInvalidBlockNumber : i + 3;
+            ASSERT_EQ(space->SearchTable(OID_BASE + TABLES + i), expect);
+        }
+    };
+    check();
+
+    space->UnMount();
+    space->Mount();
+    check();
+}
+
+TEST_F(TableSpaceTest, TestResumableReclaim)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+
+    static const uint32 TABLE_OID = 16384;
+    static const int EXTENTS = 300;
+    uint32 seghead;
+    space->AllocNewExtent(&seghead, EXTSZ_8K);
+    for (int i = 0; i < EXTENTS; i++) {
+        uint32 blkno;
+        space->AllocNewExtent(&blkno, EXTSZ_8K, seghead);
+    }
+    space->CreateTable(TableSegMetaData{TABLE_OID, seghead});
+    uint32 oldHwm = space->high_water_mark();
+
+    int slot = space->ReclaimEnqueue(seghead, TABLE_OID);
+    ASSERT_GE(slot, 0);
+    ASSERT_EQ(space->SearchTable(TABLE_OID), NVMInvalidBlockNumber);
+    ASSERT_FALSE(space->FreeSegmentChunk(seghead, EXTENTS / 3));
+
+    /* 模拟回收中途退出，重启后继续 */
+    space->UnMount();
+    space->Mount();
+    std::vector<std::pair<int, uint32>> pending;
+    space->ReclaimPending(&pending);
+    ASSERT_EQ(pending.size(), 1);
+    ASSERT_EQ(pending[0].first, slot);
+    ASSERT_EQ(pending[0].second, seghead);
+    while (!space->FreeSegmentChunk(seghead, EXTENTS / 3)) {
+    }
+    space->ReclaimDone(slot);
+    space->FreeExtent(&seghead);
+
+    pending.clear();
+    space->ReclaimPending(&pending);
+    ASSERT_TRUE(pending.empty());
+
+    for (int i = 0; i <= EXTENTS; i++) {
+        uint32 blkno;
+        space->AllocNewExtent(&blkno, EXTSZ_8K);
+    }
+    ASSERT_EQ(space->high_water_mark(), oldHwm);
+}
+
+TEST_F(TableSpaceTest, TestReclaimQueueFull)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+
+    static const uint32 TABLE_OID = 16384;
+    uint32 seghead;
+    space->AllocNewExtent(&seghead, EXTSZ_8K);
+    space->CreateTable(TableSegMetaData{TABLE_OID, seghead});
+
+    uint32 capacity = TableSpace::ReclaimQueueCapacity();
+    for (uint32 i = 0; i < capacity; i++) {
+        uint32 blkno;
+        space->AllocNewExtent(&blkno, EXTSZ_8K);
+        ASSERT_EQ(space->ReclaimEnqueue(blkno), static_cast<int>(i));
+    }
+
+    /* 队列满时不能删除表目录项，等到有槽位清出为止 */
+    std::atomic<int> slot{-1};
+    std::thread dropper([&] { slot = space->ReclaimEnqueue(seghead, TABLE_OID); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(slot, -1);
+    EXPECT_EQ(space->SearchTable(TABLE_OID), seghead);
+
+    space->ReclaimDone(0);
+    dropper.join();
+    ASSERT_EQ(slot, 0);
+    ASSERT_EQ(space->SearchTable(TABLE_OID), NVMInvalidBlockNumber);
+}
+
+TEST_F(TableSpaceTest, TestMountPrefault)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+    uint32 seghead;
+    space->AllocNewExtent(&seghead, EXTSZ_2M);
+    while (space->SliceNumber() < 3) {
+        uint32 blkno;
+        space->AllocNewExtent(&blkno, EXTSZ_2M, seghead);
+    }
+    space->UnMount();
+
+    /* 重启后所有 slice 由后台线程预取 */
+    MMapStat before;
+    GetMMapStat(&before);
+    space->Mount();
+    uint32 slices = space->SliceNumber();
+    ASSERT_GE(slices, 3);
+    MMapStat after;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        GetMMapStat(&after);
+    } while (after.m_prefaultedBytes - before.m_prefaultedBytes < slices * space->SLICE_LEN &&
+             std::chrono::steady_clock::now() < deadline);
+    ASSERT_GE(after.m_prefaultedBytes - before.m_prefaultedBytes, slices * space->SLICE_LEN);
+    ASSERT_EQ(after.m_pendingPrefaults, 0);
+    ASSERT_EQ(after.m_mappedSlices, before.m_mappedSlices + slices);
+}
+
+TEST_F(TableSpaceTest, TestLazyMount)
+{
+    static const int SLICES = 4;
+    LogicFile file(space_dir, "lazy", 1024 * 1024, SLICES);
+    file.Create();
+    for (int i = 1; i < SLICES; i++) {
+        file.extend(i * file.SLICE_BLOCKS);
+        *file.RelpointOfPageno(i * file.SLICE_BLOCKS) = (char)i;
+    }
+    file.UnMount();
+
+    /* 挂载时只映射 slice 0，其余 slice 首次访问时映射 */
+    MMapStat before;
+    GetMMapStat(&before);
+    file.Mount();
+    ASSERT_EQ(file.SliceNumber(), SLICES);
+    MMapStat after;
+    GetMMapStat(&after);
+    ASSERT_EQ(after.m_mappedSlices, before.m_mappedSlices + 1);
+
+    ASSERT_EQ(*file.RelpointOfPageno((SLICES - 1) * file.SLICE_BLOCKS), (char)(SLICES - 1));
+    GetMMapStat(&after);
+    ASSERT_EQ(after.m_mappedSlices, before.m_mappedSlices + 2);
+    file.UnMount();
+}
+
+TEST_F(TableSpaceTest, TestExtentSizeClasses)
+{
+    TableSpace *space = MyTableSpace();
+    space->Create();
+
+    /* 每种大小各有自己的空闲链表，归还后同样大小的分配复用原来的 extent */
+    std::vector<uint32> extents(EXTSZ_TYPE_NUM, NVMInvalidBlockNumber);
+    for (int i = 0; i < EXTSZ_TYPE_NUM; i++) {
+        ExtentSizeType extsz = static_cast<ExtentSizeType>(i);
+        if (GetExtentBlockCount(extsz) > space->SLICE_BLOCKS) {
+            continue;
+        }
+        space->AllocNewExtent(&extents[i], extsz);
+        NVMPageHeader *header = reinterpret_cast<NVMPageHeader *>(space->RelpointOfPageno(extents[i]));
+        ASSERT_EQ(header->m_blksz, extsz);
+    }
+    for (int i = 0; i < EXTSZ_TYPE_NUM; i++) {
+        if (NVMBlockNumberIsInvalid(extents[i])) {
+            continue;
+        }
+        uint32 blkno = extents[i];
+        space->FreeExtent(&blkno);
+        space->AllocNewExtent(&blkno, static_cast<ExtentSizeType>(i));
+        ASSERT_EQ(blkno, extents[i]);
+    }
+
+    /* slice 末尾放不下的部分切成能放下的最大 extent，之后小 extent 的分配不再推高水位 */
+    uint32 blkno;
+    do {
+        space->AllocNewExtent(&blkno, EXTSZ_2M);
+    } while (space->high_water_mark() % space->SLICE_BLOCKS + GetExtentBlockCount(EXTSZ_2M) <= space->SLICE_BLOCKS);
+    uint32 rest = space->SLICE_BLOCKS - space->high_water_mark() % space->SLICE_BLOCKS;
+    space->AllocNewExtent(&blkno, EXTSZ_2M);
+    uint32 hwm = space->high_water_mark();
+    while (rest > 0) {
+        ExtentSizeType extsz = LargestExtentWithin(rest);
+        space->AllocNewExtent(&blkno, extsz);
+        ASSERT_LT(blkno, hwm - GetExtentBlockCount(EXTSZ_2M));
+        rest -= GetExtentBlockCount(extsz);
+    }
+    ASSERT_EQ(space->high_water_mark(), hwm);
+}
@@ -53,7 +53,6 @@ TEST_F(UndoTest, BasicTest)
     }
 
     UndoBootStrap(space_dir);
-    InitLocalUndoSegment();
 
     std::vector<std::pair<UndoRecPtr, int>> undo_ptr_arr;
     std::string PREFIX = "helloworld";
@@ -79,13 +78,12 @@ TEST_F(UndoTest, BasicTest)
         undo_trx_ctx->UpdateTrxSlotStatus(TRX_COMMITTED);
         undo_trx_ctx->UpdateTrxSlotCSN(TEST_CSN);
         if (i % 10 == 0) {
-            UndoSegment *undo_segment = PickSegmentForTrx();
+            UndoSegment *undo_segment = undo_trx_ctx->BoundSegment();
             undo_segment->RecycleTransactionSlot(TEST_CSN + 1);
         }
         ReleaseTrxUndoContext(undo_trx_ctx);
     }
 
-    DestroyLocalUndoSegment();
     UndoExitProcess();
 
     UndoBootStrap(space_dir);
@@ -113,7 +111,6 @@ TEST_F(UndoTest, UndoRecoveryTest)
     UndoExitProcess();
 
     UndoBootStrap(space_dir);
-    InitLocalUndoSegment();
 
     /* no undo segment switch. */
     int MAX_TRXS = UNDO_TRX_SLOTS;
@@ -125,18 +122,16 @@ TEST_F(UndoTest, UndoRecoveryTest)
         undo_trx_ctx->UpdateTrxSlotStatus(TRX_COMMITTED);
         undo_trx_ctx->UpdateTrxSlotCSN(TEST_CSN + i);
 
-        UndoSegment *undo_segment = PickSegmentForTrx();
+        UndoSegment *undo_segment = undo_trx_ctx->BoundSegment();
         undo_segment->RecycleTransactionSlot(TEST_CSN + UNDO_TRX_SLOTS / 2);
 
         ReleaseTrxUndoContext(undo_trx_ctx);
     }
     TEST_CSN += MAX_TRXS;
 
-    DestroyLocalUndoSegment();
     UndoExitProcess();
 
     UndoBootStrap(space_dir);
-    InitLocalUndoSegment();
 
     /* consume the left half slots. */
     for (int i = 0; i < MAX_TRXS / 2; i++) {
@@ -148,17 +143,14 @@ TEST_F(UndoTest, UndoRecoveryTest)
         ReleaseTrxUndoContext(undo_trx_ctx);
     }
 
-    DestroyLocalUndoSegment();
     UndoExitProcess();
 
     UndoBootStrap(space_dir);
     /* switched to an empty undo segment. */
-    InitLocalUndoSegment();
-
-    UndoSegment *undo_segment = PickSegmentForTrx();
+    UndoSegment *undo_segment = AcquireUndoSegment();
     ASSERT_EQ(undo_segment->SegmentEmpty(), true);
+    ReleaseUndoSegment(undo_segment);
 
-    DestroyLocalUndoSegment();
     UndoExitProcess();
     delete[] record_cache;
 }
\ No newline at end of file
@@ -45,6 +45,12 @@ public:
         pt->Scan(startKey, endKey, max_range, snapshot, reverse, result);
     }
 
+    /* 物理删除 [startKey, endKey) 内的全部 key，不检查可见性，调用者保证这些 key 不会再被访问 */
+    void removeRange(Key_t &startKey, Key_t &endKey)
+    {
+        pt->RemoveRange(startKey, endKey);
+    }
+
     void registerThread(int grpId = 0)
     {
         pt->RegisterThread(grpId);
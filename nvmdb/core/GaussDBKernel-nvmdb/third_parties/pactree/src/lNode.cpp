@@ -607,6 +607,43 @@ void ListNode::Prune(LookupSnapshot snapshot, uint64_t genId)
         }
     }
 }
+bool ListNode::RemoveRange(Key_t &startKey, Key_t &endKey, bool continueScan, uint64_t genId)
+{
+    VarLenString *ed_remain;
+    if (endKey >= max)
+        ed_remain = GetRemainKey(&max);
+    else
+        ed_remain = GetRemainKey(&endKey);
+    uint8_t startIndex = 0;
+    if (!continueScan) {
+        assert(startKey >= GetMin() && startKey < GetMax());
+        auto st_remain = GetRemainKey(&startKey);
+        startIndex = PermuteLowerBound(st_remain);
+        destroy_remain_key(st_remain);
+    }
+
+    bool end = false;
+    auto lpa = GetCurrPerm();
+    std::vector<std::pair<uint8, int>> remove_items;
+    for (uint8_t i = startIndex; i < lpa->count; i++) {
+        auto kv = GetKVItem(lpa->linePoint[i].offset);
+        if (kv->key >= *ed_remain) {
+            end = true;
+            break;
+        }
+        remove_items.emplace_back(i, GetKVItemSize(kv));
+    }
+    destroy_remain_key(ed_remain);
+
+    if (!remove_items.empty()) {
+        RemoveFromPermutation(remove_items);
+        if (GetCurrPerm()->count == 0) {
+            MergeEmptyNodeWithPrev(genId);
+        }
+    }
+    return end;
+}
+
 void ListNode::MergeEmptyNodeWithPrev(uint64_t genId)
 {
     OpStruct *oplog = Oplog::allocOpLog();
@@ -106,6 +106,8 @@ public:
     bool GetDeleted();
     void SetDeleted();
     void Prune(LookupSnapshot snapshot, uint64_t genId);
+    /* 删除 [startKey, endKey) 内的全部 key，调用约定同 ScanInOrder；返回 true 表示范围在本节点内结束 */
+    bool RemoveRange(Key_t &startKey, Key_t &endKey, bool continueScan, uint64_t genId);
 
     Key_t &GetMin();
     Key_t &GetMax();
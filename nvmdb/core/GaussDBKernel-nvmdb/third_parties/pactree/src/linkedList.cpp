@@ -226,9 +226,31 @@ bool LinkedList::ScanInOrder(Key_t &startKey, Key_t &endKey, ListNode *head, int
     return true;
 }
 
-void LinkedList::Recover(void *sl)
+void LinkedList::RemoveRange(Key_t &startKey, Key_t &endKey, ListNode *head)
+{
+    ListNode *cur = searchAndLockNode(head, genId, startKey);
+    bool continueScan = false;
+    while (true) {
+        bool end = cur->RemoveRange(startKey, endKey, continueScan, genId);
+        end |= endKey <= cur->GetMax();
+        cur->WriteUnlock();
+        if (end) {
+            break;
+        }
+        ListNode *next = cur->GetNext();
+        next->SpinWriteLock(genId);
+        cur = next;
+        continueScan = true;
+    }
+}
+
+void LinkedList::NewGeneration()
 {
     genId++;
+}
+
+void LinkedList::Recover(void *sl)
+{
     auto art = (SearchLayer *)sl;
 
     for (int i = 0; i < NVMDB_NUM_LOGS_PER_THREAD * NVMDB_MAX_THREAD_NUM; i++) {
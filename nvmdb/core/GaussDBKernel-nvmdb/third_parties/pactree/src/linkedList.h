@@ -33,9 +33,13 @@ public:
     bool Lookup(Key_t &key, Val_t &value, ListNode *head);
     bool ScanInOrder(Key_t &startKey, Key_t &endKey, ListNode *head, int maxRange, LookupSnapshot snapshot,
                      std::vector<std::pair<Key_t, Val_t>> &result);
+    /* 物理删除 [startKey, endKey) 内的全部 key，与 ScanInOrder 一样逐个节点加锁前进 */
+    void RemoveRange(Key_t &startKey, Key_t &endKey, ListNode *head);
     static void Print(ListNode *head);
     static uint32_t Size(ListNode *head);
     ListNode *GetHead();
+    /* 重启后作废上一次运行留下的节点锁，需在 Recover 之前调用一次 */
+    void NewGeneration();
     void Recover(void *sl);
 private:
     pptr<ListNode> headPtr;
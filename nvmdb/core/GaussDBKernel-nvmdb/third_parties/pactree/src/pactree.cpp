@@ -187,6 +187,10 @@ void CombinerThreadExec(int activeGrp)
 
 void pactreeImpl::CreateWorkerThread(int numGrp, root_obj *root)
 {
+    /* 重新打开时 slReady 仍是上一个实例留下的 true，需先复位，否则调用方会在 search layer 建好前返回 */
+    for (int i = 0; i < numGrp; i++) {
+        slReady[i] = false;
+    }
     for (int i = 0; i < numGrp * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP; i++) {
         threadInitialized[i % numGrp] = false;
         std::thread *wt = new std::thread(workerThreadExec, i, numGrp, root);
@@ -243,9 +247,7 @@ void pactreeImpl::Init(int numGrp, root_obj *root)
             ;
         }
     }
-    RegisterThread(0);
     Recover();
-    UnregisterThread();
     HYDRALIST_RESET_TIMERS();
 }
 
@@ -411,6 +413,15 @@ void pactreeImpl::Scan(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnaps
     } while (true);
 }
 
+void pactreeImpl::RemoveRange(Key_t &startKey, Key_t &endKey)
+{
+    uint64_t clock = ordo_get_clock();
+    g_curThreadData->ReadLock(clock);
+    ListNode *jumpNode = getJumpNode(startKey);
+    dl.RemoveRange(startKey, endKey, jumpNode);
+    g_curThreadData->ReadUnlock();
+}
+
 void pactreeImpl::RegisterThread(int grpId)
 {
     SetThreadGroupId(grpId);
@@ -433,10 +444,20 @@ void pactreeImpl::UnregisterThread()
     g_curThreadData->Setfinish();
 }
 
+/* 每个 group 的 search layer 由一个线程独立重放 oplog，多个 group 共用的 oplog 由最后一个处理的 group 收尾 */
 void pactreeImpl::Recover()
 {
+    dl.NewGeneration();
+    std::vector<std::thread> workers;
     for (int i = 0; i < totalGroupActive; i++) {
-        dl.Recover(g_perGrpSlPtr[i]);
+        workers.emplace_back([this, i]() {
+            RegisterThread(i);
+            dl.Recover(g_perGrpSlPtr[i]);
+            UnregisterThread();
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
     }
 }
 
@@ -42,6 +42,7 @@ public:
 
     void Scan(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot, bool reverse,
               std::vector<std::pair<Key_t, Val_t>> &result);
+    void RemoveRange(Key_t &startKey, Key_t &endKey);
     static SearchLayer *CreateSearchLayer(root_obj *root, int threadId);
     static int GetThreadGroupId();
     static void SetThreadGroupId(int grpId);
@@ -111,11 +111,30 @@ union DoubleConvT {
     uint16_t mC[4];
 };
 
+/*
+ * ctid 只有 6 个字节：RowId 的低 32 位放在 block number 中，高位加 1 放在 offset number 中，
+ * 保证 offset number 不为 0。MaxRowId 保证高位加 1 后不会溢出。
+ */
 struct NvmRowId {
-    RowId m_rowId;
-    uint16 m_reserve = 0x1234;
+    uint32 m_rowIdLow;
+    uint16 m_rowIdHigh;
+
+    void Set(RowId rowId)
+    {
+        NVMAssert(rowId <= MaxRowId);
+        m_rowIdLow = static_cast<uint32>(rowId);
+        m_rowIdHigh = static_cast<uint16>((rowId >> BIS_PER_U32) + 1);
+    }
+
+    RowId Get() const
+    {
+        return (static_cast<RowId>(m_rowIdHigh - 1) << BIS_PER_U32) | m_rowIdLow;
+    }
 } __attribute__((packed));
 
+static_assert(sizeof(NvmRowId) == sizeof(ItemPointerData), "NvmRowId is stored in ctid");
+static_assert((MaxRowId >> BIS_PER_U32) + 1 <= MAX_UINT16, "RowId does not fit in ctid");
+
 class NvmTableMap {
 public:
     auto Find(Oid oid)
@@ -279,7 +298,8 @@ void NvmDropTable(Oid oid)
         g_nvmdbTable.Erase(iter);
     }
 
-    g_heapSpace->DropTable(oid);
+    /* 删除表目录项，segment 由后台线程分批回收 */
+    HeapDropTable(oid);
 
     return;
 }
@@ -533,6 +553,44 @@ static Datum GetTypeMin(Oid type)
     return data;
 }
 
+static const struct {
+    const char *m_name;
+    ExtentSizeType m_extent;
+} g_extentSizeOptions[] = {
+    {"8k", EXTSZ_8K}, {"64k", EXTSZ_64K}, {"512k", EXTSZ_512K}, {"2m", EXTSZ_2M}, {"16m", EXTSZ_16M}, {"64m", EXTSZ_64M},
+};
+
+/* 表选项 extent_size 指定 leaf page 的大小；'auto' 表示先用小页面，表增长后再用默认大小 */
+static NVM_ERRCODE GetTableExtentOption(List *options, ExtentSizeType &extent, bool &adaptive)
+{
+    ListCell *cell = nullptr;
+    extent = HEAP_EXTENT_SIZE;
+    adaptive = false;
+    foreach (cell, options) {
+        DefElem *def = (DefElem *)lfirst(cell);
+        if (strcmp(def->defname, "extent_size") != 0) {
+            continue;
+        }
+        const char *value = defGetString(def);
+        if (pg_strcasecmp(value, "auto") == 0) {
+            adaptive = true;
+            continue;
+        }
+        bool found = false;
+        for (const auto &option : g_extentSizeOptions) {
+            if (pg_strcasecmp(value, option.m_name) == 0) {
+                extent = option.m_extent;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return NVM_ERRCODE::NVM_ERRCODE_INPUT_PARA_ERROR;
+        }
+    }
+    return NVM_ERRCODE::NVM_SUCCESS;
+}
+
 NVM_ERRCODE CreateTable(CreateForeignTableStmt *stmt, ::TransactionId tid)
 {
     TableDesc tableDesc;
@@ -540,6 +598,13 @@ NVM_ERRCODE CreateTable(CreateForeignTableStmt *stmt, ::TransactionId tid)
     Table *table = nullptr;
     NVM_ERRCODE ret = NVM_ERRCODE::NVM_SUCCESS;
     uint32 colIndex = 0;
+    ExtentSizeType leafExtent;
+    bool adaptive = false;
+
+    ret = GetTableExtentOption(stmt->options, leafExtent, adaptive);
+    if (ret != NVM_ERRCODE::NVM_SUCCESS) {
+        goto OUT;
+    }
 
     if (list_length(stmt->base.tableElts) > NVMDB_TUPLE_MAX_COL_COUNT) {
         ret = NVM_ERRCODE::NVM_ERRCODE_COL_COUNT_EXC_LIMIT;
@@ -588,7 +653,7 @@ NVM_ERRCODE CreateTable(CreateForeignTableStmt *stmt, ::TransactionId tid)
             g_nvmdbTable.Insert(std::make_pair(stmt->base.relation->foreignOid, table));
             g_tableMutex.unlock();
             g_nvmdbTableLocal.Insert(std::make_pair(stmt->base.relation->foreignOid, table));
-            uint32 tableSeg = table->CreateSegment();
+            uint32 tableSeg = table->CreateSegment(leafExtent, adaptive);
             g_heapSpace->CreateTable(TableSegMetaData{stmt->base.relation->foreignOid, tableSeg});
         } else {
             ret = NVM_ERRCODE::NVM_ERRCODE_NO_MEM;
@@ -784,6 +849,9 @@ void NVMInsertTuple2AllIndex(Transaction *trx, Table *table, RAMTuple *tuple, Ro
         indexTuple.ExtractFromTuple(tuple);
 
         IndexInsert(trx, index, &indexTuple, rowId);
+        if (NvmIsTxnInAbortState(trx)) {
+            NvmRaiseAbortTxnError();
+        }
     }
 
     return;
@@ -802,6 +870,9 @@ void NVMDeleteTupleFromAllIndex(Transaction *trx, Table *table, RAMTuple *tuple,
         indexTuple.ExtractFromTuple(tuple);
 
         IndexDelete(trx, index, &indexTuple, rowId);
+        if (NvmIsTxnInAbortState(trx)) {
+            NvmRaiseAbortTxnError();
+        }
     }
 
     return;
@@ -814,6 +885,9 @@ void NVMInsertTuple2Index(Transaction *trx, Table *table, NVMIndex *index, RAMTu
     indexTuple.ExtractFromTuple(tuple);
 
     IndexInsert(trx, index, &indexTuple, rowId);
+    if (NvmIsTxnInAbortState(trx)) {
+        NvmRaiseAbortTxnError();
+    }
 
     return;
 }
@@ -825,6 +899,9 @@ void NVMDeleteTupleFromIndex(Transaction *trx, Table *table, NVMIndex *index, RA
     indexTuple.ExtractFromTuple(tuple);
 
     IndexDelete(trx, index, &indexTuple, rowId);
+    if (NvmIsTxnInAbortState(trx)) {
+        NvmRaiseAbortTxnError();
+    }
 
     return;
 }
@@ -870,6 +947,10 @@ TupleTableSlot *NVMExecForeignInsertImplement(EState *estate, ResultRelInfo *res
     }
 
     rowId = HeapInsert(trx, table, &tuple);
+    /* undo 写不下时事务已进入 TX_WAIT_ABORT */
+    if (NvmIsTxnInAbortState(trx)) {
+        NvmRaiseAbortTxnError();
+    }
 
     NVMInsertTuple2AllIndex(trx, table, &tuple, rowId);
 
@@ -2352,6 +2433,9 @@ static TupleTableSlot *NVMIterateForeignScan(ForeignScanState *node)
             found = true;
             break;
         }
+        if (status == NVMDB::HAM_SNAPSHOT_TOO_OLD) {
+            ereport(ERROR, (errcode(ERRCODE_SNAPSHOT_INVALID), errmsg("snapshot too old")));
+        }
         iter->Next();
     }
 
@@ -2363,7 +2447,7 @@ static TupleTableSlot *NVMIterateForeignScan(ForeignScanState *node)
 
         if (festate->mCtidNum > 0) {  // update or delete
             NVMDB::NvmRowId rowId;
-            rowId.m_rowId = iter->GetRowId();
+            rowId.Set(iter->GetRowId());
             HeapTuple resultTup = ExecFetchSlotTuple(slot);
             errno_t ret = memcpy_s(&resultTup->t_self, sizeof(rowId), &rowId, sizeof(rowId));
             NVMDB::SecureRetCheck(ret);
@@ -2536,7 +2620,10 @@ static TupleTableSlot *NVMExecForeignUpdate(EState *estate, ResultRelInfo *resul
     }
 
     NVMDB::RAMTuple tuple(table->GetColDesc(), table->GetRowLen());
-    result = NVMDB::HeapRead(fdwState->mCurrTxn, fdwState->mTable, rowId.m_rowId, &tuple);
+    result = NVMDB::HeapRead(fdwState->mCurrTxn, fdwState->mTable, rowId.Get(), &tuple);
+    if (result == NVMDB::HAM_SNAPSHOT_TOO_OLD) {
+        ereport(ERROR, (errcode(ERRCODE_SNAPSHOT_INVALID), errmsg("snapshot too old")));
+    }
     if (result != NVMDB::HAM_SUCCESS) {
         NVMAssert(false);
         return nullptr;
@@ -2558,7 +2645,7 @@ static TupleTableSlot *NVMExecForeignUpdate(EState *estate, ResultRelInfo *resul
         }
     }
 
-    result = NVMDB::HeapUpdate(fdwState->mCurrTxn, fdwState->mTable, rowId.m_rowId, &tuple);
+    result = NVMDB::HeapUpdate(fdwState->mCurrTxn, fdwState->mTable, rowId.Get(), &tuple);
     if (result != NVMDB::HAM_SUCCESS) {
         ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE), errmsg("NVM Update fail(%d)!", result)));
     }
@@ -2577,8 +2664,8 @@ static TupleTableSlot *NVMExecForeignUpdate(EState *estate, ResultRelInfo *resul
     for (uint32 k = 0; k < indexCount; k++) {
         if (indexColChange[k]) {
             NVMDB::NVMIndex *index = table->GetIndex(k);
-            NVMDB::NVMInsertTuple2Index(fdwState->mCurrTxn, table, index, &tuple, rowId.m_rowId);
-            NVMDB::NVMDeleteTupleFromIndex(fdwState->mCurrTxn, table, index, &tupleOrg, rowId.m_rowId);
+            NVMDB::NVMInsertTuple2Index(fdwState->mCurrTxn, table, index, &tuple, rowId.Get());
+            NVMDB::NVMDeleteTupleFromIndex(fdwState->mCurrTxn, table, index, &tupleOrg, rowId.Get());
         }
     }
 
@@ -2609,18 +2696,21 @@ static TupleTableSlot *NVMExecForeignDelete(EState *estate, ResultRelInfo *resul
     }
 
     NVMDB::RAMTuple tuple(table->GetColDesc(), table->GetRowLen());
-    result = NVMDB::HeapRead(fdwState->mCurrTxn, table, rowId.m_rowId, &tuple);
+    result = NVMDB::HeapRead(fdwState->mCurrTxn, table, rowId.Get(), &tuple);
+    if (result == NVMDB::HAM_SNAPSHOT_TOO_OLD) {
+        ereport(ERROR, (errcode(ERRCODE_SNAPSHOT_INVALID), errmsg("snapshot too old")));
+    }
     if (result != NVMDB::HAM_SUCCESS) {
         NVMAssert(false);
         return nullptr;
     }
 
-    result = NVMDB::HeapDelete(fdwState->mCurrTxn, fdwState->mTable, rowId.m_rowId);
+    result = NVMDB::HeapDelete(fdwState->mCurrTxn, fdwState->mTable, rowId.Get());
     if (result != NVMDB::HAM_SUCCESS) {
         ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE), errmsg("NVM Delete fail(%d)!", result)));
     }
 
-    NVMDB::NVMDeleteTupleFromAllIndex(fdwState->mCurrTxn, fdwState->mTable, &tuple, rowId.m_rowId);
+    NVMDB::NVMDeleteTupleFromAllIndex(fdwState->mCurrTxn, fdwState->mTable, &tuple, rowId.Get());
 
     if (resultRelInfo->ri_projectReturning) {
         return planSlot;
@@ -2652,12 +2742,28 @@ static int NVMGetFdwType()
 
 static void NVMTruncateForeignTable(TruncateStmt *stmt, Relation rel)
 {
-    return;
+    NVMDB::Table *table = NVMDB::NvmGetTableByOid(RelationGetRelid(rel));
+    if (table == nullptr) {
+        return;
+    }
+
+    /* 新 segment 的 generation 不同，旧索引项不会再被查到，索引不需要逐行删除 */
+    if (!table->Truncate(NVMDB::NVMGetCurrentTrxContext())) {
+        NVMDB::NvmRaiseAbortTxnError();
+    }
 }
 
 static void NVMVacuumForeignTable(VacuumStmt *stmt, Relation rel)
 {
-    return;
+    /* 只有 VACUUM FULL 持有排他锁，此时才能把空页归还给 tablespace */
+    if (!(stmt->options & VACOPT_FULL)) {
+        return;
+    }
+    NVMDB::Table *table = NVMDB::NvmGetTableByOid(RelationGetRelid(rel));
+    if (table == nullptr) {
+        return;
+    }
+    NVMDB::HeapShrink(table);
 }
 
 static uint64_t NVMGetForeignRelationMemSize(Oid reloid, Oid ixoid)
@@ -2772,7 +2878,10 @@ void InitNvm()
     } else {
         ereport(INFO, (errmsg("NVMDB begin BootStrap!")));
         NVMDB::BootStrap(nvmDirPath.c_str());
-        ereport(INFO, (errmsg("NVMDB end BootStrap!")));
+        NVMDB::StartupStat stat;
+        NVMDB::GetStartupStat(&stat);
+        ereport(INFO, (errmsg("NVMDB end BootStrap! total %lu us, heap %lu us, index %lu us, undo %lu us",
+                              stat.m_totalUs, stat.m_heapMountUs, stat.m_indexMountUs, stat.m_undoMountUs)));
     }
 }
 